@@ -0,0 +1,92 @@
+#!/usr/bin/env ucode
+'use strict';
+import { basename } from "fs";
+let ubus = require("ubus");
+
+// Station presence scenarios against a spotfilter instance started with -m.
+// The devices don't need to exist, station events are looked up by name.
+
+const iface = "station-test";
+const devices = [ "sta-test0", "sta-test1" ];
+const addr = "02:5f:00:00:10:01";
+const timeout = 2;
+
+let conn = ubus.connect();
+if (!conn) {
+	warn(`${basename(sourcepath())}: can't connect to ubus\n`);
+	exit(1);
+}
+
+let failed = 0;
+
+function call(method, data)
+{
+	let ret = conn.call("spotfilter", method, data);
+	if (ret == null && conn.error())
+		warn(`${method}: ${conn.error()}\n`);
+	return ret;
+}
+
+function station(dev, present)
+{
+	call("station_event", { device: devices[dev], address: addr, present });
+}
+
+function check(name, expected)
+{
+	let cl = conn.call("spotfilter", "client_get", { interface: iface, address: addr });
+	let result = cl ? { station: !!cl.station } : null;
+
+	if (cl?.station_device)
+		result.device = cl.station_device;
+
+	if (sprintf("%J", result) == sprintf("%J", expected)) {
+		printf("%-40s ok\n", name);
+		return;
+	}
+
+	printf("%-40s FAIL\n", name);
+	warn(`expected: ${sprintf("%J", expected)}\nresult:   ${sprintf("%J", result)}\n`);
+	failed++;
+}
+
+// idle clients are removed one second after client_timeout
+function wait_idle()
+{
+	sleep((timeout + 2) * 1000);
+}
+
+call("interface_add", {
+	name: iface,
+	devices,
+	config: {
+		client_autocreate: true,
+		client_autoremove: true,
+		client_timeout: timeout,
+	}
+});
+
+station(0, true);
+check("new station", { station: true, device: devices[0] });
+
+// roaming, the new device reports the station before the old one drops it
+station(1, true);
+station(0, false);
+check("roam, NEW on dev B before DEL on dev A", { station: true, device: devices[1] });
+
+wait_idle();
+check("roamed station is not idle", { station: true, device: devices[1] });
+
+// roaming back in the usual order
+station(1, false);
+check("DEL on dev B", { station: false });
+station(0, true);
+check("NEW on dev A", { station: true, device: devices[0] });
+
+station(0, false);
+check("DEL on the reporting device", { station: false });
+
+wait_idle();
+check("idle client removed", null);
+
+exit(failed ? 1 : 0);
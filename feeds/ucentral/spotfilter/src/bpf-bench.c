@@ -0,0 +1,778 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#define _GNU_SOURCE
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_arp.h>
+#include <linux/pkt_cls.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+#include <linux/tcp.h>
+#include <linux/icmpv6.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "spotfilter-bpf.h"
+
+/*
+ * Runs the spotfilter classifiers on synthetic frames through
+ * BPF_PROG_TEST_RUN. For every case the tc verdict and class action side
+ * effects are checked; ingress frames are also run through the XDP program,
+ * which has to drop exactly the frames dropped by tc.
+ *
+ * With -s, the classifiers are instead run for one accounted client from
+ * several threads pinned to different CPUs, and the summed per-cpu
+ * client_stats counters have to match the injected packet and byte totals.
+ */
+
+enum {
+	CLASS_INVALID,
+	CLASS_ACCEPT,
+	CLASS_FWMARK,
+	CLASS_REDIRECT,
+	CLASS_REDIRECT_VLAN,
+	CLASS_DEST_MAC,
+};
+
+#define BENCH_FWMARK		0x10
+#define BENCH_FWMARK_MASK	0xff
+#define BENCH_MARK_IN		0x100
+#define BENCH_VLAN		100
+
+static const uint8_t bench_dest_mac[ETH_ALEN] = { 0x02, 0xde, 0x57, 0, 0, 1 };
+static const uint8_t bench_gw_mac[ETH_ALEN] = { 0x02, 0x9a, 0x7e, 0, 0, 1 };
+static const uint8_t bench_unknown_mac[ETH_ALEN] = { 0x02, 0x99, 0, 0, 0, 1 };
+
+static const struct bench_client {
+	uint8_t mac[ETH_ALEN];
+	const char *ip4addr;
+	const char *ip6addr;
+	uint8_t class;
+} clients[] = {
+	{ { 0x02, 0x5f, 0, 0, 0, 1 }, "192.0.2.10", "2001:db8::10", CLASS_INVALID },
+	{ { 0x02, 0x5f, 0, 0, 0, 2 }, "192.0.2.11", NULL, CLASS_FWMARK },
+	{ { 0x02, 0x5f, 0, 0, 0, 3 }, "192.0.2.12", NULL, CLASS_REDIRECT },
+	{ { 0x02, 0x5f, 0, 0, 0, 4 }, "192.0.2.13", NULL, CLASS_REDIRECT_VLAN },
+	{ { 0x02, 0x5f, 0, 0, 0, 5 }, "192.0.2.14", NULL, CLASS_DEST_MAC },
+};
+
+#define CLIENT_UNKNOWN	-1
+#define PROTO_ARP	0xff
+
+/* from net/ndisc.h, not exported to userspace */
+#define NDISC_ROUTER_ADVERTISEMENT	134
+#define NDISC_NEIGHBOUR_SOLICITATION	135
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#endif
+
+struct test_case {
+	const char *name;
+	bool egress;
+	int client;
+	uint16_t vlan;
+	int family;
+	const char *saddr;
+	const char *daddr;
+	uint8_t proto;
+	/* ICMPv6 type in sport */
+	uint16_t sport;
+	uint16_t dport;
+
+	int verdict;
+	uint32_t mark;
+	bool dest_mac;
+};
+
+static const struct test_case tests[] = {
+	{ "dhcpv4 discover", false, 0, 0, AF_INET, "0.0.0.0", "255.255.255.255",
+	  IPPROTO_UDP, 68, 67, TC_ACT_UNSPEC },
+	{ "dhcpv6 solicit", false, 0, 0, AF_INET6, "fe80::10", "ff02::1:2",
+	  IPPROTO_UDP, 546, 547, TC_ACT_UNSPEC },
+	{ "icmpv6 ns", false, 0, 0, AF_INET6, "fe80::10", "ff02::1:ff00:1",
+	  IPPROTO_ICMPV6, NDISC_NEIGHBOUR_SOLICITATION, 0, TC_ACT_UNSPEC },
+	{ "arp request", false, 0, 0, PROTO_ARP, "192.0.2.10", "192.0.2.1",
+	  0, 0, 0, TC_ACT_UNSPEC },
+	{ "dns query", false, 0, 0, AF_INET, "192.0.2.10", "192.0.2.1",
+	  IPPROTO_UDP, 40000, 53, TC_ACT_UNSPEC },
+	{ "ipv4 blocked", false, 0, 0, AF_INET, "192.0.2.10", "192.0.2.200",
+	  IPPROTO_TCP, 40000, 80, TC_ACT_SHOT },
+	{ "ipv4 whitelist host", false, 0, 0, AF_INET, "192.0.2.10", "198.51.100.1",
+	  IPPROTO_TCP, 40000, 443, TC_ACT_UNSPEC },
+	{ "ipv4 whitelist prefix", false, 0, 0, AF_INET, "192.0.2.10", "203.0.113.5",
+	  IPPROTO_TCP, 40000, 443, TC_ACT_UNSPEC },
+	{ "ipv4 spoofed source", false, 0, 0, AF_INET, "192.0.2.99", "198.51.100.1",
+	  IPPROTO_TCP, 40000, 443, TC_ACT_SHOT },
+	{ "ipv4 unknown client", false, CLIENT_UNKNOWN, 0, AF_INET, "192.0.2.50",
+	  "198.51.100.1", IPPROTO_TCP, 40000, 443, TC_ACT_SHOT },
+	{ "ipv6 blocked", false, 0, 0, AF_INET6, "2001:db8::10", "2001:db8:ffff::1",
+	  IPPROTO_TCP, 40000, 80, TC_ACT_SHOT },
+	{ "ipv6 whitelist prefix", false, 0, 0, AF_INET6, "2001:db8::10", "2001:db8:1::1",
+	  IPPROTO_TCP, 40000, 443, TC_ACT_UNSPEC },
+	{ "vlan dhcpv4", false, 0, BENCH_VLAN, AF_INET, "0.0.0.0", "255.255.255.255",
+	  IPPROTO_UDP, 68, 67, TC_ACT_UNSPEC },
+	{ "vlan dns query", false, 0, BENCH_VLAN, AF_INET, "192.0.2.10", "192.0.2.1",
+	  IPPROTO_UDP, 40000, 53, TC_ACT_UNSPEC },
+	{ "vlan ipv4 blocked", false, 0, BENCH_VLAN, AF_INET, "192.0.2.10", "192.0.2.200",
+	  IPPROTO_TCP, 40000, 80, TC_ACT_SHOT },
+	{ "action fwmark", false, 1, 0, AF_INET, "192.0.2.11", "192.0.2.200",
+	  IPPROTO_TCP, 40000, 80, TC_ACT_UNSPEC,
+	  (BENCH_MARK_IN & ~BENCH_FWMARK_MASK) | BENCH_FWMARK },
+	{ "action redirect", false, 2, 0, AF_INET, "192.0.2.12", "192.0.2.200",
+	  IPPROTO_TCP, 40000, 80, TC_ACT_REDIRECT },
+	{ "action redirect vlan", false, 3, BENCH_VLAN, AF_INET, "192.0.2.13",
+	  "192.0.2.200", IPPROTO_TCP, 40000, 80, TC_ACT_REDIRECT },
+	{ "action dest mac", false, 4, 0, AF_INET, "192.0.2.14", "192.0.2.200",
+	  IPPROTO_TCP, 40000, 80, TC_ACT_UNSPEC, 0, true },
+	{ "egress dhcpv4 offer", true, 0, 0, AF_INET, "192.0.2.1", "192.0.2.10",
+	  IPPROTO_UDP, 67, 68, TC_ACT_UNSPEC },
+	{ "egress dns response", true, 0, 0, AF_INET, "192.0.2.1", "192.0.2.10",
+	  IPPROTO_UDP, 53, 40000, TC_ACT_UNSPEC },
+	{ "egress ipv4", true, 0, 0, AF_INET, "198.51.100.1", "192.0.2.10",
+	  IPPROTO_TCP, 443, 40000, TC_ACT_UNSPEC },
+	{ "egress icmpv6 ra", true, 0, 0, AF_INET6, "fe80::1", "ff02::1",
+	  IPPROTO_ICMPV6, NDISC_ROUTER_ADVERTISEMENT, 0, TC_ACT_UNSPEC },
+};
+
+struct frame {
+	uint8_t data[256];
+	unsigned int len;
+};
+
+static struct bpf_object *obj;
+static struct ring_buffer *snoop_ring;
+static int prog_in, prog_out, prog_xdp;
+static int repeat = 10000;
+static bool verbose;
+
+static void *
+frame_put(struct frame *f, unsigned int len)
+{
+	void *ptr = f->data + f->len;
+
+	memset(ptr, 0, len);
+	f->len += len;
+
+	return ptr;
+}
+
+static void
+frame_build(struct frame *f, const struct test_case *t)
+{
+	const uint8_t *client_mac;
+	struct ethhdr *eth;
+	uint16_t proto;
+	unsigned int l3;
+
+	f->len = 0;
+	client_mac = t->client < 0 ? bench_unknown_mac : clients[t->client].mac;
+
+	if (t->family == PROTO_ARP)
+		proto = htons(ETH_P_ARP);
+	else if (t->family == AF_INET)
+		proto = htons(ETH_P_IP);
+	else
+		proto = htons(ETH_P_IPV6);
+
+	eth = frame_put(f, sizeof(*eth));
+	memcpy(eth->h_source, t->egress ? bench_gw_mac : client_mac, ETH_ALEN);
+	memcpy(eth->h_dest, t->egress ? client_mac : bench_gw_mac, ETH_ALEN);
+	eth->h_proto = proto;
+
+	if (t->vlan) {
+		uint16_t *vlh = frame_put(f, 4);
+
+		eth->h_proto = htons(ETH_P_8021Q);
+		vlh[0] = htons(t->vlan);
+		vlh[1] = proto;
+	}
+
+	l3 = f->len;
+	if (t->family == PROTO_ARP) {
+		struct arphdr *arp = frame_put(f, sizeof(*arp));
+		uint8_t *addrs = frame_put(f, 2 * (ETH_ALEN + 4));
+
+		arp->ar_hrd = htons(ARPHRD_ETHER);
+		arp->ar_pro = htons(ETH_P_IP);
+		arp->ar_hln = ETH_ALEN;
+		arp->ar_pln = 4;
+		arp->ar_op = htons(ARPOP_REQUEST);
+		memcpy(addrs, client_mac, ETH_ALEN);
+		inet_pton(AF_INET, t->saddr, addrs + ETH_ALEN);
+		inet_pton(AF_INET, t->daddr, addrs + 2 * ETH_ALEN + 4);
+		goto out;
+	}
+
+	if (t->family == AF_INET) {
+		struct iphdr *iph = frame_put(f, sizeof(*iph));
+
+		iph->version = 4;
+		iph->ihl = 5;
+		iph->ttl = 64;
+		iph->protocol = t->proto;
+		inet_pton(AF_INET, t->saddr, &iph->saddr);
+		inet_pton(AF_INET, t->daddr, &iph->daddr);
+	} else {
+		struct ipv6hdr *ip6h = frame_put(f, sizeof(*ip6h));
+
+		ip6h->version = 6;
+		ip6h->hop_limit = 64;
+		ip6h->nexthdr = t->proto;
+		inet_pton(AF_INET6, t->saddr, &ip6h->saddr);
+		inet_pton(AF_INET6, t->daddr, &ip6h->daddr);
+	}
+
+	if (t->proto == IPPROTO_UDP) {
+		struct udphdr *udph = frame_put(f, sizeof(*udph));
+
+		udph->source = htons(t->sport);
+		udph->dest = htons(t->dport);
+		udph->len = htons(sizeof(*udph) + 64);
+	} else if (t->proto == IPPROTO_TCP) {
+		struct tcphdr *tcph = frame_put(f, sizeof(*tcph));
+
+		tcph->source = htons(t->sport);
+		tcph->dest = htons(t->dport);
+		tcph->doff = sizeof(*tcph) / 4;
+		tcph->syn = 1;
+	} else {
+		struct icmp6hdr *icmp6h = frame_put(f, sizeof(*icmp6h));
+
+		icmp6h->icmp6_type = t->sport;
+	}
+
+	/* the parsers want data beyond the headers they look at */
+	frame_put(f, 64);
+
+	if (t->family == AF_INET) {
+		struct iphdr *iph = (struct iphdr *)(f->data + l3);
+
+		iph->tot_len = htons(f->len - l3);
+	} else {
+		struct ipv6hdr *ip6h = (struct ipv6hdr *)(f->data + l3);
+
+		ip6h->payload_len = htons(f->len - l3 - sizeof(*ip6h));
+	}
+
+out:
+	if (f->len < ETH_ZLEN)
+		frame_put(f, ETH_ZLEN - f->len);
+}
+
+static int
+snoop_event(void *ctx, void *data, size_t size)
+{
+	return 0;
+}
+
+static int
+map_fd(const char *name)
+{
+	int fd = bpf_object__find_map_fd_by_name(obj, name);
+
+	if (fd < 0)
+		fprintf(stderr, "Can't find map %s\n", name);
+
+	return fd;
+}
+
+static int
+maps_init(void)
+{
+	struct spotfilter_bpf_class classes[] = {
+		[CLASS_INVALID] = {},
+		[CLASS_ACCEPT] = {
+			.actions = SPOTFILTER_ACTION_VALID,
+		},
+		[CLASS_FWMARK] = {
+			.actions = SPOTFILTER_ACTION_VALID | SPOTFILTER_ACTION_FWMARK,
+			.fwmark_val = BENCH_FWMARK,
+			.fwmark_mask = BENCH_FWMARK_MASK,
+		},
+		[CLASS_REDIRECT] = {
+			.actions = SPOTFILTER_ACTION_VALID | SPOTFILTER_ACTION_REDIRECT,
+			.redirect_ifindex = 1,
+		},
+		[CLASS_REDIRECT_VLAN] = {
+			.actions = SPOTFILTER_ACTION_VALID | SPOTFILTER_ACTION_REDIRECT |
+				   SPOTFILTER_ACTION_REDIRECT_VLAN,
+			.redirect_ifindex = 1,
+			.redirect_vlan = BENCH_VLAN + 1,
+			.redirect_vlan_proto = htons(ETH_P_8021Q),
+		},
+		[CLASS_DEST_MAC] = {
+			.actions = SPOTFILTER_ACTION_VALID | SPOTFILTER_ACTION_SET_DEST_MAC,
+		},
+	};
+	struct spotfilter_whitelist_prefix_v4 prefix4 = { .prefixlen = 24 };
+	struct spotfilter_whitelist_prefix_v6 prefix6 = { .prefixlen = 48 };
+	struct spotfilter_whitelist_entry wl = { .val = CLASS_ACCEPT };
+	int fd_class, fd_client, fd_wl4, fd_prefix4, fd_prefix6;
+	struct in_addr host4;
+	uint32_t i;
+
+	memcpy(classes[CLASS_DEST_MAC].dest_mac, bench_dest_mac, ETH_ALEN);
+
+	if ((fd_class = map_fd("class")) < 0 ||
+	    (fd_client = map_fd("client")) < 0 ||
+	    (fd_wl4 = map_fd("whitelist_ipv4")) < 0 ||
+	    (fd_prefix4 = map_fd("whitelist_prefix_ipv4")) < 0 ||
+	    (fd_prefix6 = map_fd("whitelist_prefix_ipv6")) < 0)
+		return -1;
+
+	for (i = 0; i < ARRAY_SIZE(classes); i++)
+		if (bpf_map_update_elem(fd_class, &i, &classes[i], BPF_ANY))
+			return -1;
+
+	for (i = 0; i < ARRAY_SIZE(clients); i++) {
+		struct spotfilter_client_data data = {
+			.cur_class = clients[i].class,
+			.dns_class = CLASS_ACCEPT,
+		};
+
+		inet_pton(AF_INET, clients[i].ip4addr, &data.ip4addr);
+		if (clients[i].ip6addr)
+			inet_pton(AF_INET6, clients[i].ip6addr, data.ip6addr);
+
+		if (bpf_map_update_elem(fd_client, clients[i].mac, &data, BPF_ANY))
+			return -1;
+	}
+
+	inet_pton(AF_INET, "198.51.100.1", &host4);
+	inet_pton(AF_INET, "203.0.113.0", prefix4.addr);
+	inet_pton(AF_INET6, "2001:db8:1::", prefix6.addr);
+	if (bpf_map_update_elem(fd_wl4, &host4, &wl, BPF_ANY) ||
+	    bpf_map_update_elem(fd_prefix4, &prefix4, &wl, BPF_ANY) ||
+	    bpf_map_update_elem(fd_prefix6, &prefix6, &wl, BPF_ANY))
+		return -1;
+
+	return 0;
+}
+
+static int
+prog_load(const char *path)
+{
+	struct spotfilter_bpf_config config = {};
+	struct bpf_program *prog_i, *prog_e, *prog_x;
+	struct bpf_map *map = NULL;
+	int fd;
+
+	obj = bpf_object__open_file(path, NULL);
+	if (libbpf_get_error(obj)) {
+		fprintf(stderr, "Can't open %s\n", path);
+		obj = NULL;
+		return -1;
+	}
+
+	prog_i = bpf_object__find_program_by_name(obj, "spotfilter_in");
+	prog_e = bpf_object__find_program_by_name(obj, "spotfilter_out");
+	prog_x = bpf_object__find_program_by_name(obj, "spotfilter_xdp");
+	if (!prog_i || !prog_e || !prog_x) {
+		fprintf(stderr, "Can't find spotfilter programs\n");
+		return -1;
+	}
+
+	bpf_program__set_type(prog_i, BPF_PROG_TYPE_SCHED_CLS);
+	bpf_program__set_type(prog_e, BPF_PROG_TYPE_SCHED_CLS);
+	bpf_program__set_type(prog_x, BPF_PROG_TYPE_XDP);
+
+	/* same as the daemon: ringbuf snooping if supported */
+	config.snoop_ringbuf = libbpf_probe_bpf_map_type(BPF_MAP_TYPE_RINGBUF, NULL) > 0;
+	if (!config.snoop_ringbuf &&
+	    (map = bpf_object__find_map_by_name(obj, "snoop_ring")) != NULL) {
+		bpf_map__set_type(map, BPF_MAP_TYPE_ARRAY);
+		bpf_map__set_key_size(map, sizeof(uint32_t));
+		bpf_map__set_value_size(map, sizeof(uint32_t));
+		bpf_map__set_max_entries(map, 1);
+	}
+
+	map = NULL;
+	while ((map = bpf_object__next_map(obj, map)) != NULL) {
+		if (strstr(bpf_map__name(map), ".rodata"))
+			bpf_map__set_initial_value(map, &config, sizeof(config));
+	}
+
+	if (bpf_object__load(obj)) {
+		fprintf(stderr, "Can't load %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	prog_in = bpf_program__fd(prog_i);
+	prog_out = bpf_program__fd(prog_e);
+	prog_xdp = bpf_program__fd(prog_x);
+
+	if (config.snoop_ringbuf) {
+		fd = map_fd("snoop_ring");
+		if (fd >= 0)
+			snoop_ring = ring_buffer__new(fd, snoop_event, NULL, NULL);
+	}
+
+	return maps_init();
+}
+
+static int
+run_tc(const struct test_case *t, struct frame *f, int *verdict, uint32_t *ns)
+{
+	struct __sk_buff ctx = {
+		.mark = BENCH_MARK_IN,
+	};
+	uint8_t out[sizeof(f->data)];
+	LIBBPF_OPTS(bpf_test_run_opts, opts,
+		.data_in = f->data,
+		.data_size_in = f->len,
+		.data_out = out,
+		.data_size_out = sizeof(out),
+		.ctx_in = &ctx,
+		.ctx_size_in = sizeof(ctx),
+		.ctx_out = &ctx,
+		.ctx_size_out = sizeof(ctx),
+		.repeat = repeat,
+	);
+	int ret = 0;
+
+	if (bpf_prog_test_run_opts(t->egress ? prog_out : prog_in, &opts)) {
+		fprintf(stderr, "%s: test run failed: %s\n", t->name, strerror(errno));
+		return -1;
+	}
+
+	if (snoop_ring)
+		ring_buffer__consume(snoop_ring);
+
+	*verdict = (int)opts.retval;
+	*ns = opts.duration;
+
+	if (*verdict != t->verdict)
+		ret = -1;
+
+	if (t->mark && ctx.mark != t->mark) {
+		fprintf(stderr, "%s: mark 0x%x, expected 0x%x\n", t->name, ctx.mark, t->mark);
+		ret = -1;
+	}
+
+	if (t->dest_mac && memcmp(out, bench_dest_mac, ETH_ALEN) != 0) {
+		fprintf(stderr, "%s: destination MAC not rewritten\n", t->name);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+static int
+run_xdp(const struct test_case *t, struct frame *f, int *verdict, uint32_t *ns)
+{
+	LIBBPF_OPTS(bpf_test_run_opts, opts,
+		.data_in = f->data,
+		.data_size_in = f->len,
+		.repeat = repeat,
+	);
+	int expected = t->verdict == TC_ACT_SHOT ? XDP_DROP : XDP_PASS;
+
+	if (bpf_prog_test_run_opts(prog_xdp, &opts)) {
+		fprintf(stderr, "%s: XDP test run failed: %s\n", t->name, strerror(errno));
+		return -1;
+	}
+
+	*verdict = (int)opts.retval;
+	*ns = opts.duration;
+
+	return *verdict == expected ? 0 : -1;
+}
+
+static const char *
+tc_verdict_name(int verdict)
+{
+	switch (verdict) {
+	case TC_ACT_UNSPEC:
+		return "unspec";
+	case TC_ACT_OK:
+		return "ok";
+	case TC_ACT_SHOT:
+		return "shot";
+	case TC_ACT_REDIRECT:
+		return "redirect";
+	default:
+		return "other";
+	}
+}
+
+static int
+run_tests(const char *filter)
+{
+	int failed = 0;
+	unsigned int i;
+
+	printf("%-24s %-10s %8s   %-6s %8s   %s\n",
+	       "case", "tc", "ns/pkt", "xdp", "ns/pkt", "result");
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		const struct test_case *t = &tests[i];
+		int tc_verdict, xdp_verdict = 0;
+		uint32_t tc_ns, xdp_ns = 0;
+		struct frame f;
+		bool ok;
+
+		if (filter && !strstr(t->name, filter))
+			continue;
+
+		frame_build(&f, t);
+		ok = !run_tc(t, &f, &tc_verdict, &tc_ns);
+
+		/* the frame may have been modified by the class action */
+		frame_build(&f, t);
+		if (!t->egress)
+			ok &= !run_xdp(t, &f, &xdp_verdict, &xdp_ns);
+
+		if (t->egress)
+			printf("%-24s %-10s %8u   %-6s %8s   %s\n", t->name,
+			       tc_verdict_name(tc_verdict), tc_ns, "-", "-",
+			       ok ? "ok" : "FAIL");
+		else
+			printf("%-24s %-10s %8u   %-6s %8u   %s\n", t->name,
+			       tc_verdict_name(tc_verdict), tc_ns,
+			       xdp_verdict == XDP_DROP ? "drop" : "pass", xdp_ns,
+			       ok ? "ok" : "FAIL");
+
+		if (!ok && verbose)
+			fprintf(stderr, "%s: expected tc %s\n", t->name,
+				tc_verdict_name(t->verdict));
+
+		failed += !ok;
+	}
+
+	if (failed)
+		fprintf(stderr, "%d case(s) failed\n", failed);
+
+	return !!failed;
+}
+
+#define STRESS_ROUNDS	100
+
+struct stress_thread {
+	pthread_t thread;
+	int cpu;
+	int ret;
+	struct spotfilter_client_stats sent;
+};
+
+static const struct test_case *
+test_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++)
+		if (!strcmp(tests[i].name, name))
+			return &tests[i];
+
+	return NULL;
+}
+
+/* counts repeat packets of the frame, the verdict is not checked here */
+static int
+stress_prog_run(int prog, const struct test_case *t, uint64_t *packets,
+		uint64_t *bytes)
+{
+	struct frame f;
+	LIBBPF_OPTS(bpf_test_run_opts, opts,
+		.repeat = repeat,
+	);
+
+	frame_build(&f, t);
+	opts.data_in = f.data;
+	opts.data_size_in = f.len;
+	if (bpf_prog_test_run_opts(prog, &opts)) {
+		fprintf(stderr, "%s: test run failed: %s\n", t->name, strerror(errno));
+		return -1;
+	}
+
+	*packets += repeat;
+	*bytes += (uint64_t)f.len * repeat;
+
+	return 0;
+}
+
+static void *
+stress_thread_run(void *arg)
+{
+	const struct test_case *ul = test_find("ipv4 whitelist host");
+	const struct test_case *dl = test_find("egress ipv4");
+	const struct test_case *drop = test_find("ipv4 blocked");
+	struct stress_thread *t = arg;
+	struct spotfilter_client_stats *s = &t->sent;
+	cpu_set_t set;
+	int i;
+
+	CPU_ZERO(&set);
+	CPU_SET(t->cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	/* tc accounts every packet, XDP only the ones it drops */
+	for (i = 0; i < STRESS_ROUNDS; i++) {
+		if (stress_prog_run(prog_in, ul, &s->packets_ul, &s->bytes_ul) ||
+		    stress_prog_run(prog_out, dl, &s->packets_dl, &s->bytes_dl) ||
+		    stress_prog_run(prog_xdp, drop, &s->packets_ul, &s->bytes_ul)) {
+			t->ret = -1;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int
+stress_run(int n_threads)
+{
+	int ncpus = libbpf_num_possible_cpus();
+	struct spotfilter_client_stats stats[ncpus > 0 ? ncpus : 1];
+	struct spotfilter_client_stats sent = {}, sum = {};
+	struct spotfilter_client_data data;
+	struct stress_thread *threads;
+	int fd_client, fd_stats;
+	int i, ret = 0;
+
+	if (ncpus <= 0 ||
+	    (fd_client = map_fd("client")) < 0 ||
+	    (fd_stats = map_fd("client_stats")) < 0)
+		return 1;
+
+	/* enable accounting for the client used by the selected cases */
+	if (bpf_map_lookup_elem(fd_client, clients[0].mac, &data))
+		return 1;
+
+	data.flags |= SPOTFILTER_CLIENT_F_ACCT_UL | SPOTFILTER_CLIENT_F_ACCT_DL;
+	memset(stats, 0, sizeof(stats));
+	if (bpf_map_update_elem(fd_client, clients[0].mac, &data, BPF_ANY) ||
+	    bpf_map_update_elem(fd_stats, clients[0].mac, stats, BPF_ANY)) {
+		fprintf(stderr, "Can't set up the accounted client: %s\n", strerror(errno));
+		return 1;
+	}
+
+	threads = calloc(n_threads, sizeof(*threads));
+	if (!threads)
+		return 1;
+
+	for (i = 0; i < n_threads; i++) {
+		threads[i].cpu = i % sysconf(_SC_NPROCESSORS_ONLN);
+		if (pthread_create(&threads[i].thread, NULL, stress_thread_run, &threads[i])) {
+			fprintf(stderr, "Can't start thread %d\n", i);
+			n_threads = i;
+			ret = 1;
+			break;
+		}
+	}
+
+	for (i = 0; i < n_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].ret)
+			ret = 1;
+
+		sent.packets_ul += threads[i].sent.packets_ul;
+		sent.packets_dl += threads[i].sent.packets_dl;
+		sent.bytes_ul += threads[i].sent.bytes_ul;
+		sent.bytes_dl += threads[i].sent.bytes_dl;
+	}
+	free(threads);
+
+	if (bpf_map_lookup_elem(fd_stats, clients[0].mac, stats)) {
+		fprintf(stderr, "Stats entry of the accounted client is missing\n");
+		return 1;
+	}
+
+	for (i = 0; i < ncpus; i++) {
+		sum.packets_ul += stats[i].packets_ul;
+		sum.packets_dl += stats[i].packets_dl;
+		sum.bytes_ul += stats[i].bytes_ul;
+		sum.bytes_dl += stats[i].bytes_dl;
+	}
+
+	printf("%d threads, %d runs of %d packets per direction and thread\n",
+	       n_threads, STRESS_ROUNDS, repeat);
+	printf("ul: %llu/%llu packets, %llu/%llu bytes\n",
+	       (unsigned long long)sum.packets_ul, (unsigned long long)sent.packets_ul,
+	       (unsigned long long)sum.bytes_ul, (unsigned long long)sent.bytes_ul);
+	printf("dl: %llu/%llu packets, %llu/%llu bytes\n",
+	       (unsigned long long)sum.packets_dl, (unsigned long long)sent.packets_dl,
+	       (unsigned long long)sum.bytes_dl, (unsigned long long)sent.bytes_dl);
+
+	if (memcmp(&sum, &sent, sizeof(sum)) != 0) {
+		fprintf(stderr, "Per-cpu counters don't match the injected traffic\n");
+		ret = 1;
+	}
+
+	return ret;
+}
+
+static int
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] [<case filter>]\n"
+		"Options:\n"
+		"	-o <file>	BPF object (default: spotfilter-bpf.o)\n"
+		"	-r <repeat>	Runs per case (default: 10000)\n"
+		"	-s <threads>	Run the per-cpu stats stress test instead\n"
+		"	-v		Verbose output\n"
+		"\n", prog);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit limit = {
+		.rlim_cur = RLIM_INFINITY,
+		.rlim_max = RLIM_INFINITY,
+	};
+	const char *path = "spotfilter-bpf.o";
+	int stress_threads = 0;
+	int ret = 1;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "o:r:s:v")) != -1) {
+		switch (ch) {
+		case 'o':
+			path = optarg;
+			break;
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 's':
+			stress_threads = atoi(optarg);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (repeat <= 0 || stress_threads < 0)
+		return usage(argv[0]);
+
+	setrlimit(RLIMIT_MEMLOCK, &limit);
+
+	if (prog_load(path))
+		ret = 1;
+	else if (stress_threads)
+		ret = stress_run(stress_threads);
+	else
+		ret = run_tests(optind < argc ? argv[optind] : NULL);
+
+	ring_buffer__free(snoop_ring);
+	bpf_object__close(obj);
+
+	return ret;
+}
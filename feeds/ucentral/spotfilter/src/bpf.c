@@ -5,11 +5,18 @@
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <arpa/inet.h>
+#include <linux/if_link.h>
 #include <glob.h>
+#include <errno.h>
 #include <unistd.h>
 
 #include "spotfilter.h"
 
+#define SPOTFILTER_BPF_BATCH	256
+
+static int spotfilter_bpf_ncpus;
+static bool spotfilter_bpf_no_batch;
+
 static int spotfilter_bpf_pr(enum libbpf_print_level level, const char *format,
 		     va_list args)
 {
@@ -29,6 +36,99 @@ spotfilter_fill_rodata(struct bpf_object *obj, struct spotfilter_bpf_config *val
 	}
 }
 
+static bool
+spotfilter_bpf_has_ringbuf(void)
+{
+	static int supported = -1;
+
+	if (supported < 0)
+		supported = libbpf_probe_bpf_map_type(BPF_MAP_TYPE_RINGBUF, NULL) > 0;
+
+	return supported;
+}
+
+static void
+spotfilter_bpf_init_snoop(struct bpf_object *obj, struct spotfilter_bpf_config *config)
+{
+	struct bpf_map *map;
+
+	map = bpf_object__find_map_by_name(obj, "snoop_ring");
+	if (!map)
+		return;
+
+	config->snoop_ringbuf = spotfilter_bpf_has_ringbuf();
+	if (config->snoop_ringbuf)
+		return;
+
+	/* keep the object loadable, the ringbuf code is never reached */
+	bpf_map__set_type(map, BPF_MAP_TYPE_ARRAY);
+	bpf_map__set_key_size(map, sizeof(uint32_t));
+	bpf_map__set_value_size(map, sizeof(uint32_t));
+	bpf_map__set_max_entries(map, 1);
+}
+
+static void
+spotfilter_bpf_set_max_entries(struct bpf_object *obj, const char *name, uint32_t size)
+{
+	struct bpf_map *map;
+
+	map = bpf_object__find_map_by_name(obj, name);
+	if (map && size)
+		bpf_map__set_max_entries(map, size);
+}
+
+static void
+spotfilter_bpf_init_maps(struct interface *iface, struct bpf_object *obj)
+{
+	spotfilter_bpf_set_max_entries(obj, "client", iface->bpf.max_clients);
+	spotfilter_bpf_set_max_entries(obj, "client_stats", iface->bpf.max_clients);
+	spotfilter_bpf_set_max_entries(obj, "whitelist_ipv4", iface->bpf.max_whitelist);
+	spotfilter_bpf_set_max_entries(obj, "whitelist_ipv6", iface->bpf.max_whitelist);
+	spotfilter_bpf_set_max_entries(obj, "whitelist_prefix_ipv4", iface->bpf.max_whitelist_prefix);
+	spotfilter_bpf_set_max_entries(obj, "whitelist_prefix_ipv6", iface->bpf.max_whitelist_prefix);
+}
+
+static int
+spotfilter_bpf_snoop_event(void *ctx, void *data, size_t size)
+{
+	struct spotfilter_snoop_event *e = data;
+
+	if (size < sizeof(*e) || e->caplen > sizeof(e->data))
+		return 0;
+
+	spotfilter_snoop_packet(e->data, e->caplen);
+
+	return 0;
+}
+
+static void
+spotfilter_bpf_snoop_cb(struct uloop_fd *fd, unsigned int events)
+{
+	struct interface *iface = container_of(fd, struct interface, bpf.snoop_fd);
+
+	ring_buffer__consume(iface->bpf.snoop_ring);
+}
+
+static int
+spotfilter_bpf_open_snoop(struct interface *iface, struct bpf_object *obj)
+{
+	int fd;
+
+	fd = bpf_object__find_map_fd_by_name(obj, "snoop_ring");
+	if (fd < 0)
+		return -1;
+
+	iface->bpf.snoop_ring = ring_buffer__new(fd, spotfilter_bpf_snoop_event, iface, NULL);
+	if (!iface->bpf.snoop_ring)
+		return -1;
+
+	iface->bpf.snoop_fd.fd = ring_buffer__epoll_fd(iface->bpf.snoop_ring);
+	iface->bpf.snoop_fd.cb = spotfilter_bpf_snoop_cb;
+	uloop_fd_add(&iface->bpf.snoop_fd, ULOOP_READ);
+
+	return 0;
+}
+
 static void spotfilter_init_env(void)
 {
 	struct rlimit limit = {
@@ -45,7 +145,7 @@ int spotfilter_bpf_load(struct interface *iface)
 	struct spotfilter_bpf_config config = {
 		.snoop_ifindex = spotfilter_ifb_ifindex
 	};
-	struct bpf_program *prog_i, *prog_e;
+	struct bpf_program *prog_i, *prog_e, *prog_x;
 	struct bpf_object *obj;
 	int err;
 
@@ -53,6 +153,12 @@ int spotfilter_bpf_load(struct interface *iface)
 
 	spotfilter_init_env();
 
+	spotfilter_bpf_ncpus = libbpf_num_possible_cpus();
+	if (spotfilter_bpf_ncpus <= 0) {
+		fprintf(stderr, "Can't get number of possible CPUs\n");
+		return -1;
+	}
+
 	obj = bpf_object__open_file(SPOTFILTER_PROG_PATH, &opts);
 	err = libbpf_get_error(obj);
 	if (err) {
@@ -72,9 +178,18 @@ int spotfilter_bpf_load(struct interface *iface)
 		goto error;
 	}
 
+	prog_x = bpf_object__find_program_by_name(obj, "spotfilter_xdp");
+	if (!prog_x) {
+		fprintf(stderr, "Can't find XDP ingress program\n");
+		goto error;
+	}
+
 	bpf_program__set_type(prog_i, BPF_PROG_TYPE_SCHED_CLS);
 	bpf_program__set_type(prog_e, BPF_PROG_TYPE_SCHED_CLS);
+	bpf_program__set_type(prog_x, BPF_PROG_TYPE_XDP);
 
+	spotfilter_bpf_init_maps(iface, obj);
+	spotfilter_bpf_init_snoop(obj, &config);
 	spotfilter_fill_rodata(obj, &config);
 
 	err = bpf_object__load(obj);
@@ -85,13 +200,22 @@ int spotfilter_bpf_load(struct interface *iface)
 
 	iface->bpf.prog_ingress = bpf_program__fd(prog_i);
 	iface->bpf.prog_egress = bpf_program__fd(prog_e);
+	iface->bpf.prog_xdp = bpf_program__fd(prog_x);
 	if ((iface->bpf.map_class = bpf_object__find_map_fd_by_name(obj, "class")) < 0 ||
 	    (iface->bpf.map_client = bpf_object__find_map_fd_by_name(obj, "client")) < 0 ||
+	    (iface->bpf.map_client_stats = bpf_object__find_map_fd_by_name(obj, "client_stats")) < 0 ||
 	    (iface->bpf.map_whitelist_v4 = bpf_object__find_map_fd_by_name(obj, "whitelist_ipv4")) < 0 ||
-	    (iface->bpf.map_whitelist_v6 = bpf_object__find_map_fd_by_name(obj, "whitelist_ipv6")) < 0) {
+	    (iface->bpf.map_whitelist_v6 = bpf_object__find_map_fd_by_name(obj, "whitelist_ipv6")) < 0 ||
+	    (iface->bpf.map_whitelist_prefix_v4 = bpf_object__find_map_fd_by_name(obj, "whitelist_prefix_ipv4")) < 0 ||
+	    (iface->bpf.map_whitelist_prefix_v6 = bpf_object__find_map_fd_by_name(obj, "whitelist_prefix_ipv6")) < 0) {
 		perror("bpf_object__find_map_fd_by_name");
 		goto error;
 	}
+
+	if (config.snoop_ringbuf && spotfilter_bpf_open_snoop(iface, obj)) {
+		fprintf(stderr, "Can't open snoop ring buffer\n");
+		goto error;
+	}
 	iface->bpf.obj = obj;
 
 	return 0;
@@ -112,12 +236,150 @@ int spotfilter_bpf_set_client(struct interface *iface,
 			      const struct spotfilter_client_key *key,
 			      const struct spotfilter_client_data *data)
 {
-	if (!data)
+	struct spotfilter_client_stats stats[spotfilter_bpf_ncpus];
+
+	if (!data) {
+		bpf_map_delete_elem(iface->bpf.map_client_stats, key);
 		return bpf_map_delete_elem(iface->bpf.map_client, key);
+	}
+
+	/* keep the counters of existing clients */
+	memset(stats, 0, sizeof(stats));
+	bpf_map_update_elem(iface->bpf.map_client_stats, key, stats, BPF_NOEXIST);
 
 	return bpf_map_update_elem(iface->bpf.map_client, key, data, BPF_ANY);
 }
 
+int spotfilter_bpf_get_client_stats(struct interface *iface,
+				    const struct spotfilter_client_key *key,
+				    struct spotfilter_client_stats *data)
+{
+	struct spotfilter_client_stats stats[spotfilter_bpf_ncpus];
+	int i;
+
+	memset(data, 0, sizeof(*data));
+	if (bpf_map_lookup_elem(iface->bpf.map_client_stats, key, stats))
+		return -1;
+
+	for (i = 0; i < spotfilter_bpf_ncpus; i++) {
+		data->packets_ul += stats[i].packets_ul;
+		data->packets_dl += stats[i].packets_dl;
+		data->bytes_ul += stats[i].bytes_ul;
+		data->bytes_dl += stats[i].bytes_dl;
+	}
+
+	return 0;
+}
+
+void spotfilter_bpf_reset_client_stats(struct interface *iface,
+				       const struct spotfilter_client_key *key)
+{
+	struct spotfilter_client_stats stats[spotfilter_bpf_ncpus];
+
+	memset(stats, 0, sizeof(stats));
+	bpf_map_update_elem(iface->bpf.map_client_stats, key, stats, BPF_ANY);
+}
+
+static void
+spotfilter_bpf_batch_error(int err)
+{
+	/* older kernels or map types without batch ops, stop trying */
+	if (err == EINVAL || err == EOPNOTSUPP || err == ENOTSUP || err == 524)
+		spotfilter_bpf_no_batch = true;
+}
+
+static int
+spotfilter_bpf_dump_map(struct interface *iface, int fd, size_t key_size, size_t val_size,
+			void (*cb)(struct interface *iface, const void *key, const void *val))
+{
+	DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts);
+	uint64_t batch;
+	uint32_t count, i;
+	void *keys, *vals;
+	bool first = true;
+	int ret, err = 0;
+
+	if (spotfilter_bpf_no_batch)
+		return -1;
+
+	keys = calloc(SPOTFILTER_BPF_BATCH, key_size);
+	vals = calloc(SPOTFILTER_BPF_BATCH, val_size);
+	do {
+		count = SPOTFILTER_BPF_BATCH;
+		ret = bpf_map_lookup_batch(fd, first ? NULL : &batch, &batch,
+					   keys, vals, &count, &opts);
+		if (ret && errno != ENOENT) {
+			err = errno;
+			break;
+		}
+
+		for (i = 0; i < count; i++)
+			cb(iface, keys + i * key_size, vals + i * val_size);
+		first = false;
+	} while (!ret);
+
+	free(keys);
+	free(vals);
+
+	if (!err)
+		return 0;
+
+	spotfilter_bpf_batch_error(err);
+	return -1;
+}
+
+static void
+spotfilter_bpf_sync_client_data(struct interface *iface, const void *key, const void *val)
+{
+	struct client *cl;
+
+	cl = avl_find_element(&iface->clients, key, cl, node);
+	if (cl)
+		memcpy(&cl->data, val, sizeof(cl->data));
+}
+
+static void
+spotfilter_bpf_sync_client_stats(struct interface *iface, const void *key, const void *val)
+{
+	const struct spotfilter_client_stats *stats = val;
+	struct client *cl;
+	int i;
+
+	cl = avl_find_element(&iface->clients, key, cl, node);
+	if (!cl)
+		return;
+
+	for (i = 0; i < spotfilter_bpf_ncpus; i++) {
+		cl->stats.packets_ul += stats[i].packets_ul;
+		cl->stats.packets_dl += stats[i].packets_dl;
+		cl->stats.bytes_ul += stats[i].bytes_ul;
+		cl->stats.bytes_dl += stats[i].bytes_dl;
+	}
+}
+
+/*
+ * Refresh data and stats of all clients with batched map reads.
+ * On failure, the caller has to fall back to per-client lookups.
+ */
+int spotfilter_bpf_sync_clients(struct interface *iface)
+{
+	struct client *cl;
+
+	if (spotfilter_bpf_dump_map(iface, iface->bpf.map_client,
+				    sizeof(struct spotfilter_client_key),
+				    sizeof(struct spotfilter_client_data),
+				    spotfilter_bpf_sync_client_data))
+		return -1;
+
+	avl_for_each_element(&iface->clients, cl, node)
+		memset(&cl->stats, 0, sizeof(cl->stats));
+
+	return spotfilter_bpf_dump_map(iface, iface->bpf.map_client_stats,
+				       sizeof(struct spotfilter_client_key),
+				       spotfilter_bpf_ncpus * sizeof(struct spotfilter_client_stats),
+				       spotfilter_bpf_sync_client_stats);
+}
+
 static void
 __spotfilter_bpf_set_device(struct interface *iface, int ifindex, bool egress, bool enabled)
 {
@@ -142,6 +404,49 @@ __spotfilter_bpf_set_device(struct interface *iface, int ifindex, bool egress, b
 	bpf_tc_attach(&hook, &attach_tc);
 }
 
+static bool
+spotfilter_bpf_xdp_attached(int ifindex)
+{
+	struct bpf_prog_info info = {};
+	uint32_t len = sizeof(info);
+	uint32_t id = 0;
+	bool ret;
+	int fd;
+
+	if (bpf_xdp_query_id(ifindex, XDP_FLAGS_DRV_MODE, &id) || !id)
+		return false;
+
+	fd = bpf_prog_get_fd_by_id(id);
+	if (fd < 0)
+		return false;
+
+	ret = !bpf_obj_get_info_by_fd(fd, &info, &len) &&
+	      !strcmp(info.name, "spotfilter_xdp");
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * The XDP program only drops traffic early, the tc ingress classifier stays
+ * attached in any case. Only native (driver) mode is used, generic XDP runs
+ * after skb allocation and would not save anything over tc.
+ */
+static void
+spotfilter_bpf_set_xdp(struct interface *iface, int ifindex, bool enabled)
+{
+	if (!enabled) {
+		/* also covers programs left behind by a previous instance */
+		if (spotfilter_bpf_xdp_attached(ifindex))
+			bpf_xdp_detach(ifindex, XDP_FLAGS_DRV_MODE, NULL);
+		return;
+	}
+
+	if (bpf_xdp_attach(ifindex, iface->bpf.prog_xdp,
+			   XDP_FLAGS_DRV_MODE | XDP_FLAGS_UPDATE_IF_NOEXIST, NULL))
+		ULOG_INFO("XDP not available on ifindex %d, using tc only\n", ifindex);
+}
+
 void spotfilter_bpf_set_device(struct interface *iface, int ifindex, bool enabled)
 {
 	if (enabled)
@@ -149,6 +454,7 @@ void spotfilter_bpf_set_device(struct interface *iface, int ifindex, bool enable
 
 	__spotfilter_bpf_set_device(iface, ifindex, true, enabled);
 	__spotfilter_bpf_set_device(iface, ifindex, false, enabled);
+	spotfilter_bpf_set_xdp(iface, ifindex, enabled);
 }
 
 void spotfilter_bpf_update_class(struct interface *iface, uint32_t index)
@@ -186,11 +492,109 @@ void spotfilter_bpf_set_whitelist(struct interface *iface, const void *addr,
 	bpf_map_update_elem(fd, addr, &e, BPF_ANY);
 }
 
+void spotfilter_bpf_whitelist_batch_add(struct spotfilter_whitelist_batch *b,
+					const void *addr, uint8_t val)
+{
+	size_t len = b->ipv6 ? sizeof(struct in6_addr) : sizeof(struct in_addr);
+
+	if (!(b->count % SPOTFILTER_BPF_BATCH)) {
+		b->addrs = realloc(b->addrs, (b->count + SPOTFILTER_BPF_BATCH) * len);
+		b->vals = realloc(b->vals, (b->count + SPOTFILTER_BPF_BATCH) *
+					   sizeof(*b->vals));
+	}
+
+	memcpy(b->addrs + b->count * len, addr, len);
+	b->vals[b->count].val = val;
+	b->vals[b->count].seen = 0;
+	b->count++;
+}
+
+/* writes or removes all collected entries and frees the batch */
+void spotfilter_bpf_whitelist_batch_commit(struct interface *iface,
+					   struct spotfilter_whitelist_batch *b,
+					   bool remove)
+{
+	DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts);
+	int fd = b->ipv6 ? iface->bpf.map_whitelist_v6 : iface->bpf.map_whitelist_v4;
+	size_t len = b->ipv6 ? sizeof(struct in6_addr) : sizeof(struct in_addr);
+	uint32_t n = b->count;
+	uint32_t i;
+	int ret;
+
+	if (!b->count)
+		goto out;
+
+	if (spotfilter_bpf_no_batch)
+		goto fallback;
+
+	if (remove)
+		ret = bpf_map_delete_batch(fd, b->addrs, &n, &opts);
+	else
+		ret = bpf_map_update_batch(fd, b->addrs, b->vals, &n, &opts);
+
+	if (!ret)
+		goto out;
+
+	/* deleting stops at the first missing entry, that is not an error */
+	if (!remove || errno != ENOENT)
+		spotfilter_bpf_batch_error(errno);
+
+fallback:
+	for (i = 0; i < b->count; i++)
+		spotfilter_bpf_set_whitelist(iface, b->addrs + i * len, b->ipv6,
+					     remove ? NULL : &b->vals[i].val);
+
+out:
+	free(b->addrs);
+	free(b->vals);
+	b->addrs = NULL;
+	b->vals = NULL;
+	b->count = 0;
+}
+
+void spotfilter_bpf_set_whitelist_prefix(struct interface *iface, const void *addr,
+					 int prefixlen, bool ipv6, const uint8_t *state)
+{
+	int fd = ipv6 ? iface->bpf.map_whitelist_prefix_v6 : iface->bpf.map_whitelist_prefix_v4;
+	struct spotfilter_whitelist_prefix_v6 key = {
+		.prefixlen = prefixlen,
+	};
+	struct spotfilter_whitelist_entry e = {};
+	int len = ipv6 ? 16 : 4;
+	int i;
+
+	/* clear host bits, the v4 key is a prefix of the v6 layout */
+	memcpy(key.addr, addr, len);
+	for (i = 0; i < len; i++) {
+		if (prefixlen >= 8 * (i + 1))
+			continue;
+
+		if (prefixlen <= 8 * i)
+			key.addr[i] = 0;
+		else
+			key.addr[i] &= 0xff << (8 - (prefixlen - 8 * i));
+	}
+
+	if (!state) {
+		bpf_map_delete_elem(fd, &key);
+		return;
+	}
+
+	e.val = *state;
+	bpf_map_update_elem(fd, &key, &e, BPF_ANY);
+}
+
 void spotfilter_bpf_free(struct interface *iface)
 {
 	if (!iface->bpf.obj)
 		return;
 
+	if (iface->bpf.snoop_ring) {
+		uloop_fd_delete(&iface->bpf.snoop_fd);
+		ring_buffer__free(iface->bpf.snoop_ring);
+		iface->bpf.snoop_ring = NULL;
+	}
+
 	bpf_object__close(iface->bpf.obj);
 	iface->bpf.obj = NULL;
 }
@@ -7,6 +7,14 @@
 
 struct interface;
 
+/* exact match whitelist entries, written with a single map update */
+struct spotfilter_whitelist_batch {
+	void *addrs;
+	struct spotfilter_whitelist_entry *vals;
+	uint32_t count;
+	bool ipv6;
+};
+
 int spotfilter_bpf_load(struct interface *iface);
 void spotfilter_bpf_free(struct interface *iface);
 void spotfilter_bpf_set_device(struct interface *iface, int ifindex, bool enabled);
@@ -17,8 +25,21 @@ int spotfilter_bpf_get_client(struct interface *iface,
 int spotfilter_bpf_set_client(struct interface *iface,
 			      const struct spotfilter_client_key *key,
 			      const struct spotfilter_client_data *data);
+int spotfilter_bpf_get_client_stats(struct interface *iface,
+				    const struct spotfilter_client_key *key,
+				    struct spotfilter_client_stats *data);
+int spotfilter_bpf_sync_clients(struct interface *iface);
+void spotfilter_bpf_reset_client_stats(struct interface *iface,
+				       const struct spotfilter_client_key *key);
 void spotfilter_bpf_set_whitelist(struct interface *iface, const void *addr,
 				  bool ipv6, const uint8_t *state);
+void spotfilter_bpf_whitelist_batch_add(struct spotfilter_whitelist_batch *b,
+					const void *addr, uint8_t val);
+void spotfilter_bpf_whitelist_batch_commit(struct interface *iface,
+					   struct spotfilter_whitelist_batch *b,
+					   bool remove);
+void spotfilter_bpf_set_whitelist_prefix(struct interface *iface, const void *addr,
+					 int prefixlen, bool ipv6, const uint8_t *state);
 bool spotfilter_bpf_whitelist_seen(struct interface *iface, const void *addr, bool ipv6);
 
 #endif
@@ -170,4 +170,119 @@ skb_parse_tcp(struct skb_parser_info *info)
 	return tcph;
 }
 
+/* XDP frames are linear, no pulls are needed before accessing headers */
+struct xdp_parser_info {
+	struct xdp_md *xdp;
+	__u32 offset;
+	int proto;
+};
+
+static __always_inline void *
+xdp_ptr(struct xdp_md *xdp, __u32 offset, __u32 len)
+{
+	void *ptr = (void *)(long)xdp->data + offset;
+	void *end = (void *)(long)xdp->data_end;
+
+	if (ptr + len >= end)
+		return NULL;
+
+	return ptr;
+}
+
+static __always_inline void *
+xdp_info_ptr(struct xdp_parser_info *info, __u32 len)
+{
+	__u32 offset = info->offset;
+	return xdp_ptr(info->xdp, offset, len);
+}
+
+static __always_inline __u32
+xdp_len(struct xdp_md *xdp)
+{
+	return xdp->data_end - xdp->data;
+}
+
+static __always_inline void
+xdp_parse_init(struct xdp_parser_info *info, struct xdp_md *xdp)
+{
+	*info = (struct xdp_parser_info){
+		.xdp = xdp
+	};
+}
+
+static __always_inline struct ethhdr *
+xdp_parse_ethernet(struct xdp_parser_info *info)
+{
+	struct ethhdr *eth;
+
+	eth = xdp_info_ptr(info, sizeof(*eth));
+	if (!eth)
+		return NULL;
+
+	info->proto = eth->h_proto;
+	info->offset += sizeof(*eth);
+
+	return eth;
+}
+
+static __always_inline struct vlan_hdr *
+xdp_parse_vlan(struct xdp_parser_info *info)
+{
+	struct vlan_hdr *vlh;
+
+	if (info->proto != bpf_htons(ETH_P_8021Q) &&
+	    info->proto != bpf_htons(ETH_P_8021AD))
+		return NULL;
+
+	vlh = xdp_info_ptr(info, sizeof(*vlh));
+	if (!vlh)
+		return NULL;
+
+	info->proto = vlh->h_vlan_encapsulated_proto;
+	info->offset += sizeof(*vlh);
+
+	return vlh;
+}
+
+static __always_inline struct iphdr *
+xdp_parse_ipv4(struct xdp_parser_info *info)
+{
+	struct iphdr *iph;
+	int hdr_len;
+
+	if (info->proto != bpf_htons(ETH_P_IP))
+		return NULL;
+
+	iph = xdp_info_ptr(info, sizeof(*iph));
+	if (!iph)
+		return NULL;
+
+	hdr_len = iph->ihl * 4;
+	if (hdr_len < sizeof(*iph))
+		return NULL;
+
+	info->proto = iph->protocol;
+	info->offset += hdr_len;
+
+	return iph;
+}
+
+static __always_inline struct ipv6hdr *
+xdp_parse_ipv6(struct xdp_parser_info *info)
+{
+	struct ipv6hdr *ip6h;
+
+	if (info->proto != bpf_htons(ETH_P_IPV6))
+		return NULL;
+
+	ip6h = xdp_info_ptr(info, sizeof(*ip6h));
+	if (!ip6h)
+		return NULL;
+
+	info->proto = READ_ONCE(ip6h->nexthdr);
+	info->offset += sizeof(*ip6h);
+
+	return ip6h;
+}
+
 #endif
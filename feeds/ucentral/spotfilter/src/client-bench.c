@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <libubox/blobmsg.h>
+#include <libubus.h>
+
+/*
+ * Measures the latency of the client_list ubus call of a running spotfilter
+ * instance. Clients are added to the given interface with locally
+ * administered MAC addresses (02:5f:...) and removed again afterwards.
+ */
+
+static struct ubus_context *ctx;
+static struct blob_buf b;
+static const char *iface = "hotspot";
+static uint32_t obj_id;
+static int n_reply;
+
+static uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+client_msg(int i)
+{
+	char addr[18];
+
+	snprintf(addr, sizeof(addr), "02:5f:%02x:%02x:%02x:%02x",
+		 (i >> 24) & 0xff, (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+
+	blob_buf_init(&b, 0);
+	blobmsg_add_string(&b, "interface", iface);
+	blobmsg_add_string(&b, "address", addr);
+}
+
+static int
+clients_set(int start, int end, bool remove)
+{
+	int i, ret;
+
+	for (i = start; i < end; i++) {
+		client_msg(i);
+		if (!remove)
+			blobmsg_add_u32(&b, "state", 0);
+
+		ret = ubus_invoke(ctx, obj_id, remove ? "client_remove" : "client_set",
+				  b.head, NULL, NULL, 5000);
+		if (ret && !remove) {
+			fprintf(stderr, "Failed to add client %d: %s\n",
+				i, ubus_strerror(ret));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void
+list_cb(struct ubus_request *req, int type, struct blob_attr *msg)
+{
+	struct blob_attr *cur;
+	int rem;
+
+	n_reply = 0;
+	blobmsg_for_each_attr(cur, msg, rem)
+		n_reply++;
+}
+
+static int
+bench_list(int n, int rounds)
+{
+	uint64_t start, total = 0, max = 0;
+	int i, ret;
+
+	for (i = 0; i < rounds; i++) {
+		uint64_t cur;
+
+		blob_buf_init(&b, 0);
+		blobmsg_add_string(&b, "interface", iface);
+
+		start = bench_now();
+		ret = ubus_invoke(ctx, obj_id, "client_list", b.head, list_cb, NULL, 30000);
+		cur = bench_now() - start;
+		if (ret) {
+			fprintf(stderr, "client_list failed: %s\n", ubus_strerror(ret));
+			return -1;
+		}
+
+		total += cur;
+		if (cur > max)
+			max = cur;
+	}
+
+	printf("%d clients (%d listed): client_list avg %.2f ms, max %.2f ms\n",
+	       n, n_reply, (double)total / rounds / 1000000,
+	       (double)max / 1000000);
+
+	return 0;
+}
+
+static int
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] [<clients>...]\n"
+		"Options:\n"
+		"	-i <interface>	spotfilter interface (default: hotspot)\n"
+		"	-r <rounds>	client_list calls per size (default: 20)\n"
+		"	-s <path>	ubus socket path\n"
+		"\n"
+		"Client counts default to 1000 and 10000\n"
+		"\n", prog);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	static const int default_sizes[] = { 1000, 10000 };
+	const char *ubus_socket = NULL;
+	int rounds = 20, cur = 0;
+	int ret = 0;
+	int i, ch;
+
+	while ((ch = getopt(argc, argv, "i:r:s:")) != -1) {
+		switch (ch) {
+		case 'i':
+			iface = optarg;
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 's':
+			ubus_socket = optarg;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (rounds <= 0)
+		return usage(argv[0]);
+
+	ctx = ubus_connect(ubus_socket);
+	if (!ctx) {
+		fprintf(stderr, "Failed to connect to ubus\n");
+		return 1;
+	}
+
+	if (ubus_lookup_id(ctx, "spotfilter", &obj_id)) {
+		fprintf(stderr, "spotfilter is not running\n");
+		ret = 1;
+		goto out;
+	}
+
+	for (i = 0; optind + i < argc || (optind == argc && i < 2); i++) {
+		int n = optind < argc ? atoi(argv[optind + i]) : default_sizes[i];
+
+		if (n < cur)
+			n = cur;
+
+		/* keep the clients of the previous round, only add the rest */
+		if (clients_set(cur, n, false) || bench_list(n, rounds)) {
+			ret = 1;
+			cur = n;
+			break;
+		}
+
+		cur = n;
+	}
+
+	clients_set(0, cur, true);
+
+out:
+	ubus_free(ctx);
+	return ret;
+}
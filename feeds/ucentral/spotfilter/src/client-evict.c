@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#include <errno.h>
+
+#include "spotfilter.h"
+
+/*
+ * Kept out of client.c so that client-map-bench can run the same eviction
+ * code against real BPF maps.
+ */
+
+/* the longest idle client without an associated station */
+struct client *
+client_evict_candidate(struct interface *iface, struct client *skip)
+{
+	struct client *cl, *ret = NULL;
+
+	avl_for_each_element(&iface->clients, cl, node) {
+		if (cl == skip || cl->station)
+			continue;
+
+		if (!ret || cl->idle > ret->idle)
+			ret = cl;
+	}
+
+	return ret;
+}
+
+/*
+ * With client_evict, a full client map makes room by removing an idle
+ * client. Clients with an associated station are never evicted, and the
+ * stats entry is removed together with the client entry.
+ */
+int client_bpf_update(struct interface *iface, struct client *cl)
+{
+	struct client *victim;
+
+	while (spotfilter_bpf_set_client(iface, &cl->key, &cl->data)) {
+		if (!iface->client_evict || errno != E2BIG)
+			return -1;
+
+		victim = client_evict_candidate(iface, cl);
+		if (!victim)
+			return -1;
+
+		client_free(iface, victim);
+	}
+
+	return 0;
+}
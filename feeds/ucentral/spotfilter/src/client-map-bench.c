@@ -0,0 +1,289 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#include <sys/resource.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "spotfilter.h"
+
+/*
+ * Fills client and client_stats maps laid out like the ones in
+ * spotfilter-bpf.c past their capacity, through client_bpf_update() from
+ * client-evict.c. Without client_evict, the extra clients have to be
+ * rejected. With it, every extra client has to be accepted, no associated
+ * client may be lost, each victim has to be the longest idle unassociated
+ * client and both maps have to stay in sync with the client list.
+ */
+
+static struct client *inserting;
+static uint32_t evicted, evict_errors;
+static int ncpus;
+
+static uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+bench_mac_cmp(const void *k1, const void *k2, void *priv)
+{
+	return memcmp(k1, k2, ETH_ALEN);
+}
+
+static void
+client_key(struct spotfilter_client_key *key, uint32_t i)
+{
+	key->addr[0] = 0x02;
+	key->addr[1] = 0x5f;
+	key->addr[2] = i >> 24;
+	key->addr[3] = i >> 16;
+	key->addr[4] = i >> 8;
+	key->addr[5] = i;
+}
+
+/* same map updates as bpf.c */
+int spotfilter_bpf_set_client(struct interface *iface,
+			      const struct spotfilter_client_key *key,
+			      const struct spotfilter_client_data *data)
+{
+	struct spotfilter_client_stats stats[ncpus];
+
+	if (!data) {
+		bpf_map_delete_elem(iface->bpf.map_client_stats, key);
+		return bpf_map_delete_elem(iface->bpf.map_client, key);
+	}
+
+	memset(stats, 0, sizeof(stats));
+	bpf_map_update_elem(iface->bpf.map_client_stats, key, stats, BPF_NOEXIST);
+
+	return bpf_map_update_elem(iface->bpf.map_client, key, data, BPF_ANY);
+}
+
+static void
+client_delete(struct interface *iface, struct client *cl)
+{
+	avl_delete(&iface->clients, &cl->node);
+	spotfilter_bpf_set_client(iface, &cl->key, NULL);
+	free(cl);
+}
+
+/* only called by client_bpf_update() to evict a client */
+void client_free(struct interface *iface, struct client *cl)
+{
+	struct client *cur;
+
+	if (cl->station || cl == inserting)
+		evict_errors++;
+
+	avl_for_each_element(&iface->clients, cur, node) {
+		if (cur == inserting || cur->station)
+			continue;
+
+		if (cur->idle > cl->idle)
+			evict_errors++;
+	}
+
+	evicted++;
+	client_delete(iface, cl);
+}
+
+static struct client *
+client_insert(struct interface *iface, uint32_t i, bool station, int idle)
+{
+	struct client *cl;
+
+	cl = calloc(1, sizeof(*cl));
+	client_key(&cl->key, i);
+	cl->node.key = &cl->key.addr;
+	avl_insert(&iface->clients, &cl->node);
+	cl->data.ip4addr = i;
+	cl->station = station;
+	cl->idle = idle;
+
+	inserting = cl;
+	if (client_bpf_update(iface, cl)) {
+		client_delete(iface, cl);
+		cl = NULL;
+	}
+	inserting = NULL;
+
+	return cl;
+}
+
+static int
+map_run(bool evict, uint32_t size, uint32_t extra, uint32_t lookups)
+{
+	DECLARE_LIBBPF_OPTS(bpf_map_create_opts, opts,
+			    .map_flags = BPF_F_NO_PREALLOC);
+	struct spotfilter_client_stats stats[ncpus];
+	struct spotfilter_client_data data = {};
+	struct spotfilter_client_key key;
+	struct interface iface = {};
+	struct client *cl, *tmp;
+	uint32_t i, failed = 0, present = 0, station_present = 0;
+	uint32_t stations = size / 4, stats_present = 0;
+	uint64_t start, lookup_time;
+	int ret = 0;
+
+	avl_init(&iface.clients, bench_mac_cmp, false, NULL);
+	iface.client_evict = evict;
+	iface.bpf.map_client = bpf_map_create(BPF_MAP_TYPE_HASH, "client", sizeof(key),
+					      sizeof(data), size, &opts);
+	iface.bpf.map_client_stats = bpf_map_create(BPF_MAP_TYPE_PERCPU_HASH, "client_stats",
+						    sizeof(key), sizeof(stats[0]), size, &opts);
+	if (iface.bpf.map_client < 0 || iface.bpf.map_client_stats < 0) {
+		fprintf(stderr, "Failed to create map: %s\n", strerror(errno));
+		return -1;
+	}
+
+	evicted = evict_errors = 0;
+
+	/* the first clients are associated, the others idle for a while */
+	for (i = 0; i < size; i++) {
+		if (!client_insert(&iface, i, i < stations, i < stations ? 0 : rand() % 300)) {
+			fprintf(stderr, "Insert %u below capacity failed: %s\n",
+				i, strerror(errno));
+			ret = -1;
+			goto out;
+		}
+	}
+
+	if (evicted) {
+		fprintf(stderr, "Clients evicted below capacity\n");
+		ret = -1;
+	}
+
+	for (i = size; i < size + extra; i++)
+		failed += !client_insert(&iface, i, false, 0);
+
+	for (i = 0; i < size + extra; i++) {
+		bool found, found_stats, listed;
+
+		client_key(&key, i);
+		found = !bpf_map_lookup_elem(iface.bpf.map_client, &key, &data);
+		found_stats = !bpf_map_lookup_elem(iface.bpf.map_client_stats, &key, stats);
+		listed = !!avl_find(&iface.clients, &key.addr);
+		if (found != found_stats) {
+			fprintf(stderr, "Client %u: client and stats maps out of sync\n", i);
+			ret = -1;
+		}
+
+		if (found && data.ip4addr != i) {
+			fprintf(stderr, "Wrong data for client %u\n", i);
+			ret = -1;
+		}
+
+		if (found != listed) {
+			fprintf(stderr, "Client %u: map does not match the client list\n", i);
+			ret = -1;
+		}
+
+		present += found;
+		stats_present += found_stats;
+		if (found && i < stations)
+			station_present++;
+	}
+
+	start = bench_now();
+	for (i = 0; i < lookups; i++) {
+		client_key(&key, rand() % (size + extra));
+		bpf_map_lookup_elem(iface.bpf.map_client, &key, &data);
+	}
+	lookup_time = bench_now() - start;
+
+	printf("%s: %u entries, %u extra inserts (%u failed, %u evicted), %u present, "
+	       "%u/%u associated kept, %.0f ns/lookup\n",
+	       evict ? "evict" : "no evict", size, extra, failed, evicted, present,
+	       station_present, stations, (double)lookup_time / lookups);
+
+	if (evict_errors) {
+		fprintf(stderr, "%u evictions of a client that is not the longest idle "
+			"unassociated one\n", evict_errors);
+		ret = -1;
+	}
+
+	if (evict) {
+		if (failed || present != size || stats_present != size ||
+		    station_present != stations) {
+			fprintf(stderr, "Unexpected eviction behaviour\n");
+			ret = -1;
+		}
+	} else if (failed != extra || present != size || evicted) {
+		fprintf(stderr, "Hash map accepted entries past its capacity\n");
+		ret = -1;
+	}
+
+out:
+	avl_remove_all_elements(&iface.clients, cl, node, tmp)
+		free(cl);
+	close(iface.bpf.map_client_stats);
+	close(iface.bpf.map_client);
+	return ret;
+}
+
+static int
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"Options:\n"
+		"	-n <size>	Map size (default: 1000)\n"
+		"	-e <extra>	Clients inserted past capacity (default: size)\n"
+		"	-l <lookups>	Number of timed lookups (default: 100000)\n"
+		"\n", prog);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit limit = {
+		.rlim_cur = RLIM_INFINITY,
+		.rlim_max = RLIM_INFINITY,
+	};
+	int size = 1000, extra = -1, lookups = 100000;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "n:e:l:")) != -1) {
+		switch (ch) {
+		case 'n':
+			size = atoi(optarg);
+			break;
+		case 'e':
+			extra = atoi(optarg);
+			break;
+		case 'l':
+			lookups = atoi(optarg);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (extra < 0)
+		extra = size;
+
+	if (size <= 0 || lookups <= 0)
+		return usage(argv[0]);
+
+	setrlimit(RLIMIT_MEMLOCK, &limit);
+	ncpus = libbpf_num_possible_cpus();
+	if (ncpus <= 0)
+		return 1;
+
+	if (map_run(false, size, extra, lookups) ||
+	    map_run(true, size, extra, lookups))
+		return 1;
+
+	return 0;
+}
@@ -85,6 +85,7 @@ static void __client_free(struct interface *iface, struct client *cl)
 	avl_delete(&iface->clients, &cl->node);
 	kvlist_free(&cl->kvdata);
 	free(cl->device);
+	free(cl->station_dev);
 	spotfilter_bpf_set_client(iface, &cl->key, NULL);
 	free(cl);
 }
@@ -175,14 +176,11 @@ int client_set(struct interface *iface, const void *addr, const char *id,
 		cl->data.dns_class = dns_state;
 	if (accounting >= 0)
 		cl->data.flags = accounting;
-	if (flush) {
+	if (flush)
 		kvlist_free(&cl->kvdata);
-		cl->data.packets_ul = 0;
-		cl->data.packets_dl = 0;
-		cl->data.bytes_ul = 0;
-		cl->data.bytes_dl = 0;
-	}
-	spotfilter_bpf_set_client(iface, &cl->key, &cl->data);
+	client_bpf_update(iface, cl);
+	if (flush)
+		spotfilter_bpf_reset_client_stats(iface, &cl->key);
 
 	if (new_client)
 		spotfilter_ubus_notify(iface, cl, "client_add");
@@ -246,7 +244,7 @@ void client_set_ipaddr(const void *mac, const void *addr, bool ipv6, bool arp)
 		else
 			continue;
 
-		spotfilter_bpf_set_client(iface, &cl->key, &cl->data);
+		client_bpf_update(iface, cl);
 	}
 }
 
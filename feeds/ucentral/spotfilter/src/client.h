@@ -15,9 +15,14 @@ struct client {
 	struct kvlist kvdata;
 	int idle;
 
+	bool station;
+	uint32_t station_gen;
+	char *station_dev;
+
 	uint32_t arp_ip4addr;
 	struct spotfilter_client_key key;
 	struct spotfilter_client_data data;
+	struct spotfilter_client_stats stats;
 	char *device;
 };
 
@@ -25,6 +30,8 @@ int client_set(struct interface *iface, const void *addr, const char *id,
 	       int state, int dns_state, int accounting, struct blob_attr *data,
 	       const char *device, bool flush);
 void client_free(struct interface *iface, struct client *cl);
+struct client *client_evict_candidate(struct interface *iface, struct client *skip);
+int client_bpf_update(struct interface *iface, struct client *cl);
 void client_set_ipaddr(const void *mac, const void *addr, bool ipv6, bool arp);
 void client_set_arp_ipaddr(const void *mac, const void *addr);
 void client_init_interface(struct interface *iface);
@@ -51,8 +51,11 @@ interface_check_device(struct interface *iface, struct device *dev)
 	int old_ifindex = dev->ifindex;
 
 	dev->ifindex = if_nametoindex(device_name(dev));
-	if (dev->ifindex != old_ifindex)
-		spotfilter_bpf_set_device(iface, dev->ifindex, true);
+	if (dev->ifindex == old_ifindex)
+		return;
+
+	spotfilter_bpf_set_device(iface, dev->ifindex, true);
+	spotfilter_nl80211_resync();
 }
 
 static void
@@ -212,9 +215,42 @@ interface_check_whitelist(struct blob_attr *attr)
 	return true;
 }
 
+static int
+interface_parse_prefix(const char *str, void *addr, bool *ipv6)
+{
+	char buf[INET6_ADDRSTRLEN];
+	const char *sep;
+	unsigned long len;
+	char *err;
+	int max_len;
+
+	*ipv6 = strchr(str, ':');
+	max_len = *ipv6 ? 128 : 32;
+
+	sep = strchr(str, '/');
+	if (!sep)
+		return inet_pton(*ipv6 ? AF_INET6 : AF_INET, str, addr) == 1 ? max_len : -1;
+
+	if (sep - str >= (int)sizeof(buf))
+		return -1;
+
+	memcpy(buf, str, sep - str);
+	buf[sep - str] = 0;
+
+	len = strtoul(sep + 1, &err, 10);
+	if (!sep[1] || *err || len > max_len)
+		return -1;
+
+	if (inet_pton(*ipv6 ? AF_INET6 : AF_INET, buf, addr) != 1)
+		return -1;
+
+	return len;
+}
+
 static void
 interface_whitelist_set(struct interface *iface, bool add)
 {
+	struct spotfilter_whitelist_batch wl4 = {}, wl6 = { .ipv6 = true };
 	struct blob_attr *tb[__WL_ATTR_MAX];
 	struct blob_attr *attr, *cur;
 	unsigned int class = 0;
@@ -239,20 +275,29 @@ interface_whitelist_set(struct interface *iface, bool add)
 		}
 
 		blobmsg_for_each_attr(cur, tb[WL_ATTR_ADDRS], rem2) {
-			const char *addrstr = blobmsg_get_string(cur);
-			bool ipv6 = strchr(addrstr, ':');
 			union {
 				struct in_addr in;
 				struct in6_addr in6;
 			} addr = {};
 			uint8_t val = class;
+			bool ipv6;
+			int len;
 
-			if (inet_pton(ipv6 ? AF_INET6 : AF_INET, addrstr, &addr) != 1)
+			len = interface_parse_prefix(blobmsg_get_string(cur), &addr, &ipv6);
+			if (len < 0)
 				continue;
 
-			spotfilter_bpf_set_whitelist(iface, &addr, ipv6, add ? &val : NULL);
+			/* full length entries stay in the exact match map */
+			if (len == (ipv6 ? 128 : 32))
+				spotfilter_bpf_whitelist_batch_add(ipv6 ? &wl6 : &wl4, &addr, val);
+			else
+				spotfilter_bpf_set_whitelist_prefix(iface, &addr, len, ipv6,
+								    add ? &val : NULL);
 		}
 	}
+
+	spotfilter_bpf_whitelist_batch_commit(iface, &wl4, !add);
+	spotfilter_bpf_whitelist_batch_commit(iface, &wl6, !add);
 }
 
 
@@ -265,6 +310,7 @@ interface_set_config(struct interface *iface, bool iface_init)
 		CONFIG_ATTR_ACTIVE_TIMEOUT,
 		CONFIG_ATTR_CLIENT_AUTOCREATE,
 		CONFIG_ATTR_CLIENT_AUTOREMOVE,
+		CONFIG_ATTR_CLIENT_EVICT,
 		CONFIG_ATTR_CLIENT_TIMEOUT,
 		CONFIG_ATTR_DEFAULT_CLASS,
 		CONFIG_ATTR_DEFAULT_DNS_CLASS,
@@ -277,6 +323,7 @@ interface_set_config(struct interface *iface, bool iface_init)
 		[CONFIG_ATTR_CLIENT_TIMEOUT] = { "client_timeout", BLOBMSG_TYPE_INT32 },
 		[CONFIG_ATTR_CLIENT_AUTOCREATE] = { "client_autocreate", BLOBMSG_TYPE_BOOL },
 		[CONFIG_ATTR_CLIENT_AUTOREMOVE] = { "client_autoremove", BLOBMSG_TYPE_BOOL },
+		[CONFIG_ATTR_CLIENT_EVICT] = { "client_evict", BLOBMSG_TYPE_BOOL },
 		[CONFIG_ATTR_DEFAULT_CLASS] = { "default_class", BLOBMSG_TYPE_INT32 },
 		[CONFIG_ATTR_DEFAULT_DNS_CLASS] = { "default_dns_class", BLOBMSG_TYPE_INT32 },
 	};
@@ -306,6 +353,7 @@ interface_set_config(struct interface *iface, bool iface_init)
 		iface->whitelist = cur;
 	else
 		iface->whitelist = NULL;
+	spotfilter_dns_whitelist_update(iface);
 
 	if ((cur = tb[CONFIG_ATTR_ACTIVE_TIMEOUT]) != NULL)
 		iface->active_timeout = blobmsg_get_u32(cur);
@@ -327,6 +375,11 @@ interface_set_config(struct interface *iface, bool iface_init)
 	else
 		iface->client_autoremove = true;
 
+	if ((cur = tb[CONFIG_ATTR_CLIENT_EVICT]) != NULL)
+		iface->client_evict = blobmsg_get_u8(cur);
+	else
+		iface->client_evict = false;
+
 	blobmsg_for_each_attr(cur, tb[CONFIG_ATTR_CLASS], rem) {
 		struct spotfilter_bpf_class cdata = {};
 		int index;
@@ -355,6 +408,43 @@ interface_set_config(struct interface *iface, bool iface_init)
 	interface_whitelist_set(iface, true);
 }
 
+static void
+interface_set_bpf_config(struct interface *iface, struct blob_attr *config)
+{
+	enum {
+		BPF_ATTR_MAX_CLIENTS,
+		BPF_ATTR_MAX_WHITELIST,
+		BPF_ATTR_MAX_WHITELIST_PREFIX,
+		__BPF_ATTR_MAX,
+	};
+	static const struct blobmsg_policy policy[__BPF_ATTR_MAX] = {
+		[BPF_ATTR_MAX_CLIENTS] = { "max_clients", BLOBMSG_TYPE_INT32 },
+		[BPF_ATTR_MAX_WHITELIST] = { "max_whitelist", BLOBMSG_TYPE_INT32 },
+		[BPF_ATTR_MAX_WHITELIST_PREFIX] = { "max_whitelist_prefix", BLOBMSG_TYPE_INT32 },
+	};
+	struct blob_attr *tb[__BPF_ATTR_MAX] = {};
+	struct blob_attr *cur;
+
+	if (config)
+		blobmsg_parse(policy, __BPF_ATTR_MAX, tb,
+			      blobmsg_data(config), blobmsg_len(config));
+
+	if ((cur = tb[BPF_ATTR_MAX_CLIENTS]) != NULL && blobmsg_get_u32(cur))
+		iface->bpf.max_clients = blobmsg_get_u32(cur);
+	else
+		iface->bpf.max_clients = 1000;
+
+	if ((cur = tb[BPF_ATTR_MAX_WHITELIST]) != NULL && blobmsg_get_u32(cur))
+		iface->bpf.max_whitelist = blobmsg_get_u32(cur);
+	else
+		iface->bpf.max_whitelist = 10000;
+
+	if ((cur = tb[BPF_ATTR_MAX_WHITELIST_PREFIX]) != NULL && blobmsg_get_u32(cur))
+		iface->bpf.max_whitelist_prefix = blobmsg_get_u32(cur);
+	else
+		iface->bpf.max_whitelist_prefix = 1000;
+}
+
 void interface_check_devices(void)
 {
 	struct interface *iface;
@@ -384,6 +474,7 @@ void interface_add(const char *name, struct blob_attr *config,
 		vlist_init(&iface->devices, avl_strcmp, device_update_cb);
 		client_init_interface(iface);
 		spotfilter_dns_init(iface);
+		interface_set_bpf_config(iface, config);
 
 		if (spotfilter_bpf_load(iface)) {
 			free(iface);
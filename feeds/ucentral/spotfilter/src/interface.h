@@ -9,6 +9,8 @@
 #include <libubox/blobmsg.h>
 #include <libubox/uloop.h>
 
+#include "timer-wheel.h"
+
 struct bpf_object;
 
 struct interface {
@@ -17,11 +19,18 @@ struct interface {
 	struct blob_attr *config;
 	struct blob_attr *whitelist;
 
+	struct dns_whitelist dns_whitelist;
 	struct avl_tree cname_cache;
 	struct avl_tree addr_map;
 
-	struct uloop_timeout addr_gc;
-	uint32_t next_gc;
+	struct timer_wheel addr_timers;
+	struct timer_wheel cname_timers;
+
+	struct {
+		uint32_t last_usec;
+		uint32_t max_usec;
+		uint64_t expired;
+	} dns_gc;
 
 	uint32_t active_timeout;
 
@@ -30,17 +39,29 @@ struct interface {
 
 	bool client_autocreate;
 	bool client_autoremove;
+	bool client_evict;
 	int client_timeout;
 
 	struct {
 		struct bpf_object *obj;
+		struct ring_buffer *snoop_ring;
+		struct uloop_fd snoop_fd;
+
+		/* map sizes, only applied when the program is loaded */
+		uint32_t max_clients;
+		uint32_t max_whitelist;
+		uint32_t max_whitelist_prefix;
 
 		int prog_ingress;
 		int prog_egress;
+		int prog_xdp;
 		int map_class;
 		int map_client;
+		int map_client_stats;
 		int map_whitelist_v4;
 		int map_whitelist_v6;
+		int map_whitelist_prefix_v4;
+		int map_whitelist_prefix_v6;
 	} bpf;
 
 	struct spotfilter_bpf_class cdata[SPOTFILTER_NUM_CLASS];
@@ -73,6 +73,8 @@ static int usage(const char *progname)
 {
 	fprintf(stderr, "Usage: %s [options]\n"
 		"Options:\n"
+		"	-m		Take station events from ubus (station_event)\n"
+		"			instead of nl80211, for testing\n"
 		"\n", progname);
 
 	return 1;
@@ -83,8 +85,11 @@ int main(int argc, char **argv)
 	int ret = 2;
 	int ch;
 
-	while ((ch = getopt(argc, argv, "")) != -1) {
+	while ((ch = getopt(argc, argv, "m")) != -1) {
 		switch (ch) {
+		case 'm':
+			spotfilter_mock_stations = true;
+			break;
 		default:
 			return usage(argv[0]);
 		}
@@ -96,9 +101,11 @@ int main(int argc, char **argv)
 	if (rtnl_init())
 		return 1;
 
-	if (spotfilter_nl80211_init())
+	if (!spotfilter_mock_stations && spotfilter_nl80211_init())
 		return 1;
 
+	spotfilter_station_init();
+
 	if (spotfilter_dev_init())
 		return 1;
 
@@ -113,6 +120,7 @@ int main(int argc, char **argv)
 out:
 	interface_done();
 	spotfilter_dev_done();
+	spotfilter_station_done();
 	spotfilter_nl80211_done();
 	uloop_done();
 
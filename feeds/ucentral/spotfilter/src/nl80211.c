@@ -22,9 +22,12 @@
 static struct nl_sock *genl;
 static struct nl_cb *genl_cb;
 static struct uloop_fd genl_fd;
-static struct uloop_timeout update_timer;
+static struct uloop_timeout sync_timer;
 static int nl80211_id;
 
+/* full station dump to catch missed events */
+#define NL80211_SYNC_INTERVAL	60
+
 static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err,
 			 void *arg)
 {
@@ -132,7 +135,9 @@ static int nl_get_multicast_id(struct nl_sock *sock, const char *family, const c
 static void
 nl80211_sock_cb(struct uloop_fd *fd, unsigned int events)
 {
-	nl_recvmsgs(genl, genl_cb);
+	/* socket overrun, events were lost */
+	if (nl_recvmsgs(genl, genl_cb) == -NLE_NOMEM)
+		uloop_timeout_set(&sync_timer, 1);
 }
 
 static void
@@ -150,32 +155,62 @@ nl80211_device_update(struct interface *iface, struct device *dev)
 	nl_wait_for_ack(genl);
 }
 
-static void
-nl80211_interface_update(struct interface *iface)
+static void spotfilter_nl80211_sync(struct uloop_timeout *t)
 {
-	struct client *cl, *tmp;
+	struct interface *iface;
 	struct device *dev;
 
-	avl_for_each_element_safe(&iface->clients, cl, node, tmp) {
-		if (cl->idle++ < iface->client_timeout)
-			continue;
-
-		if (iface->client_autoremove)
-			client_free(iface, cl);
+	spotfilter_station_sync_begin();
+	avl_for_each_element(&interfaces, iface, node) {
+		vlist_for_each_element(&iface->devices, dev, node) {
+			if (dev->ifindex)
+				nl80211_device_update(iface, dev);
+		}
 	}
+	spotfilter_station_sync_end();
 
-	vlist_for_each_element(&iface->devices, dev, node)
-		nl80211_device_update(iface, dev);
+	uloop_timeout_set(t, NL80211_SYNC_INTERVAL * 1000);
 }
 
-static void spotfilter_nl80211_update(struct uloop_timeout *t)
+void spotfilter_nl80211_resync(void)
 {
-	struct interface *iface;
+	if (!genl)
+		return;
 
-	avl_for_each_element(&interfaces, iface, node)
-		nl80211_interface_update(iface);
+	uloop_timeout_set(&sync_timer, 1);
+}
 
-	uloop_timeout_set(t, 1000);
+/*
+ * Look up a single station on all devices of the interface, used when a
+ * client is added or removed through ubus instead of waiting for the next
+ * full sync. A reply for an associated station is handled like a
+ * NEW_STATION event, devices without the station answer with an error.
+ */
+void spotfilter_nl80211_station_query(struct interface *iface, const void *addr)
+{
+	struct nl_msg *msg;
+	struct device *dev;
+
+	if (!genl)
+		return;
+
+	vlist_for_each_element(&iface->devices, dev, node) {
+		if (!dev->ifindex)
+			continue;
+
+		msg = nlmsg_alloc();
+		if (!msg)
+			return;
+
+		genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, nl80211_id, 0, 0,
+			    NL80211_CMD_GET_STATION, 0);
+		nla_put_u32(msg, NL80211_ATTR_IFINDEX, dev->ifindex);
+		nla_put(msg, NL80211_ATTR_MAC, ETH_ALEN, addr);
+
+		nl_send_auto_complete(genl, msg);
+		nlmsg_free(msg);
+		nl_wait_for_ack(genl);
+	}
 }
 
 static int no_seq_check(struct nl_msg *msg, void *arg)
@@ -189,35 +224,23 @@ static int valid_msg(struct nl_msg *msg, void *arg)
 	struct nlattr *tb[NL80211_ATTR_MAX + 1];
 	struct interface *iface;
 	struct device *dev;
-	struct client *cl;
-	const void *addr;
-	int ifindex;
 
 	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
 		  genlmsg_attrlen(gnlh, 0), NULL);
 
-	if (gnlh->cmd != NL80211_CMD_NEW_STATION)
+	if (gnlh->cmd != NL80211_CMD_NEW_STATION &&
+	    gnlh->cmd != NL80211_CMD_DEL_STATION)
 		return NL_SKIP;
 
 	if (!tb[NL80211_ATTR_IFINDEX] || !tb[NL80211_ATTR_MAC])
 		return NL_SKIP;
 
-	ifindex = nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
-	addr = nla_data(tb[NL80211_ATTR_MAC]);
-
-	avl_for_each_element(&interfaces, iface, node)
-		vlist_for_each_element(&iface->devices, dev, node)
-			if (dev->ifindex == ifindex)
-				goto found;
-
-	return NL_SKIP;
+	if (!spotfilter_station_find_device(nla_get_u32(tb[NL80211_ATTR_IFINDEX]),
+					    NULL, &iface, &dev))
+		return NL_SKIP;
 
-found:
-	cl = avl_find_element(&iface->clients, addr, cl, node);
-	if (cl)
-		cl->idle = 0;
-	else if (iface->client_autocreate)
-		client_set(iface, addr, NULL, -1, -1, -1, NULL, device_name(dev), false);
+	spotfilter_station_update(iface, dev, nla_data(tb[NL80211_ATTR_MAC]),
+				  gnlh->cmd == NL80211_CMD_NEW_STATION);
 
 	return NL_SKIP;
 }
@@ -254,8 +277,8 @@ int spotfilter_nl80211_init(void)
 	genl_fd.cb = nl80211_sock_cb;
 	uloop_fd_add(&genl_fd, ULOOP_READ);
 
-	update_timer.cb = spotfilter_nl80211_update;
-	uloop_timeout_set(&update_timer, 1);
+	sync_timer.cb = spotfilter_nl80211_sync;
+	uloop_timeout_set(&sync_timer, 1);
 
 	return 0;
 
@@ -269,7 +292,7 @@ void spotfilter_nl80211_done(void)
 	if (!genl)
 		return;
 
-	uloop_timeout_cancel(&update_timer);
+	uloop_timeout_cancel(&sync_timer);
 	uloop_fd_delete(&genl_fd);
 	nl_socket_free(genl);
 	genl = NULL;
@@ -0,0 +1,424 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Sends synthetic frames into one end of a veth pair and receives them on
+ * the other end the same way the spotfilter snoop socket does, either with
+ * one recvfrom per packet or through the TPACKET_V3 ring. Reports the
+ * receive rate, kernel drops and the delay between sending a frame and
+ * processing it, which includes the ring block retire timeout.
+ *
+ * The veth pair has to be set up beforehand:
+ *
+ *	ip link add snoop-bench0 type veth peer name snoop-bench1
+ *	ip link set snoop-bench0 up
+ *	ip link set snoop-bench1 up
+ */
+
+/* same ring layout as snoop.c */
+#define RING_BLOCK_SIZE		(1 << 16)
+#define RING_BLOCK_NR		16
+#define RING_FRAME_SIZE		2048
+#define RING_TIMEOUT_MS		1
+
+/* local experimental ethertype, ignored by the network stack */
+#define BENCH_ETH_P		0x88b5
+#define BENCH_IDLE_MS		200
+
+enum {
+	BENCH_SOCKET,
+	BENCH_RING,
+};
+
+static const char *mode_names[] = {
+	[BENCH_SOCKET] = "socket",
+	[BENCH_RING] = "ring",
+};
+
+struct bench_hdr {
+	struct ethhdr eth;
+	uint64_t seq;
+	uint64_t ts;
+} __attribute__((packed));
+
+struct bench_opts {
+	const char *tx_ifname;
+	const char *rx_ifname;
+	size_t n_packets;
+	size_t rate;
+	size_t len;
+	int timeout;
+	int mode;
+};
+
+static struct {
+	int fd;
+	void *map;
+	unsigned int block;
+} rx;
+
+static struct {
+	uint64_t *lat;
+	size_t received;
+	uint64_t first_ts;
+	uint64_t last;
+} result;
+
+static volatile bool tx_done;
+static size_t tx_sent;
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#endif
+
+static uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+packet_socket(const char *ifname, uint16_t proto)
+{
+	struct sockaddr_ll sll = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(proto),
+	};
+	int fd;
+
+	sll.sll_ifindex = if_nametoindex(ifname);
+	if (!sll.sll_ifindex) {
+		fprintf(stderr, "Interface %s not found\n", ifname);
+		return -1;
+	}
+
+	fd = socket(AF_PACKET, SOCK_RAW, htons(proto));
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	if (bind(fd, (struct sockaddr *)&sll, sizeof(sll))) {
+		perror("bind");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void *
+tx_thread(void *arg)
+{
+	struct bench_opts *o = arg;
+	uint8_t *buf = calloc(1, o->len);
+	struct bench_hdr *hdr = (struct bench_hdr *)buf;
+	uint64_t start;
+	int fd;
+
+	fd = packet_socket(o->tx_ifname, 0);
+	if (fd < 0)
+		goto out;
+
+	memset(hdr->eth.h_dest, 0xff, ETH_ALEN);
+	memcpy(hdr->eth.h_source, "\x02\x5b\x00\x00\x00\x01", ETH_ALEN);
+	hdr->eth.h_proto = htons(BENCH_ETH_P);
+
+	start = bench_now();
+	for (size_t i = 0; i < o->n_packets; i++) {
+		if (o->rate) {
+			uint64_t next = start + i * 1000000000ULL / o->rate;
+
+			while (bench_now() < next)
+				;
+		}
+
+		hdr->seq = i;
+		hdr->ts = bench_now();
+		if (send(fd, buf, o->len, 0) < 0) {
+			if (errno == ENOBUFS || errno == EAGAIN || errno == EINTR) {
+				i--;
+				continue;
+			}
+
+			perror("send");
+			break;
+		}
+		tx_sent++;
+	}
+
+	close(fd);
+out:
+	free(buf);
+	tx_done = true;
+	return NULL;
+}
+
+static void
+rx_frame(struct bench_opts *o, const void *data, size_t len)
+{
+	const struct bench_hdr *hdr = data;
+	uint64_t now = bench_now();
+
+	if (len < sizeof(*hdr) || hdr->eth.h_proto != htons(BENCH_ETH_P) ||
+	    hdr->seq >= o->n_packets || result.received >= o->n_packets)
+		return;
+
+	if (!result.received)
+		result.first_ts = hdr->ts;
+	result.lat[result.received++] = now - hdr->ts;
+	result.last = now;
+}
+
+static void
+rx_socket(struct bench_opts *o)
+{
+	static uint8_t buf[8192];
+	int len;
+
+	while ((len = recvfrom(rx.fd, buf, sizeof(buf), MSG_DONTWAIT, NULL, NULL)) > 0)
+		rx_frame(o, buf, len);
+}
+
+static void
+rx_ring(struct bench_opts *o)
+{
+	while (1) {
+		struct tpacket_block_desc *bd;
+		struct tpacket3_hdr *h;
+		unsigned int i;
+
+		bd = rx.map + rx.block * RING_BLOCK_SIZE;
+		if (!(bd->hdr.bh1.block_status & TP_STATUS_USER))
+			break;
+
+		__sync_synchronize();
+
+		h = (void *)bd + bd->hdr.bh1.offset_to_first_pkt;
+		for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+			rx_frame(o, (void *)h + h->tp_mac, h->tp_snaplen);
+			h = (void *)h + h->tp_next_offset;
+		}
+
+		__sync_synchronize();
+		bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		rx.block = (rx.block + 1) % RING_BLOCK_NR;
+	}
+}
+
+static int
+rx_init(struct bench_opts *o)
+{
+	struct tpacket_req3 req = {
+		.tp_block_size = RING_BLOCK_SIZE,
+		.tp_block_nr = RING_BLOCK_NR,
+		.tp_frame_size = RING_FRAME_SIZE,
+		.tp_frame_nr = RING_BLOCK_SIZE / RING_FRAME_SIZE * RING_BLOCK_NR,
+		.tp_retire_blk_tov = o->timeout,
+	};
+	int ver = TPACKET_V3;
+
+	rx.fd = packet_socket(o->rx_ifname, ETH_P_ALL);
+	if (rx.fd < 0)
+		return -1;
+
+	if (o->mode != BENCH_RING)
+		return 0;
+
+	if (setsockopt(rx.fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) ||
+	    setsockopt(rx.fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))) {
+		perror("setsockopt");
+		return -1;
+	}
+
+	rx.map = mmap(NULL, RING_BLOCK_SIZE * RING_BLOCK_NR, PROT_READ | PROT_WRITE,
+		      MAP_SHARED, rx.fd, 0);
+	if (rx.map == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+u64_cmp(const void *a1, const void *a2)
+{
+	uint64_t v1 = *(const uint64_t *)a1, v2 = *(const uint64_t *)a2;
+
+	return v1 < v2 ? -1 : v1 > v2;
+}
+
+static int
+bench_run(struct bench_opts *o)
+{
+	struct tpacket_stats_v3 st = {};
+	socklen_t st_len = sizeof(st);
+	struct pollfd pfd = {
+		.events = POLLIN,
+	};
+	uint64_t idle_start = 0;
+	pthread_t thread;
+	uint64_t *lat;
+	size_t n;
+
+	if (rx_init(o))
+		return 1;
+
+	result.lat = calloc(o->n_packets, sizeof(*result.lat));
+	pfd.fd = rx.fd;
+
+	/* drop anything queued before the test starts */
+	if (o->mode == BENCH_RING)
+		rx_ring(o);
+	else
+		rx_socket(o);
+	result.received = 0;
+	getsockopt(rx.fd, SOL_PACKET, PACKET_STATISTICS, &st, &st_len);
+
+	if (pthread_create(&thread, NULL, tx_thread, o)) {
+		perror("pthread_create");
+		return 1;
+	}
+
+	while (result.received < o->n_packets) {
+		size_t prev = result.received;
+
+		poll(&pfd, 1, 10);
+		if (o->mode == BENCH_RING)
+			rx_ring(o);
+		else
+			rx_socket(o);
+
+		if (!tx_done || result.received != prev) {
+			idle_start = 0;
+			continue;
+		}
+
+		if (!idle_start)
+			idle_start = bench_now();
+		else if (bench_now() - idle_start > BENCH_IDLE_MS * 1000000ULL)
+			break;
+	}
+	pthread_join(thread, NULL);
+
+	st_len = sizeof(st);
+	getsockopt(rx.fd, SOL_PACKET, PACKET_STATISTICS, &st, &st_len);
+
+	n = result.received;
+	lat = result.lat;
+	qsort(lat, n, sizeof(*lat), u64_cmp);
+
+	if (o->mode == BENCH_RING)
+		printf("ring (retire timeout %d ms)", o->timeout);
+	else
+		printf("socket");
+	printf(", %zu byte frames: %zu sent, %zu received, %u dropped",
+	       o->len, tx_sent, n, st.tp_drops);
+	if (o->mode == BENCH_RING)
+		printf(", %u queue freezes", st.tp_freeze_q_cnt);
+	printf("\n");
+
+	if (n)
+		printf("%.0f pkts/s, latency p50 %llu us, p90 %llu us, p99 %llu us, max %llu us\n",
+		       n * 1e9 / (result.last - result.first_ts),
+		       (unsigned long long)lat[n / 2] / 1000,
+		       (unsigned long long)lat[n * 9 / 10] / 1000,
+		       (unsigned long long)lat[n * 99 / 100] / 1000,
+		       (unsigned long long)lat[n - 1] / 1000);
+
+	if (rx.map)
+		munmap(rx.map, RING_BLOCK_SIZE * RING_BLOCK_NR);
+	close(rx.fd);
+	free(result.lat);
+
+	return n ? 0 : 1;
+}
+
+static int
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"Options:\n"
+		"	-i <ifname>	Transmit interface (default: snoop-bench0)\n"
+		"	-I <ifname>	Receive interface (default: snoop-bench1)\n"
+		"	-m <mode>	Receive mode: socket, ring (default: ring)\n"
+		"	-n <packets>	Number of packets (default: 100000)\n"
+		"	-r <pps>	Transmit rate, 0 for unlimited (default: 0)\n"
+		"	-l <len>	Frame length (default: 300)\n"
+		"	-t <ms>		Ring block retire timeout (default: %d)\n"
+		"\n", prog, RING_TIMEOUT_MS);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts o = {
+		.tx_ifname = "snoop-bench0",
+		.rx_ifname = "snoop-bench1",
+		.n_packets = 100000,
+		.len = 300,
+		.timeout = RING_TIMEOUT_MS,
+		.mode = BENCH_RING,
+	};
+	int ch;
+
+	while ((ch = getopt(argc, argv, "i:I:m:n:r:l:t:")) != -1) {
+		switch (ch) {
+		case 'i':
+			o.tx_ifname = optarg;
+			break;
+		case 'I':
+			o.rx_ifname = optarg;
+			break;
+		case 'm':
+			for (o.mode = 0; o.mode < (int)ARRAY_SIZE(mode_names); o.mode++)
+				if (!strcmp(mode_names[o.mode], optarg))
+					break;
+			if (o.mode == ARRAY_SIZE(mode_names))
+				return usage(argv[0]);
+			break;
+		case 'n':
+			o.n_packets = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			o.rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			o.len = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			o.timeout = atoi(optarg);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (!o.n_packets || o.len < sizeof(struct bench_hdr) ||
+	    o.len > RING_FRAME_SIZE || o.timeout <= 0)
+		return usage(argv[0]);
+
+	return bench_run(&o);
+}
@@ -7,16 +7,16 @@
 #include <netinet/ip.h>
 #include <netinet/ip6.h>
 #include <netinet/udp.h>
-#include <netpacket/packet.h>
+#include <linux/if_packet.h>
 #include <net/if.h>
 #include <net/if_arp.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <fnmatch.h>
 #include <resolv.h>
 
 #include <libubox/uloop.h>
@@ -45,9 +45,28 @@
 #define MAX_NAME_LEN            256
 #define MAX_DATA_LEN            8096
 
+#define CNAME_TIMEOUT		5
+
+#define RING_BLOCK_SIZE		(1 << 16)
+#define RING_BLOCK_NR		16
+#define RING_FRAME_SIZE		2048
+/*
+ * A TPACKET_V3 block is only handed to userspace when it is full or when
+ * the retire timer expires, so under light load every snooped DNS response
+ * waits for up to this long before its addresses are whitelisted. The kernel
+ * rounds the timeout up to a jiffy (10 ms with HZ=100).
+ */
+#define RING_TIMEOUT_MS		1
+
 int spotfilter_ifb_ifindex;
 static struct uloop_fd ufd;
-static struct uloop_timeout cname_gc_timer;
+static struct uloop_timeout dns_gc_timer;
+static struct spotfilter_snoop_stats snoop_stats;
+
+static struct {
+	void *map;
+	unsigned int block;
+} ring;
 
 struct arp_packet {
 	uint16_t hwtype;
@@ -108,13 +127,14 @@ struct addr_entry_data {
 
 struct addr_entry {
 	struct avl_node node;
+	struct timer_wheel_entry timer;
 	struct addr_entry_data data;
 };
 
 struct cname_entry {
 	struct avl_node node;
+	struct timer_wheel_entry timer;
 	uint8_t class;
-	uint8_t age;
 };
 
 static uint32_t spotfilter_gettime(void)
@@ -190,7 +210,8 @@ cname_cache_set(struct interface *iface, const char *name, int class)
 		avl_insert(&iface->cname_cache, &e->node);
 	}
 
-	e->age = 0;
+	timer_wheel_add(&iface->cname_timers, &e->timer,
+			spotfilter_gettime() + CNAME_TIMEOUT);
 	e->class = (uint8_t)class;
 }
 
@@ -209,8 +230,8 @@ cname_cache_get(struct interface *iface, const char *name, int *class)
 	return 0;
 }
 
-static bool
-__spotfilter_dns_whitelist_lookup(struct blob_attr *attr, const char *name, int *class)
+static void
+__spotfilter_dns_whitelist_add(struct interface *iface, struct blob_attr *attr, int index)
 {
 	enum {
 		WL_ATTR_CLASS,
@@ -228,32 +249,34 @@ __spotfilter_dns_whitelist_lookup(struct blob_attr *attr, const char *name, int
 	blobmsg_parse(policy, __WL_ATTR_MAX, tb, blobmsg_data(attr), blobmsg_len(attr));
 
 	if (!tb[WL_ATTR_CLASS] || !tb[WL_ATTR_HOSTS])
-		return false;
-
-	blobmsg_for_each_attr(cur, tb[WL_ATTR_HOSTS], rem) {
-		if (fnmatch(blobmsg_get_string(cur), name, 0))
-			continue;
-
-		*class = blobmsg_get_u32(tb[WL_ATTR_CLASS]);
-		return true;
-	}
+		return;
 
-	return false;
+	blobmsg_for_each_attr(cur, tb[WL_ATTR_HOSTS], rem)
+		dns_whitelist_add(&iface->dns_whitelist, blobmsg_get_string(cur), index,
+				  blobmsg_get_u32(tb[WL_ATTR_CLASS]));
 }
 
-static void
-spotfilter_dns_whitelist_lookup(struct interface *iface, const char *name, int *class)
+/* host patterns point into iface->whitelist, call on every update */
+void spotfilter_dns_whitelist_update(struct interface *iface)
 {
 	struct blob_attr *cur;
+	int index = 0;
 	int rem;
 
+	dns_whitelist_free(&iface->dns_whitelist);
+	dns_whitelist_init(&iface->dns_whitelist);
+
 	if (!iface->whitelist)
 		return;
 
-	blobmsg_for_each_attr(cur, iface->whitelist, rem) {
-		if (__spotfilter_dns_whitelist_lookup(cur, name, class))
-			return;
-	}
+	blobmsg_for_each_attr(cur, iface->whitelist, rem)
+		__spotfilter_dns_whitelist_add(iface, cur, index++);
+}
+
+static void
+spotfilter_dns_whitelist_lookup(struct interface *iface, const char *name, int *class)
+{
+	dns_whitelist_lookup(&iface->dns_whitelist, name, class);
 }
 
 static void
@@ -262,7 +285,6 @@ spotfilter_dns_whitelist_map_add(struct interface *iface, const struct addr_entr
 {
 	struct addr_entry *e;
 	uint8_t val = (uint8_t)class;
-	int32_t delta;
 
 	if (class < 0)
 		return;
@@ -276,11 +298,8 @@ spotfilter_dns_whitelist_map_add(struct interface *iface, const struct addr_entr
 	}
 
 	spotfilter_bpf_set_whitelist(iface, ipv6 ? data->ip6addr : &data->ip4addr, ipv6, &val);
-	e->data.timeout = spotfilter_gettime() + data->timeout;
-
-	delta = e->data.timeout - iface->next_gc;
-	if (iface->next_gc && delta < 0)
-		uloop_timeout_set(&iface->addr_gc, data->timeout);
+	timer_wheel_add(&iface->addr_timers, &e->timer,
+			spotfilter_gettime() + data->timeout);
 }
 
 static int
@@ -514,6 +533,119 @@ retry:
 	spotfilter_packet_cb(&pkt);
 }
 
+/*
+ * packets copied to the BPF ring buffer by the classifier. The ring is
+ * mapped read-only, so the packet is copied before parsing.
+ */
+void spotfilter_snoop_packet(const void *data, unsigned int len)
+{
+	static uint8_t buf[SPOTFILTER_SNOOP_MAX_LEN];
+	struct packet pkt = {
+		.head = buf,
+		.buffer = buf,
+		.len = len,
+	};
+
+	if (len > sizeof(buf))
+		return;
+
+	memcpy(buf, data, len);
+
+	snoop_stats.ringbuf_packets++;
+	spotfilter_packet_cb(&pkt);
+}
+
+/* process all blocks retired by the kernel since the last wakeup */
+static void
+spotfilter_ring_cb(struct uloop_fd *fd, unsigned int events)
+{
+	while (1) {
+		struct tpacket_block_desc *bd;
+		struct tpacket3_hdr *h;
+		unsigned int i;
+
+		bd = ring.map + ring.block * RING_BLOCK_SIZE;
+		if (!(bd->hdr.bh1.block_status & TP_STATUS_USER))
+			break;
+
+		__sync_synchronize();
+
+		h = (void *)bd + bd->hdr.bh1.offset_to_first_pkt;
+		for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+			struct packet pkt = {
+				.head = (void *)h + h->tp_mac,
+				.buffer = (void *)h + h->tp_mac,
+				.len = h->tp_snaplen,
+			};
+
+			spotfilter_packet_cb(&pkt);
+			h = (void *)h + h->tp_next_offset;
+		}
+
+		__sync_synchronize();
+		bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		ring.block = (ring.block + 1) % RING_BLOCK_NR;
+	}
+}
+
+static int
+spotfilter_ring_init(int sock)
+{
+	struct tpacket_req3 req = {
+		.tp_block_size = RING_BLOCK_SIZE,
+		.tp_block_nr = RING_BLOCK_NR,
+		.tp_frame_size = RING_FRAME_SIZE,
+		.tp_frame_nr = RING_BLOCK_SIZE / RING_FRAME_SIZE * RING_BLOCK_NR,
+		.tp_retire_blk_tov = RING_TIMEOUT_MS,
+	};
+	int ver = TPACKET_V3;
+
+	if (setsockopt(sock, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) ||
+	    setsockopt(sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)))
+		return -1;
+
+	ring.map = mmap(NULL, RING_BLOCK_SIZE * RING_BLOCK_NR, PROT_READ | PROT_WRITE,
+			MAP_SHARED, sock, 0);
+	if (ring.map == MAP_FAILED) {
+		memset(&req, 0, sizeof(req));
+		setsockopt(sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+		ring.map = NULL;
+		return -1;
+	}
+
+	ring.block = 0;
+
+	return 0;
+}
+
+static void
+spotfilter_ring_free(void)
+{
+	if (!ring.map)
+		return;
+
+	munmap(ring.map, RING_BLOCK_SIZE * RING_BLOCK_NR);
+	ring.map = NULL;
+}
+
+void spotfilter_snoop_get_stats(struct spotfilter_snoop_stats *stats)
+{
+	struct tpacket_stats_v3 st = {};
+	socklen_t len = sizeof(st);
+
+	/* the kernel resets its counters on every read */
+	if (ufd.registered &&
+	    !getsockopt(ufd.fd, SOL_PACKET, PACKET_STATISTICS, &st, &len)) {
+		snoop_stats.packets += st.tp_packets;
+		snoop_stats.drops += st.tp_drops;
+		if (len >= sizeof(st))
+			snoop_stats.freeze_count += st.tp_freeze_q_cnt;
+	}
+
+	*stats = snoop_stats;
+	stats->ring = !!ring.map;
+}
+
 static int
 spotfilter_open_socket(void)
 {
@@ -529,6 +661,10 @@ spotfilter_open_socket(void)
 		return -1;
 	}
 
+	if (spotfilter_ring_init(sock))
+		ULOG_WARN("failed to set up packet ring, using recvfrom: %s\n",
+			  strerror(errno));
+
 	sll.sll_ifindex = if_nametoindex(SPOTFILTER_IFB_NAME);
 	if (bind(sock, (struct sockaddr *)&sll, sizeof(sll))) {
 		ULOG_ERR("failed to bind socket to "SPOTFILTER_IFB_NAME": %s\n",
@@ -539,69 +675,75 @@ spotfilter_open_socket(void)
 	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
 
 	ufd.fd = sock;
-	ufd.cb = spotfilter_socket_cb;
+	ufd.cb = ring.map ? spotfilter_ring_cb : spotfilter_socket_cb;
 	uloop_fd_add(&ufd, ULOOP_READ);
 
 	return 0;
 
 error:
+	spotfilter_ring_free();
 	close(sock);
 	return -1;
 }
 
 
 static void
-spotfilter_addr_gc(struct uloop_timeout *t)
+spotfilter_addr_expire(struct timer_wheel *w, struct timer_wheel_entry *t)
 {
-	struct interface *iface = container_of(t, struct interface, addr_gc);
-	struct addr_entry *e, *tmp;
-	uint32_t now = spotfilter_gettime();
-	int32_t timeout = 0;
-
-	iface->next_gc = 0;
-	avl_for_each_element_safe(&iface->addr_map, e, node, tmp) {
-		const void *addr = e->data.ip6addr[0] ? &e->data.ip6addr[0] : &e->data.ip4addr;
-		bool ipv6 = !!e->data.ip6addr[0];
-		int32_t cur_timeout;
-
-		cur_timeout = e->data.timeout - now;
-		if (cur_timeout <= 0) {
-			if (!spotfilter_bpf_whitelist_seen(iface, addr, ipv6)) {
-				spotfilter_bpf_set_whitelist(iface, addr, ipv6, NULL);
-				avl_delete(&iface->addr_map, &e->node);
-				free(e);
-				continue;
-			}
-
-			e->data.timeout = now + iface->active_timeout;
-		}
-
-		if (!timeout || cur_timeout < timeout) {
-			timeout = cur_timeout;
-			iface->next_gc = e->data.timeout;
-		}
+	struct interface *iface = container_of(w, struct interface, addr_timers);
+	struct addr_entry *e = container_of(t, struct addr_entry, timer);
+	const void *addr = e->data.ip6addr[0] ? &e->data.ip6addr[0] : &e->data.ip4addr;
+	bool ipv6 = !!e->data.ip6addr[0];
+
+	/* still in use, keep it for another active_timeout */
+	if (spotfilter_bpf_whitelist_seen(iface, addr, ipv6)) {
+		timer_wheel_add(w, t, w->now + iface->active_timeout);
+		return;
 	}
 
-	if (!timeout)
-		return;
+	spotfilter_bpf_set_whitelist(iface, addr, ipv6, NULL);
+	avl_delete(&iface->addr_map, &e->node);
+	free(e);
+}
+
+static void
+spotfilter_cname_expire(struct timer_wheel *w, struct timer_wheel_entry *t)
+{
+	struct interface *iface = container_of(w, struct interface, cname_timers);
+	struct cname_entry *e = container_of(t, struct cname_entry, timer);
+
+	avl_delete(&iface->cname_cache, &e->node);
+	free(e);
+}
+
+static uint64_t
+spotfilter_gettime_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	uloop_timeout_set(&iface->addr_gc, timeout * 1000);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
 }
 
 static void
-spotfilter_cname_cache_gc(struct uloop_timeout *timeout)
+spotfilter_dns_gc(struct uloop_timeout *timeout)
 {
+	uint32_t now = spotfilter_gettime();
 	struct interface *iface;
-	struct cname_entry *e, *tmp;
 
 	avl_for_each_element(&interfaces, iface, node) {
-		avl_for_each_element_safe(&iface->cname_cache, e, node, tmp) {
-			if (e->age++ < 5)
-				continue;
+		uint64_t start = spotfilter_gettime_usec();
+		uint32_t usec;
 
-			avl_delete(&iface->cname_cache, &e->node);
-			free(e);
-		}
+		iface->dns_gc.expired +=
+			timer_wheel_advance(&iface->addr_timers, now, spotfilter_addr_expire) +
+			timer_wheel_advance(&iface->cname_timers, now, spotfilter_cname_expire);
+
+		usec = spotfilter_gettime_usec() - start;
+		iface->dns_gc.last_usec = usec;
+		if (usec > iface->dns_gc.max_usec)
+			iface->dns_gc.max_usec = usec;
 	}
 
 	uloop_timeout_set(timeout, 1000);
@@ -617,21 +759,29 @@ void spotfilter_dns_init(struct interface *iface)
 {
 	avl_init(&iface->cname_cache, avl_strcmp, false, NULL);
 	avl_init(&iface->addr_map, avl_addr_cmp, false, NULL);
-	iface->addr_gc.cb = spotfilter_addr_gc;
+	timer_wheel_init(&iface->addr_timers, spotfilter_gettime());
+	timer_wheel_init(&iface->cname_timers, spotfilter_gettime());
+	dns_whitelist_init(&iface->dns_whitelist);
 }
 
 void spotfilter_dns_free(struct interface *iface)
 {
 	struct cname_entry *e, *tmp;
+	struct addr_entry *a, *atmp;
 
 	avl_remove_all_elements(&iface->cname_cache, e, node, tmp)
 		free(e);
+
+	avl_remove_all_elements(&iface->addr_map, a, node, atmp)
+		free(a);
+
+	dns_whitelist_free(&iface->dns_whitelist);
 }
 
 int spotfilter_dev_init(void)
 {
-	cname_gc_timer.cb = spotfilter_cname_cache_gc;
-	spotfilter_cname_cache_gc(&cname_gc_timer);
+	dns_gc_timer.cb = spotfilter_dns_gc;
+	spotfilter_dns_gc(&dns_gc_timer);
 
 	spotfilter_dev_done();
 
@@ -649,6 +799,7 @@ void spotfilter_dev_done(void)
 {
 	if (ufd.registered) {
 		uloop_fd_delete(&ufd);
+		spotfilter_ring_free();
 		close(ufd.fd);
 	}
 
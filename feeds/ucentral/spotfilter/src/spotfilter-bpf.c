@@ -38,6 +38,14 @@ struct {
 	__uint(map_flags, BPF_F_NO_PREALLOC);
 } client SEC(".maps");
 
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(key_size, sizeof(struct spotfilter_client_key));
+	__type(value, struct spotfilter_client_stats);
+	__uint(max_entries, 1000);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+} client_stats SEC(".maps");
+
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
 	__uint(key_size, sizeof(struct in_addr));
@@ -54,6 +62,63 @@ struct {
 	__uint(map_flags, BPF_F_NO_PREALLOC);
 } whitelist_ipv6 SEC(".maps");
 
+struct {
+	__uint(type, BPF_MAP_TYPE_LPM_TRIE);
+	__uint(key_size, sizeof(struct spotfilter_whitelist_prefix_v4));
+	__type(value, struct spotfilter_whitelist_entry);
+	__uint(max_entries, 1000);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+} whitelist_prefix_ipv4 SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LPM_TRIE);
+	__uint(key_size, sizeof(struct spotfilter_whitelist_prefix_v6));
+	__type(value, struct spotfilter_whitelist_entry);
+	__uint(max_entries, 1000);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+} whitelist_prefix_ipv6 SEC(".maps");
+
+/* replaced with a placeholder map by userspace if unsupported */
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(max_entries, 256 * 1024);
+} snoop_ring SEC(".maps");
+
+/* larger packets are left to the clone path instead of being truncated */
+static __always_inline bool
+snoop_ringbuf(struct __sk_buff *skb)
+{
+	struct spotfilter_snoop_event *e;
+	uint32_t len = skb->len;
+
+	if (len > SPOTFILTER_SNOOP_MAX_LEN || len < ETH_HLEN)
+		return false;
+
+	e = bpf_ringbuf_reserve(&snoop_ring, sizeof(*e), 0);
+	if (!e)
+		return false;
+
+	e->len = skb->len;
+	e->caplen = len;
+	if (bpf_skb_load_bytes(skb, 0, e->data, len)) {
+		bpf_ringbuf_discard(e, 0);
+		return false;
+	}
+
+	bpf_ringbuf_submit(e, 0);
+	return true;
+}
+
+/* the ifb clone is used without ringbuf support or if the ring is full */
+static __always_inline void
+snoop_packet(struct __sk_buff *skb)
+{
+	if (config.snoop_ringbuf && snoop_ringbuf(skb))
+		return;
+
+	bpf_clone_redirect(skb, config.snoop_ifindex, BPF_F_INGRESS);
+}
+
 static bool
 is_dhcpv4_port(uint16_t port)
 {
@@ -61,15 +126,11 @@ is_dhcpv4_port(uint16_t port)
 }
 
 static __always_inline bool
-check_ipv4_control(struct skb_parser_info *info)
+check_ipv4_control(int proto, void *l4)
 {
-	struct udphdr *udph;
-
-	if (info->proto != IPPROTO_UDP)
-		return false;
+	struct udphdr *udph = l4;
 
-	udph = skb_info_ptr(info, sizeof(*udph));
-	if (!udph)
+	if (proto != IPPROTO_UDP || !udph)
 		return false;
 
 	return is_dhcpv4_port(udph->source) && is_dhcpv4_port(udph->dest);
@@ -100,24 +161,19 @@ is_icmpv6_control(uint8_t type)
 }
 
 static __always_inline bool
-check_ipv6_control(struct skb_parser_info *info)
+check_ipv6_control(int proto, void *l4)
 {
-	if (info->proto == IPPROTO_UDP) {
-		struct udphdr *udph;
+	if (!l4)
+		return false;
 
-		udph = skb_info_ptr(info, sizeof(*udph));
-		if (!udph)
-			return false;
+	if (proto == IPPROTO_UDP) {
+		struct udphdr *udph = l4;
 
 		return is_dhcpv6_port(udph->source) && is_dhcpv6_port(udph->dest);
 	}
 
-	if (info->proto == IPPROTO_ICMPV6) {
-		struct icmp6hdr *icmp6h;
-
-		icmp6h = skb_info_ptr(info, sizeof(*icmp6h));
-		if (!icmp6h)
-			return false;
+	if (proto == IPPROTO_ICMPV6) {
+		struct icmp6hdr *icmp6h = l4;
 
 		return is_icmpv6_control(icmp6h->icmp6_type);
 	}
@@ -126,15 +182,11 @@ check_ipv6_control(struct skb_parser_info *info)
 }
 
 static __always_inline bool
-check_dns(struct skb_parser_info *info, bool ingress)
+check_dns(int proto, void *l4, bool ingress)
 {
-	struct udphdr *udph;
+	struct udphdr *udph = l4;
 
-	if (info->proto != IPPROTO_UDP)
-		return false;
-
-	udph = skb_info_ptr(info, sizeof(*udph));
-	if (!udph)
+	if (proto != IPPROTO_UDP || !udph)
 		return false;
 
 	if (ingress)
@@ -143,14 +195,53 @@ check_dns(struct skb_parser_info *info, bool ingress)
 	return udph->source == bpf_htons(53);
 }
 
+static __always_inline struct spotfilter_whitelist_entry *
+whitelist_lookup_ipv4(uint32_t *addr)
+{
+	struct spotfilter_whitelist_prefix_v4 key = {
+		.prefixlen = 32,
+	};
+	struct spotfilter_whitelist_entry *wl_val;
+
+	/* exact matches of DNS learned hosts take precedence */
+	wl_val = bpf_map_lookup_elem(&whitelist_ipv4, addr);
+	if (wl_val) {
+		wl_val->seen = 1;
+		return wl_val;
+	}
+
+	memcpy(key.addr, addr, sizeof(key.addr));
+	return bpf_map_lookup_elem(&whitelist_prefix_ipv4, &key);
+}
+
+static __always_inline struct spotfilter_whitelist_entry *
+whitelist_lookup_ipv6(struct in6_addr *addr)
+{
+	struct spotfilter_whitelist_prefix_v6 key = {
+		.prefixlen = 128,
+	};
+	struct spotfilter_whitelist_entry *wl_val;
+
+	wl_val = bpf_map_lookup_elem(&whitelist_ipv6, addr);
+	if (wl_val) {
+		wl_val->seen = 1;
+		return wl_val;
+	}
+
+	memcpy(key.addr, addr, sizeof(key.addr));
+	return bpf_map_lookup_elem(&whitelist_prefix_ipv6, &key);
+}
+
 SEC("tc/egress")
 int spotfilter_out(struct __sk_buff *skb)
 {
+	struct spotfilter_client_stats *stats;
 	struct spotfilter_client_data *cl;
 	struct skb_parser_info info;
 	struct ethhdr *eth;
 	bool is_control = false;
 	bool is_dns = false;
+	void *l4;
 
 	skb_parse_init(&info, skb);
 	eth = skb_parse_ethernet(&info);
@@ -158,24 +249,27 @@ int spotfilter_out(struct __sk_buff *skb)
 		return TC_ACT_UNSPEC;
 
 	cl = bpf_map_lookup_elem(&client, eth->h_dest);
-	if (cl && (cl->flags & SPOTFILTER_CLIENT_F_ACCT_DL)) {
-		cl->packets_dl++;
-		cl->bytes_dl += skb->len;
+	if (cl && (cl->flags & SPOTFILTER_CLIENT_F_ACCT_DL) &&
+	    (stats = bpf_map_lookup_elem(&client_stats, eth->h_dest)) != NULL) {
+		stats->packets_dl++;
+		stats->bytes_dl += skb->len;
 	}
 
 	skb_parse_vlan(&info);
 	if (skb_parse_ipv4(&info, sizeof(struct udphdr))) {
-		is_control = check_ipv4_control(&info);
-		is_dns = check_dns(&info, false);
+		l4 = skb_info_ptr(&info, sizeof(struct udphdr));
+		is_control = check_ipv4_control(info.proto, l4);
+		is_dns = check_dns(info.proto, l4, false);
 	} else if (skb_parse_ipv6(&info, sizeof(struct icmp6hdr))) {
-		is_control = check_ipv6_control(&info);
-		is_dns = check_dns(&info, false);
+		l4 = skb_info_ptr(&info, sizeof(struct icmp6hdr));
+		is_control = check_ipv6_control(info.proto, l4);
+		is_dns = check_dns(info.proto, l4, false);
 	} else {
 		return TC_ACT_UNSPEC;
 	}
 
 	if (is_control || is_dns)
-		bpf_clone_redirect(skb, config.snoop_ifindex, BPF_F_INGRESS);
+		snoop_packet(skb);
 
 	return TC_ACT_UNSPEC;
 }
@@ -184,6 +278,7 @@ SEC("tc/ingress")
 int spotfilter_in(struct __sk_buff *skb)
 {
 	struct spotfilter_client_data *cl, cldata = {};
+	struct spotfilter_client_stats *stats;
 	struct spotfilter_bpf_class *c, cdata;
 	struct skb_parser_info info;
 	struct ipv6hdr *ip6h;
@@ -195,6 +290,7 @@ int spotfilter_in(struct __sk_buff *skb)
 	bool is_dns = false;
 	struct spotfilter_whitelist_entry *wl_val = NULL;
 	uint32_t cur_class;
+	void *l4;
 
 	skb_parse_init(&info, skb);
 	eth = skb_parse_ethernet(&info);
@@ -204,31 +300,34 @@ int spotfilter_in(struct __sk_buff *skb)
 	cl = bpf_map_lookup_elem(&client, eth->h_source);
 	if (cl) {
 		cldata = *cl;
-		if (cl->flags & SPOTFILTER_CLIENT_F_ACCT_UL) {
-			cl->packets_ul++;
-			cl->bytes_ul += skb->len;
+		if ((cl->flags & SPOTFILTER_CLIENT_F_ACCT_UL) &&
+		    (stats = bpf_map_lookup_elem(&client_stats, eth->h_source)) != NULL) {
+			stats->packets_ul++;
+			stats->bytes_ul += skb->len;
 		}
 	}
 
 	has_vlan = !!skb_parse_vlan(&info);
 	if ((iph = skb_parse_ipv4(&info, sizeof(struct udphdr))) != NULL) {
 		addr_match = iph->saddr == cldata.ip4addr;
-		is_control = check_ipv4_control(&info);
-		is_dns = check_dns(&info, true);
+		l4 = skb_info_ptr(&info, sizeof(struct udphdr));
+		is_control = check_ipv4_control(info.proto, l4);
+		is_dns = check_dns(info.proto, l4, true);
 
 		if (!is_control)
-			wl_val = bpf_map_lookup_elem(&whitelist_ipv4, &iph->daddr);
+			wl_val = whitelist_lookup_ipv4(&iph->daddr);
 	} else if ((ip6h = skb_parse_ipv6(&info, sizeof(struct icmp6hdr))) != NULL) {
 		addr_match = ipv6_addr_equal(&ip6h->saddr, (struct in6_addr *)&cldata.ip6addr);
 		if ((ip6h->saddr.s6_addr[0] & 0xe0) != 0x20)
 			addr_match = true;
-		is_control = check_ipv6_control(&info);
-		is_dns = check_dns(&info, true);
+		l4 = skb_info_ptr(&info, sizeof(struct icmp6hdr));
+		is_control = check_ipv6_control(info.proto, l4);
+		is_dns = check_dns(info.proto, l4, true);
 
 		if (!is_control)
-			wl_val = bpf_map_lookup_elem(&whitelist_ipv6, &ip6h->daddr);
+			wl_val = whitelist_lookup_ipv6(&ip6h->daddr);
 	} else if (info.proto == bpf_htons(ETH_P_ARP)) {
-		bpf_clone_redirect(skb, config.snoop_ifindex, BPF_F_INGRESS);
+		snoop_packet(skb);
 		return TC_ACT_UNSPEC;
 	} else {
 		return TC_ACT_UNSPEC;
@@ -237,11 +336,10 @@ int spotfilter_in(struct __sk_buff *skb)
 	if (wl_val) {
 		cldata.cur_class = wl_val->val;
 		cldata.dns_class = wl_val->val;
-		wl_val->seen = 1;
 	}
 
 	if (is_control) {
-		bpf_clone_redirect(skb, config.snoop_ifindex, BPF_F_INGRESS);
+		snoop_packet(skb);
 		return TC_ACT_UNSPEC;
 	}
 
@@ -289,4 +387,85 @@ int spotfilter_in(struct __sk_buff *skb)
 	return TC_ACT_UNSPEC;
 }
 
+/*
+ * Driver level prefilter for the ingress classifier: drops everything
+ * spotfilter_in would drop before an skb is allocated. All other packets
+ * (control traffic, valid classes, actions) are passed on to spotfilter_in.
+ */
+SEC("xdp")
+int spotfilter_xdp(struct xdp_md *xdp)
+{
+	struct spotfilter_client_data *cl, cldata = {};
+	struct spotfilter_client_stats *stats;
+	struct spotfilter_whitelist_entry *wl_val = NULL;
+	struct spotfilter_bpf_class *c;
+	struct xdp_parser_info info;
+	struct ipv6hdr *ip6h;
+	struct ethhdr *eth;
+	struct iphdr *iph;
+	bool addr_match = false;
+	bool is_control = false;
+	bool is_dns = false;
+	uint32_t cur_class;
+	void *l4;
+
+	xdp_parse_init(&info, xdp);
+	eth = xdp_parse_ethernet(&info);
+	if (!eth)
+		return XDP_PASS;
+
+	cl = bpf_map_lookup_elem(&client, eth->h_source);
+	if (cl)
+		cldata = *cl;
+
+	xdp_parse_vlan(&info);
+	if ((iph = xdp_parse_ipv4(&info)) != NULL) {
+		addr_match = iph->saddr == cldata.ip4addr;
+		l4 = xdp_info_ptr(&info, sizeof(struct udphdr));
+		is_control = check_ipv4_control(info.proto, l4);
+		is_dns = check_dns(info.proto, l4, true);
+
+		if (!is_control)
+			wl_val = whitelist_lookup_ipv4(&iph->daddr);
+	} else if ((ip6h = xdp_parse_ipv6(&info)) != NULL) {
+		addr_match = ipv6_addr_equal(&ip6h->saddr, (struct in6_addr *)&cldata.ip6addr);
+		if ((ip6h->saddr.s6_addr[0] & 0xe0) != 0x20)
+			addr_match = true;
+		l4 = xdp_info_ptr(&info, sizeof(struct icmp6hdr));
+		is_control = check_ipv6_control(info.proto, l4);
+		is_dns = check_dns(info.proto, l4, true);
+
+		if (!is_control)
+			wl_val = whitelist_lookup_ipv6(&ip6h->daddr);
+	} else {
+		return XDP_PASS;
+	}
+
+	if (is_control)
+		return XDP_PASS;
+
+	if (!addr_match)
+		goto drop;
+
+	if (wl_val) {
+		cldata.cur_class = wl_val->val;
+		cldata.dns_class = wl_val->val;
+	}
+
+	cur_class = is_dns ? cldata.dns_class : cldata.cur_class;
+	c = bpf_map_lookup_elem(&class, &cur_class);
+	if (!c || (c->actions & SPOTFILTER_ACTION_VALID))
+		return XDP_PASS;
+
+drop:
+	/* passed packets are accounted by spotfilter_in */
+	if (cl && (cldata.flags & SPOTFILTER_CLIENT_F_ACCT_UL) &&
+	    (stats = bpf_map_lookup_elem(&client_stats, eth->h_source)) != NULL) {
+		stats->packets_ul++;
+		stats->bytes_ul += xdp_len(xdp);
+	}
+
+	return XDP_DROP;
+}
+
 char _license[] SEC("license") = "GPL";
@@ -18,7 +18,10 @@ struct spotfilter_client_data {
 	uint8_t cur_class;
 	uint8_t dns_class;
 	uint8_t flags;
+};
 
+/* per-cpu values, summed up in userspace */
+struct spotfilter_client_stats {
 	uint64_t packets_ul;
 	uint64_t packets_dl;
 	uint64_t bytes_ul;
@@ -27,6 +30,15 @@ struct spotfilter_client_data {
 
 struct spotfilter_bpf_config {
 	uint32_t snoop_ifindex;
+	uint8_t snoop_ringbuf;
+};
+
+#define SPOTFILTER_SNOOP_MAX_LEN	2048
+
+struct spotfilter_snoop_event {
+	uint32_t len;
+	uint32_t caplen;
+	uint8_t data[SPOTFILTER_SNOOP_MAX_LEN];
 };
 
 struct spotfilter_whitelist_entry {
@@ -34,6 +46,16 @@ struct spotfilter_whitelist_entry {
 	uint8_t seen;
 };
 
+struct spotfilter_whitelist_prefix_v4 {
+	uint32_t prefixlen;
+	uint8_t addr[4];
+};
+
+struct spotfilter_whitelist_prefix_v6 {
+	uint32_t prefixlen;
+	uint8_t addr[16];
+};
+
 #define SPOTFILTER_NUM_CLASS 16
 
 #define SPOTFILTER_ACTION_FWMARK	(1 << 0)
@@ -21,6 +21,7 @@
 #include <netinet/in.h>
 
 #include "spotfilter-bpf.h"
+#include "whitelist.h"
 #include "interface.h"
 #include "bpf.h"
 #include "client.h"
@@ -34,6 +35,14 @@
 extern int spotfilter_ifb_ifindex;
 struct nl_msg;
 
+struct spotfilter_snoop_stats {
+	uint64_t ringbuf_packets;
+	uint64_t packets;
+	uint64_t drops;
+	uint64_t freeze_count;
+	bool ring;
+};
+
 int rtnl_init(void);
 int rtnl_fd(void);
 int rtnl_call(struct nl_msg *msg);
@@ -46,14 +55,30 @@ void spotfilter_ubus_notify(struct interface *iface, struct client *cl, const ch
 
 int spotfilter_dev_init(void);
 void spotfilter_dev_done(void);
+void spotfilter_snoop_get_stats(struct spotfilter_snoop_stats *stats);
+void spotfilter_snoop_packet(const void *data, unsigned int len);
 
 void spotfilter_dns_init(struct interface *iface);
 void spotfilter_dns_free(struct interface *iface);
+void spotfilter_dns_whitelist_update(struct interface *iface);
 
 void spotfilter_recv_dhcpv4(const void *msg, int len, const void *eth_addr);
 void spotfilter_recv_icmpv6(const void *data, int len, const uint8_t *src, const uint8_t *dest);
 
 int spotfilter_nl80211_init(void);
 void spotfilter_nl80211_done(void);
+void spotfilter_nl80211_resync(void);
+void spotfilter_nl80211_station_query(struct interface *iface, const void *addr);
+
+extern bool spotfilter_mock_stations;
+
+void spotfilter_station_init(void);
+void spotfilter_station_done(void);
+bool spotfilter_station_find_device(int ifindex, const char *name,
+				    struct interface **iface, struct device **dev);
+void spotfilter_station_update(struct interface *iface, struct device *dev,
+			       const void *addr, bool present);
+void spotfilter_station_sync_begin(void);
+void spotfilter_station_sync_end(void);
 
 #endif
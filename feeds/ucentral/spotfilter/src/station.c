@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <libubox/uloop.h>
+
+#include "spotfilter.h"
+
+/*
+ * Station presence is tracked from association events. Clients count
+ * idle seconds while no station with their address is associated to one
+ * of the interface devices and are removed after client_timeout.
+ *
+ * The device that last reported the station is remembered: a station
+ * roaming between devices of the interface may show up on the new device
+ * before it is deleted from the old one, so only a delete from that device
+ * clears the flag.
+ */
+
+static struct uloop_timeout idle_timer;
+static uint32_t station_gen;
+
+bool spotfilter_mock_stations;
+
+void spotfilter_station_update(struct interface *iface, struct device *dev,
+			       const void *addr, bool present)
+{
+	const char *name = device_name(dev);
+	struct client *cl;
+
+	cl = avl_find_element(&iface->clients, addr, cl, node);
+	if (!cl) {
+		if (!present || !iface->client_autocreate)
+			return;
+
+		if (client_set(iface, addr, NULL, -1, -1, -1, NULL, name, false))
+			return;
+
+		cl = avl_find_element(&iface->clients, addr, cl, node);
+		if (!cl)
+			return;
+	}
+
+	if (!present && cl->station && cl->station_dev &&
+	    strcmp(cl->station_dev, name) != 0)
+		return;
+
+	/*
+	 * the insert may have failed while the client map was full. This is
+	 * also checked for every station on the periodic full sync.
+	 */
+	if (present && spotfilter_bpf_get_client(iface, &cl->key, &cl->data))
+		client_bpf_update(iface, cl);
+
+	if (present && (!cl->station_dev || strcmp(cl->station_dev, name) != 0)) {
+		free(cl->station_dev);
+		cl->station_dev = strdup(name);
+	}
+
+	cl->station = present;
+	cl->station_gen = station_gen;
+	if (present)
+		cl->idle = 0;
+}
+
+bool spotfilter_station_find_device(int ifindex, const char *name,
+				    struct interface **iface, struct device **dev)
+{
+	avl_for_each_element(&interfaces, *iface, node) {
+		if (name) {
+			*dev = vlist_find(&(*iface)->devices, name, *dev, node);
+			if (*dev)
+				return true;
+
+			continue;
+		}
+
+		vlist_for_each_element(&(*iface)->devices, *dev, node)
+			if ((*dev)->ifindex == ifindex)
+				return true;
+	}
+
+	return false;
+}
+
+void spotfilter_station_sync_begin(void)
+{
+	station_gen++;
+}
+
+/* stations not reported since the last sync_begin are gone */
+void spotfilter_station_sync_end(void)
+{
+	struct interface *iface;
+	struct client *cl;
+
+	avl_for_each_element(&interfaces, iface, node) {
+		avl_for_each_element(&iface->clients, cl, node) {
+			if (cl->station && cl->station_gen != station_gen)
+				cl->station = false;
+		}
+	}
+}
+
+static void
+station_idle_update(struct uloop_timeout *t)
+{
+	struct interface *iface;
+	struct client *cl, *tmp;
+
+	avl_for_each_element(&interfaces, iface, node) {
+		avl_for_each_element_safe(&iface->clients, cl, node, tmp) {
+			if (cl->station)
+				continue;
+
+			if (cl->idle++ < iface->client_timeout)
+				continue;
+
+			if (iface->client_autoremove)
+				client_free(iface, cl);
+		}
+	}
+
+	uloop_timeout_set(t, 1000);
+}
+
+void spotfilter_station_init(void)
+{
+	idle_timer.cb = station_idle_update;
+	uloop_timeout_set(&idle_timer, 1000);
+}
+
+void spotfilter_station_done(void)
+{
+	uloop_timeout_cancel(&idle_timer);
+}
@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "timer-wheel.h"
+
+/*
+ * Checks the timer wheel against a brute force model. Entries are added,
+ * renewed and deleted at random while the time advances in steps of one
+ * second up to past the top level range. Every expiry has to happen at
+ * exactly the expected second, expired entries are partly re-armed from
+ * the callback and nothing may be left behind once the last expiry time
+ * has passed. Runs once from a low start time and once across the 32 bit
+ * wraparound.
+ */
+
+#define MODEL_LONG_RANGE	(1U << 25)
+
+struct model_entry {
+	struct timer_wheel_entry e;
+	uint32_t due;
+	bool pending;
+};
+
+static struct model_entry *entries;
+static unsigned int n_entries, n_pending;
+static unsigned long errors, expired;
+static bool verbose;
+
+static uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t
+model_delta(void)
+{
+	unsigned int r = rand() % 1000;
+
+	if (r < 10)
+		return rand() % MODEL_LONG_RANGE;
+	if (r < 100)
+		return rand() % (TIMER_WHEEL_SIZE * TIMER_WHEEL_SIZE * TIMER_WHEEL_SIZE);
+	if (r < 400)
+		return rand() % (TIMER_WHEEL_SIZE * TIMER_WHEEL_SIZE);
+
+	return rand() % (2 * TIMER_WHEEL_SIZE);
+}
+
+/* expiry times not in the future fire on the next second */
+static void
+model_add(struct timer_wheel *w, struct model_entry *m, uint32_t expires)
+{
+	if ((int32_t)(expires - w->now) < 1)
+		m->due = w->now + 1;
+	else
+		m->due = expires;
+
+	if (!m->pending)
+		n_pending++;
+	m->pending = true;
+
+	timer_wheel_add(w, &m->e, expires);
+}
+
+static void
+model_del(struct timer_wheel *w, struct model_entry *m)
+{
+	if (m->pending)
+		n_pending--;
+	m->pending = false;
+
+	timer_wheel_del(w, &m->e);
+}
+
+static void
+model_expire(struct timer_wheel *w, struct timer_wheel_entry *e)
+{
+	struct model_entry *m = container_of(e, struct model_entry, e);
+
+	expired++;
+	if (!m->pending || m->due != w->now) {
+		if (verbose || errors < 10)
+			fprintf(stderr, "entry %u expired at %u, %s %u\n",
+				(unsigned int)(m - entries), w->now,
+				m->pending ? "due" : "not pending, was due", m->due);
+		errors++;
+	}
+
+	if (m->pending)
+		n_pending--;
+	m->pending = false;
+
+	if (timer_wheel_pending(e)) {
+		fprintf(stderr, "entry %u still queued in the callback\n",
+			(unsigned int)(m - entries));
+		errors++;
+	}
+
+	/* renewed from the callback, including already expired times */
+	if (!(rand() % 4))
+		model_add(w, m, w->now + model_delta() - 2);
+}
+
+static void
+model_check(struct timer_wheel *w, uint32_t now)
+{
+	unsigned int i;
+
+	for (i = 0; i < n_entries; i++) {
+		struct model_entry *m = &entries[i];
+
+		if (!m->pending || (int32_t)(now - m->due) < 0)
+			continue;
+
+		if (verbose || errors < 10)
+			fprintf(stderr, "entry %u due at %u not expired at %u\n",
+				i, m->due, now);
+		errors++;
+	}
+
+	if (w->count != n_pending) {
+		fprintf(stderr, "wheel count %u, expected %u\n", w->count, n_pending);
+		errors++;
+	}
+}
+
+static uint32_t
+model_step(void)
+{
+	unsigned int r = rand() % 100;
+
+	if (r < 70)
+		return 1 + rand() % 4;
+	if (r < 95)
+		return rand() % (TIMER_WHEEL_SIZE * TIMER_WHEEL_SIZE);
+
+	return rand() % (2 * TIMER_WHEEL_SIZE * TIMER_WHEEL_SIZE * TIMER_WHEEL_SIZE);
+}
+
+static int
+model_run(uint32_t start, unsigned int steps)
+{
+	struct timer_wheel w;
+	uint32_t now = start, last = start;
+	uint64_t t_start, t_add = 0, t_advance = 0;
+	unsigned long ops = 0;
+	unsigned int i, j;
+
+	memset(entries, 0, n_entries * sizeof(*entries));
+	n_pending = 0;
+	errors = expired = 0;
+	timer_wheel_init(&w, start);
+
+	t_start = bench_now();
+	for (i = 0; i < n_entries; i++)
+		model_add(&w, &entries[i], now + model_delta());
+	t_add += bench_now() - t_start;
+	ops += n_entries;
+
+	for (i = 0; i < steps && errors < 100; i++) {
+		t_start = bench_now();
+		for (j = 0; j < n_entries / 100; j++) {
+			struct model_entry *m = &entries[rand() % n_entries];
+
+			if (rand() % 3)
+				model_add(&w, m, now + model_delta());
+			else
+				model_del(&w, m);
+		}
+		t_add += bench_now() - t_start;
+		ops += n_entries / 100;
+
+		now += model_step();
+		t_start = bench_now();
+		timer_wheel_advance(&w, now, model_expire);
+		t_advance += bench_now() - t_start;
+		model_check(&w, now);
+	}
+
+	/* drain: everything has to expire by the latest due time */
+	for (i = 0; i < n_entries; i++)
+		if (entries[i].pending && (int32_t)(entries[i].due - last) > 0)
+			last = entries[i].due;
+
+	if ((int32_t)(last - now) > 0)
+		now = last;
+
+	t_start = bench_now();
+	timer_wheel_advance(&w, now, model_expire);
+	t_advance += bench_now() - t_start;
+	model_check(&w, now);
+
+	if (n_pending) {
+		fprintf(stderr, "%u entries left after draining\n", n_pending);
+		errors++;
+	}
+
+	printf("start %10u: %lu adds/deletes (%.0f ns/op), %lu expired, "
+	       "%u seconds (%.0f ns/s), %lu errors\n",
+	       start, ops, (double)t_add / ops, expired, now - start,
+	       (double)t_advance / (now - start), errors);
+
+	return errors ? -1 : 0;
+}
+
+static int
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"Options:\n"
+		"	-n <entries>	Number of timers (default: 20000)\n"
+		"	-s <steps>	Number of time steps (default: 2000)\n"
+		"	-r <seed>	Random seed (default: 1)\n"
+		"	-v		Print every mismatch\n"
+		"\n", prog);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int n = 20000, steps = 2000, seed = 1;
+	int ret = 0;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "n:s:r:v")) != -1) {
+		switch (ch) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 's':
+			steps = atoi(optarg);
+			break;
+		case 'r':
+			seed = atoi(optarg);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (n < 100 || steps <= 0)
+		return usage(argv[0]);
+
+	n_entries = n;
+	entries = calloc(n_entries, sizeof(*entries));
+	if (!entries)
+		return 1;
+
+	srand(seed);
+	if (model_run(0, steps) ||
+	    model_run(UINT32_MAX - MODEL_LONG_RANGE / 2, steps))
+		ret = 1;
+
+	free(entries);
+
+	return ret;
+}
@@ -196,10 +196,16 @@ client_ubus_update(struct ubus_context *ctx, struct ubus_object *obj,
 		accounting = client_accounting_flags(cur);
 
 	if (!strcmp(method, "client_remove")) {
+		uint8_t mac[ETH_ALEN];
+
 		if (!cl)
 			return UBUS_STATUS_NOT_FOUND;
 
+		memcpy(mac, addr, ETH_ALEN);
 		client_free(iface, cl);
+
+		/* recreate the client right away if autocreate is enabled */
+		spotfilter_nl80211_station_query(iface, mac);
 		return 0;
 	}
 
@@ -212,6 +218,10 @@ client_ubus_update(struct ubus_context *ctx, struct ubus_object *obj,
 	client_set(iface, addr, id, state, dns_state, accounting,
 		   tb[CLIENT_ATTR_DATA], NULL, flush);
 
+	/* no NEW_STATION event follows for an already associated station */
+	if (!cl)
+		spotfilter_nl80211_station_query(iface, addr);
+
 	return 0;
 }
 
@@ -238,19 +248,26 @@ interface_dump_action(struct blob_buf *buf, struct interface *iface, uint8_t cla
 		blobmsg_add_string(buf, "dest_mac", ether_ntoa((const void *)c->dest_mac));
 }
 
-static void client_dump(struct interface *iface, struct client *cl)
+static void client_dump(struct interface *iface, struct client *cl, bool synced)
 {
+	struct spotfilter_client_stats *stats = &cl->stats;
 	struct blob_attr *val;
 	const char *name;
 	char *buf;
 	void *c;
 
-	spotfilter_bpf_get_client(iface, &cl->key, &cl->data);
+	if (!synced) {
+		spotfilter_bpf_get_client(iface, &cl->key, &cl->data);
+		spotfilter_bpf_get_client_stats(iface, &cl->key, stats);
+	}
 
 	if (cl->device)
 		blobmsg_add_string(&b, "device", cl->device);
 
 	blobmsg_add_u32(&b, "idle", cl->idle);
+	blobmsg_add_u8(&b, "station", cl->station);
+	if (cl->station && cl->station_dev)
+		blobmsg_add_string(&b, "station_device", cl->station_dev);
 
 	blobmsg_add_u32(&b, "state", cl->data.cur_class);
 	blobmsg_add_u32(&b, "dns_state", cl->data.dns_class);
@@ -296,10 +313,10 @@ static void client_dump(struct interface *iface, struct client *cl)
 	blobmsg_close_table(&b, c);
 
 	c = blobmsg_open_table(&b, "acct_data");
-	blobmsg_add_u64(&b, "packets_ul", cl->data.packets_ul);
-	blobmsg_add_u64(&b, "packets_dl", cl->data.packets_dl);
-	blobmsg_add_u64(&b, "bytes_ul", cl->data.bytes_ul);
-	blobmsg_add_u64(&b, "bytes_dl", cl->data.bytes_dl);
+	blobmsg_add_u64(&b, "packets_ul", stats->packets_ul);
+	blobmsg_add_u64(&b, "packets_dl", stats->packets_dl);
+	blobmsg_add_u64(&b, "bytes_ul", stats->bytes_ul);
+	blobmsg_add_u64(&b, "bytes_dl", stats->bytes_dl);
 	blobmsg_close_table(&b, c);
 }
 
@@ -324,7 +341,7 @@ client_ubus_get(struct ubus_context *ctx, struct ubus_object *obj,
 
 	blob_buf_init(&b, 0);
 	blobmsg_add_string(&b, "address", ether_ntoa(cl->node.key));
-	client_dump(iface, cl);
+	client_dump(iface, cl, false);
 
 	ubus_send_reply(ctx, req, b.head);
 
@@ -339,6 +356,7 @@ client_ubus_list(struct ubus_context *ctx, struct ubus_object *obj,
 	struct blob_attr *iface_attr;
 	struct interface *iface;
 	struct client *cl;
+	bool synced;
 
 	blobmsg_parse(&client_policy[CLIENT_ATTR_IFACE], 1, &iface_attr,
 		      blobmsg_data(msg), blobmsg_len(msg));
@@ -351,12 +369,14 @@ client_ubus_list(struct ubus_context *ctx, struct ubus_object *obj,
 	if (!iface)
 		return UBUS_STATUS_NOT_FOUND;
 
+	synced = !spotfilter_bpf_sync_clients(iface);
+
 	blob_buf_init(&b, 0);
 	avl_for_each_element(&iface->clients, cl, node) {
 		void *c;
 
 		c = blobmsg_open_table(&b, ether_ntoa(cl->node.key));
-		client_dump(iface, cl);
+		client_dump(iface, cl, synced);
 		blobmsg_close_table(&b, c);
 	}
 
@@ -383,11 +403,12 @@ whitelist_update(struct ubus_context *ctx, struct ubus_object *obj,
 		 struct ubus_request_data *req, const char *method,
 		 struct blob_attr *msg)
 {
+	struct spotfilter_whitelist_batch wl4 = {}, wl6 = { .ipv6 = true };
 	struct blob_attr *tb[__WHITELIST_ATTR_MAX];
 	struct interface *iface;
 	struct blob_attr *cur;
 	uint8_t state = 0;
-	const uint8_t *val = &state;
+	bool remove;
 	int rem;
 
 	blobmsg_parse(whitelist_policy, __WHITELIST_ATTR_MAX, tb,
@@ -406,8 +427,7 @@ whitelist_update(struct ubus_context *ctx, struct ubus_object *obj,
 	    blobmsg_check_array(cur, BLOBMSG_TYPE_STRING) < 0)
 		return UBUS_STATUS_INVALID_ARGUMENT;
 
-	if (!strcmp(method, "whitelist_remove"))
-		val = NULL;
+	remove = !strcmp(method, "whitelist_remove");
 
 	blobmsg_for_each_attr(cur, tb[WHITELIST_ATTR_ADDR], rem) {
 		const char *addrstr = blobmsg_get_string(cur);
@@ -420,14 +440,114 @@ whitelist_update(struct ubus_context *ctx, struct ubus_object *obj,
 		if (inet_pton(ipv6 ? AF_INET6 : AF_INET, addrstr, &addr) != 1)
 			continue;
 
-		spotfilter_bpf_set_whitelist(iface, &addr, ipv6, val);
+		spotfilter_bpf_whitelist_batch_add(ipv6 ? &wl6 : &wl4, &addr, state);
 	}
 
+	spotfilter_bpf_whitelist_batch_commit(iface, &wl4, remove);
+	spotfilter_bpf_whitelist_batch_commit(iface, &wl6, remove);
+
+	return 0;
+}
+
+enum {
+	STATION_ATTR_DEVICE,
+	STATION_ATTR_ADDR,
+	STATION_ATTR_PRESENT,
+	__STATION_ATTR_MAX
+};
+
+static const struct blobmsg_policy station_policy[__STATION_ATTR_MAX] = {
+	[STATION_ATTR_DEVICE] = { "device", BLOBMSG_TYPE_STRING },
+	[STATION_ATTR_ADDR] = { "address", BLOBMSG_TYPE_STRING },
+	[STATION_ATTR_PRESENT] = { "present", BLOBMSG_TYPE_BOOL },
+};
+
+/* replaces nl80211 station events when running with -m */
+static int
+station_event(struct ubus_context *ctx, struct ubus_object *obj,
+	      struct ubus_request_data *req, const char *method,
+	      struct blob_attr *msg)
+{
+	struct blob_attr *tb[__STATION_ATTR_MAX];
+	struct interface *iface;
+	struct device *dev;
+	const void *addr;
+	bool present = true;
+
+	if (!spotfilter_mock_stations)
+		return UBUS_STATUS_NOT_SUPPORTED;
+
+	blobmsg_parse(station_policy, __STATION_ATTR_MAX, tb,
+		      blobmsg_data(msg), blobmsg_len(msg));
+
+	if (!tb[STATION_ATTR_DEVICE] || !tb[STATION_ATTR_ADDR])
+		return UBUS_STATUS_INVALID_ARGUMENT;
+
+	addr = ether_aton(blobmsg_get_string(tb[STATION_ATTR_ADDR]));
+	if (!addr)
+		return UBUS_STATUS_INVALID_ARGUMENT;
+
+	if (tb[STATION_ATTR_PRESENT])
+		present = blobmsg_get_bool(tb[STATION_ATTR_PRESENT]);
+
+	if (!spotfilter_station_find_device(0, blobmsg_get_string(tb[STATION_ATTR_DEVICE]),
+					    &iface, &dev))
+		return UBUS_STATUS_NOT_FOUND;
+
+	spotfilter_station_update(iface, dev, addr, present);
+
+	return 0;
+}
+
+static int
+snoop_stats(struct ubus_context *ctx, struct ubus_object *obj,
+	    struct ubus_request_data *req, const char *method,
+	    struct blob_attr *msg)
+{
+	struct spotfilter_snoop_stats stats;
+
+	spotfilter_snoop_get_stats(&stats);
+
+	blob_buf_init(&b, 0);
+	blobmsg_add_u8(&b, "ring", stats.ring);
+	blobmsg_add_u64(&b, "ringbuf_packets", stats.ringbuf_packets);
+	blobmsg_add_u64(&b, "packets", stats.packets);
+	blobmsg_add_u64(&b, "drops", stats.drops);
+	blobmsg_add_u64(&b, "freeze_count", stats.freeze_count);
+	ubus_send_reply(ctx, req, b.head);
+
+	return 0;
+}
+
+static int
+dns_cache_stats(struct ubus_context *ctx, struct ubus_object *obj,
+		struct ubus_request_data *req, const char *method,
+		struct blob_attr *msg)
+{
+	struct interface *iface;
+
+	blob_buf_init(&b, 0);
+	avl_for_each_element(&interfaces, iface, node) {
+		void *c;
+
+		c = blobmsg_open_table(&b, interface_name(iface));
+		blobmsg_add_u32(&b, "addr_entries", iface->addr_map.count);
+		blobmsg_add_u32(&b, "cname_entries", iface->cname_cache.count);
+		blobmsg_add_u32(&b, "gc_last_usec", iface->dns_gc.last_usec);
+		blobmsg_add_u32(&b, "gc_max_usec", iface->dns_gc.max_usec);
+		blobmsg_add_u64(&b, "gc_expired", iface->dns_gc.expired);
+		blobmsg_close_table(&b, c);
+	}
+	ubus_send_reply(ctx, req, b.head);
+
 	return 0;
 }
 
 static const struct ubus_method spotfilter_methods[] = {
 	UBUS_METHOD_NOARG("check_devices", check_devices),
+	UBUS_METHOD_NOARG("snoop_stats", snoop_stats),
+	UBUS_METHOD_NOARG("dns_cache_stats", dns_cache_stats),
+	UBUS_METHOD("station_event", station_event, station_policy),
 	UBUS_METHOD("client_set", client_ubus_update, client_policy),
 	UBUS_METHOD_MASK("client_remove", client_ubus_update, client_policy,
 			 (1 << CLIENT_ATTR_IFACE) | (1 << CLIENT_ATTR_ADDR)),
@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <libubox/utils.h>
+
+#include "whitelist.h"
+
+struct bench_pattern {
+	char *pattern;
+	int index;
+	uint8_t class;
+};
+
+static struct bench_pattern *patterns;
+static int n_patterns;
+static unsigned int seed = 1;
+
+static uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+pattern_add(struct dns_whitelist *wl, const char *pattern, int index)
+{
+	struct bench_pattern *p;
+
+	patterns = realloc(patterns, (n_patterns + 1) * sizeof(*patterns));
+	p = &patterns[n_patterns++];
+	p->pattern = strdup(pattern);
+	p->index = index;
+	p->class = index % 16;
+	dns_whitelist_add(wl, p->pattern, p->index, p->class);
+}
+
+/* same semantics as the old linear lookup over the whitelist config */
+static bool
+linear_lookup(const char *name, int *class)
+{
+	int i;
+
+	for (i = 0; i < n_patterns; i++) {
+		if (fnmatch(patterns[i].pattern, name, 0))
+			continue;
+
+		*class = patterns[i].class;
+		return true;
+	}
+
+	return false;
+}
+
+static void
+patterns_free(struct dns_whitelist *wl)
+{
+	int i;
+
+	for (i = 0; i < n_patterns; i++)
+		free(patterns[i].pattern);
+	free(patterns);
+	patterns = NULL;
+	n_patterns = 0;
+	dns_whitelist_free(wl);
+}
+
+static int
+check_name(struct dns_whitelist *wl, const char *name)
+{
+	int class = -1, ref_class = -1;
+	bool found, ref_found;
+
+	found = dns_whitelist_lookup(wl, name, &class);
+	ref_found = linear_lookup(name, &ref_class);
+	if (found == ref_found && class == ref_class)
+		return 0;
+
+	fprintf(stderr, "Mismatch for '%s': trie %d/%d, fnmatch %d/%d\n",
+		name, found, class, ref_found, ref_class);
+	return -1;
+}
+
+static void
+random_name(char *buf, int max_labels, bool pattern)
+{
+	static const char *labels[] = { "a", "b", "ab", "", "com", "ba" };
+	static const char *wild[] = { "*", "?", "a*", "[ab]", "*b", "\\a" };
+	int n = 1 + rand_r(&seed) % max_labels;
+	int i;
+
+	buf[0] = 0;
+	for (i = 0; i < n; i++) {
+		if (i)
+			strcat(buf, ".");
+		if (pattern && !(rand_r(&seed) % (i ? 8 : 2)))
+			strcat(buf, wild[rand_r(&seed) % ARRAY_SIZE(wild)]);
+		else
+			strcat(buf, labels[rand_r(&seed) % ARRAY_SIZE(labels)]);
+	}
+}
+
+/* compare trie results against fnmatch on random small patterns and names */
+static int
+check_run(int rounds)
+{
+	struct dns_whitelist wl;
+	char buf[64];
+	int i, j;
+
+	for (i = 0; i < rounds; i++) {
+		dns_whitelist_init(&wl);
+		for (j = rand_r(&seed) % 8; j >= 0; j--) {
+			random_name(buf, 4, true);
+			pattern_add(&wl, buf, n_patterns);
+		}
+
+		for (j = 0; j < 64; j++) {
+			random_name(buf, 5, false);
+			if (check_name(&wl, buf))
+				return 1;
+		}
+
+		patterns_free(&wl);
+	}
+
+	printf("check: %d rounds ok\n", rounds);
+	return 0;
+}
+
+static int
+bench_run(int n, int lookups)
+{
+	struct dns_whitelist wl;
+	char **names, buf[128];
+	uint64_t start, trie_time, linear_time;
+	int i, class, found = 0;
+
+	dns_whitelist_init(&wl);
+	for (i = 0; i < n; i++) {
+		snprintf(buf, sizeof(buf), "%sdomain%d.%s", i % 3 ? "*." : "",
+			 i, i % 2 ? "com" : "net");
+		pattern_add(&wl, buf, i);
+	}
+
+	names = calloc(lookups, sizeof(*names));
+	for (i = 0; i < lookups; i++) {
+		int id = rand_r(&seed) % (2 * n);
+
+		snprintf(buf, sizeof(buf), "host%d.cdn.domain%d.%s",
+			 i, id, id % 2 ? "com" : "net");
+		names[i] = strdup(buf);
+	}
+
+	start = bench_now();
+	for (i = 0; i < lookups; i++)
+		found += dns_whitelist_lookup(&wl, names[i], &class);
+	trie_time = bench_now() - start;
+
+	start = bench_now();
+	for (i = 0; i < lookups; i++)
+		linear_lookup(names[i], &class);
+	linear_time = bench_now() - start;
+
+	printf("%d patterns, %d lookups (%d hits)\n", n, lookups, found);
+	printf("trie: %.0f ns/lookup, fnmatch: %.0f ns/lookup\n",
+	       (double)trie_time / lookups, (double)linear_time / lookups);
+
+	for (i = 0; i < lookups; i++) {
+		if (check_name(&wl, names[i]))
+			return 1;
+		free(names[i]);
+	}
+	free(names);
+	patterns_free(&wl);
+
+	return 0;
+}
+
+static int
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"Options:\n"
+		"	-n <patterns>	Number of patterns (default: 500)\n"
+		"	-l <lookups>	Number of lookups (default: 100000)\n"
+		"	-c <rounds>	Compare against fnmatch on random patterns instead\n"
+		"	-s <seed>	Random seed\n"
+		"\n", prog);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int n = 500, lookups = 100000, rounds = 0;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "n:l:c:s:")) != -1) {
+		switch (ch) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'l':
+			lookups = atoi(optarg);
+			break;
+		case 'c':
+			rounds = atoi(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (n <= 0 || lookups <= 0)
+		return usage(argv[0]);
+
+	if (rounds)
+		return check_run(rounds);
+
+	return bench_run(n, lookups);
+}
@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#include <limits.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libubox/avl.h>
+#include <libubox/avl-cmp.h>
+#include <libubox/utils.h>
+
+#include "whitelist.h"
+
+#define MAX_NAME_LEN	256
+
+struct dns_whitelist_match {
+	int index;
+	uint8_t class;
+};
+
+struct dns_whitelist_node {
+	struct avl_node node;
+	struct avl_tree children;
+
+	/* pattern ends at this label */
+	struct dns_whitelist_match exact;
+	/* "*." followed by the labels up to this node */
+	struct dns_whitelist_match wildcard;
+};
+
+struct dns_whitelist_pattern {
+	const char *pattern;
+	struct dns_whitelist_match match;
+};
+
+static struct dns_whitelist_node *
+dns_whitelist_node_new(const char *label, int len)
+{
+	struct dns_whitelist_node *n;
+	char *label_buf;
+
+	n = calloc_a(sizeof(*n), &label_buf, len + 1);
+	memcpy(label_buf, label, len);
+	n->node.key = label_buf;
+	avl_init(&n->children, avl_strcmp, false, NULL);
+	n->exact.index = -1;
+	n->wildcard.index = -1;
+
+	return n;
+}
+
+static void
+dns_whitelist_node_free(struct dns_whitelist_node *n)
+{
+	struct dns_whitelist_node *child, *tmp;
+
+	avl_remove_all_elements(&n->children, child, node, tmp)
+		dns_whitelist_node_free(child);
+	free(n);
+}
+
+static void
+dns_whitelist_match_set(struct dns_whitelist_match *m, int index, uint8_t class)
+{
+	/* the first matching whitelist entry wins */
+	if (m->index >= 0 && m->index <= index)
+		return;
+
+	m->index = index;
+	m->class = class;
+}
+
+static bool
+dns_whitelist_label_valid(const char *label, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		if (strchr("*?[\\", label[i]))
+			return false;
+
+	return true;
+}
+
+static bool
+dns_whitelist_pattern_valid(const char *pattern)
+{
+	if (!strncmp(pattern, "*.", 2))
+		pattern += 2;
+	else if (!strcmp(pattern, "*"))
+		return true;
+
+	return dns_whitelist_label_valid(pattern, strlen(pattern)) &&
+	       strlen(pattern) < MAX_NAME_LEN;
+}
+
+void dns_whitelist_init(struct dns_whitelist *wl)
+{
+	memset(wl, 0, sizeof(*wl));
+	wl->root = dns_whitelist_node_new("", 0);
+}
+
+void dns_whitelist_add(struct dns_whitelist *wl, const char *pattern,
+		       int index, uint8_t class)
+{
+	struct dns_whitelist_node *n = wl->root, *child;
+	struct dns_whitelist_pattern *p;
+	bool wildcard = false;
+	char label[MAX_NAME_LEN];
+	const char *end;
+
+	if (!dns_whitelist_pattern_valid(pattern)) {
+		wl->patterns = realloc(wl->patterns, (wl->n_patterns + 1) * sizeof(*p));
+		p = &wl->patterns[wl->n_patterns++];
+		p->pattern = pattern;
+		p->match.index = index;
+		p->match.class = class;
+		return;
+	}
+
+	if (!strcmp(pattern, "*")) {
+		dns_whitelist_match_set(&n->wildcard, index, class);
+		return;
+	}
+
+	if (!strncmp(pattern, "*.", 2)) {
+		pattern += 2;
+		wildcard = true;
+	}
+
+	end = pattern + strlen(pattern);
+	while (1) {
+		const char *start = end;
+		int len;
+
+		while (start > pattern && start[-1] != '.')
+			start--;
+
+		len = end - start;
+		memcpy(label, start, len);
+		label[len] = 0;
+
+		child = avl_find_element(&n->children, label, child, node);
+		if (!child) {
+			child = dns_whitelist_node_new(label, len);
+			avl_insert(&n->children, &child->node);
+		}
+		n = child;
+
+		if (start == pattern)
+			break;
+
+		end = start - 1;
+	}
+
+	if (wildcard)
+		dns_whitelist_match_set(&n->wildcard, index, class);
+	else
+		dns_whitelist_match_set(&n->exact, index, class);
+}
+
+/*
+ * Matches fnmatch(pattern, name, 0) semantics: "*" also matches dots, so
+ * a wildcard node matches any name that has at least one more label
+ * (which may be empty) in front of the labels leading to it.
+ */
+bool dns_whitelist_lookup(struct dns_whitelist *wl, const char *name, int *class)
+{
+	struct dns_whitelist_match best = { .index = INT_MAX };
+	struct dns_whitelist_node *n = wl->root;
+	char buf[MAX_NAME_LEN];
+	int end, start, i;
+
+	end = strlen(name);
+	if (end >= (int)sizeof(buf))
+		goto out;
+
+	memcpy(buf, name, end + 1);
+	while (1) {
+		if (n->wildcard.index >= 0 && n->wildcard.index < best.index)
+			best = n->wildcard;
+
+		for (start = end; start > 0 && buf[start - 1] != '.'; start--);
+		buf[end] = 0;
+
+		n = avl_find_element(&n->children, buf + start, n, node);
+		if (!n)
+			break;
+
+		if (!start) {
+			if (n->exact.index >= 0 && n->exact.index < best.index)
+				best = n->exact;
+			break;
+		}
+
+		end = start - 1;
+	}
+
+out:
+	for (i = 0; i < wl->n_patterns; i++) {
+		struct dns_whitelist_pattern *p = &wl->patterns[i];
+
+		if (p->match.index >= best.index)
+			break;
+
+		if (fnmatch(p->pattern, name, 0))
+			continue;
+
+		best = p->match;
+		break;
+	}
+
+	if (best.index == INT_MAX)
+		return false;
+
+	*class = best.class;
+	return true;
+}
+
+void dns_whitelist_free(struct dns_whitelist *wl)
+{
+	if (wl->root)
+		dns_whitelist_node_free(wl->root);
+	free(wl->patterns);
+	memset(wl, 0, sizeof(*wl));
+}
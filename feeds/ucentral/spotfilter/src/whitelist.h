@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#ifndef __SPOTFILTER_WHITELIST_H
+#define __SPOTFILTER_WHITELIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct dns_whitelist_node;
+struct dns_whitelist_pattern;
+
+/*
+ * Host name patterns compiled into a trie keyed by reversed domain labels.
+ * Patterns that are not plain names or "*.<name>" are kept in a list
+ * and matched with fnmatch.
+ */
+struct dns_whitelist {
+	struct dns_whitelist_node *root;
+
+	struct dns_whitelist_pattern *patterns;
+	int n_patterns;
+};
+
+void dns_whitelist_init(struct dns_whitelist *wl);
+void dns_whitelist_add(struct dns_whitelist *wl, const char *pattern,
+		       int index, uint8_t class);
+bool dns_whitelist_lookup(struct dns_whitelist *wl, const char *name, int *class);
+void dns_whitelist_free(struct dns_whitelist *wl);
+
+#endif
@@ -231,6 +231,17 @@ dhcprelay_dev_get_by_index(int ifindex)
 	return NULL;
 }
 
+const char *dhcprelay_dev_name(int ifindex)
+{
+	struct device *dev;
+
+	dev = dhcprelay_dev_get_by_index(ifindex);
+	if (!dev)
+		return NULL;
+
+	return dev->ifname;
+}
+
 void dhcprelay_dev_send(struct packet *pkt, int ifindex, const uint8_t *addr, uint16_t proto)
 {
 	struct sockaddr_ll sll = {
@@ -235,5 +235,8 @@ void dhcprelay_packet_cb(struct packet *pkt)
 		return;
 
 	pkt->dhcp_tail = tail;
+	if (dhcprelay_policy_handle(pkt))
+		return;
+
 	dhcprelay_ubus_notify(type, pkt);
 }
@@ -93,6 +93,7 @@ void dhcprelay_dev_add(const char *name, bool upstream);
 void dhcprelay_dev_config_update(struct blob_attr *br, struct blob_attr *dev);
 void dhcprelay_dev_send(struct packet *pkt, int ifindex, const uint8_t *addr, uint16_t proto);
 void dhcprelay_update_devices(void);
+const char *dhcprelay_dev_name(int ifindex);
 
 void dhcprelay_ubus_init(void);
 void dhcprelay_ubus_done(void);
@@ -104,4 +105,8 @@ void dhcprelay_handle_response(struct packet *pkt);
 int dhcprelay_forward_request(struct packet *pkt, struct blob_attr *data);
 int dhcprelay_add_options(struct packet *pkt, struct blob_attr *data);
 
+int dhcprelay_policy_update(struct blob_attr *data);
+void dhcprelay_policy_done(void);
+bool dhcprelay_policy_handle(struct packet *pkt);
+
 #endif
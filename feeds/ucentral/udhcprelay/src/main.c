@@ -77,6 +77,7 @@ int main(int argc, char **argv)
 
 	dhcprelay_ubus_done();
 	dhcprelay_dev_done();
+	dhcprelay_policy_done();
 	uloop_done();
 
 	return 0;
@@ -0,0 +1,332 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#include <fnmatch.h>
+#include <libubus.h>
+
+#include "dhcprelay.h"
+#include "msg.h"
+
+enum dhcprelay_policy_action {
+	POLICY_ACTION_FORWARD,
+	POLICY_ACTION_DROP,
+	POLICY_ACTION_NOTIFY,
+};
+
+struct dhcprelay_policy_rule {
+	const char *device;
+	int vlan;
+	int option;
+	const void *value;
+	size_t value_len;
+
+	enum dhcprelay_policy_action action;
+	struct blob_attr *forward;
+};
+
+/*
+ * Rules are evaluated in order, the first match decides. Strings used for
+ * matching point into the memdup'd policy message.
+ */
+static struct {
+	struct dhcprelay_policy_rule *rules;
+	unsigned int n_rules;
+	struct blob_attr *data;
+} policy;
+
+static struct blob_buf b;
+
+static int
+dhcprelay_policy_add_option82(struct blob_attr *circuit_id, struct blob_attr *remote_id)
+{
+	const char *circuit = circuit_id ? blobmsg_get_string(circuit_id) : "";
+	const char *remote = remote_id ? blobmsg_get_string(remote_id) : "";
+	size_t circuit_len = strlen(circuit), remote_len = strlen(remote);
+	uint8_t buf[256], *pos = buf;
+	void *c;
+
+	if (4 + circuit_len + remote_len > 255)
+		return -1;
+
+	*pos++ = 1;
+	*pos++ = circuit_len;
+	memcpy(pos, circuit, circuit_len);
+	pos += circuit_len;
+	*pos++ = 2;
+	*pos++ = remote_len;
+	memcpy(pos, remote, remote_len);
+	pos += remote_len;
+	*pos++ = 0;
+
+	/* same [ code, value ] format as the subscriber reply */
+	c = blobmsg_open_array(&b, NULL);
+	blobmsg_add_u32(&b, NULL, 82);
+	blobmsg_add_field(&b, BLOBMSG_TYPE_STRING, NULL, buf, pos - buf);
+	blobmsg_close_array(&b, c);
+
+	return 0;
+}
+
+static struct blob_attr *
+dhcprelay_policy_forward_data(struct blob_attr *address, struct blob_attr *options,
+			      struct blob_attr *circuit_id, struct blob_attr *remote_id)
+{
+	struct blob_attr *cur;
+	void *c;
+	int rem;
+
+	if (options && blobmsg_check_array(options, BLOBMSG_TYPE_ARRAY) < 0)
+		return NULL;
+
+	blob_buf_init(&b, 0);
+	blobmsg_add_blob(&b, address);
+
+	c = blobmsg_open_array(&b, "options");
+	blobmsg_for_each_attr(cur, options, rem)
+		blobmsg_add_blob(&b, cur);
+
+	if ((circuit_id || remote_id) &&
+	    dhcprelay_policy_add_option82(circuit_id, remote_id))
+		return NULL;
+	blobmsg_close_array(&b, c);
+
+	return blob_memdup(b.head);
+}
+
+static int
+dhcprelay_policy_parse_rule(struct dhcprelay_policy_rule *rule, struct blob_attr *data)
+{
+	enum {
+		RULE_ATTR_DEVICE,
+		RULE_ATTR_VLAN,
+		RULE_ATTR_OPTION,
+		RULE_ATTR_VALUE,
+		RULE_ATTR_ACTION,
+		RULE_ATTR_ADDRESS,
+		RULE_ATTR_OPTIONS,
+		RULE_ATTR_CIRCUIT_ID,
+		RULE_ATTR_REMOTE_ID,
+		__RULE_ATTR_MAX,
+	};
+	static const struct blobmsg_policy rule_policy[__RULE_ATTR_MAX] = {
+		[RULE_ATTR_DEVICE] = { "device", BLOBMSG_TYPE_STRING },
+		[RULE_ATTR_VLAN] = { "vlan", BLOBMSG_TYPE_INT32 },
+		[RULE_ATTR_OPTION] = { "option", BLOBMSG_TYPE_INT32 },
+		[RULE_ATTR_VALUE] = { "value", BLOBMSG_TYPE_STRING },
+		[RULE_ATTR_ACTION] = { "action", BLOBMSG_TYPE_STRING },
+		[RULE_ATTR_ADDRESS] = { "address", BLOBMSG_TYPE_STRING },
+		[RULE_ATTR_OPTIONS] = { "options", BLOBMSG_TYPE_ARRAY },
+		[RULE_ATTR_CIRCUIT_ID] = { "circuit_id", BLOBMSG_TYPE_STRING },
+		[RULE_ATTR_REMOTE_ID] = { "remote_id", BLOBMSG_TYPE_STRING },
+	};
+	struct blob_attr *tb[__RULE_ATTR_MAX], *cur;
+	const char *action = "forward";
+
+	blobmsg_parse(rule_policy, __RULE_ATTR_MAX, tb, blobmsg_data(data), blobmsg_len(data));
+
+	rule->vlan = -1;
+	rule->option = -1;
+
+	if ((cur = tb[RULE_ATTR_DEVICE]) != NULL)
+		rule->device = blobmsg_get_string(cur);
+
+	if ((cur = tb[RULE_ATTR_VLAN]) != NULL) {
+		rule->vlan = blobmsg_get_u32(cur);
+		if (rule->vlan < 0 || rule->vlan > 4095)
+			return -1;
+	}
+
+	if ((cur = tb[RULE_ATTR_OPTION]) != NULL) {
+		rule->option = blobmsg_get_u32(cur);
+		if (rule->option <= DHCPV4_OPT_PAD || rule->option >= DHCPV4_OPT_END)
+			return -1;
+	}
+
+	if ((cur = tb[RULE_ATTR_VALUE]) != NULL) {
+		if (rule->option < 0)
+			return -1;
+
+		rule->value = blobmsg_data(cur);
+		rule->value_len = blobmsg_len(cur) - 1;
+	}
+
+	if ((cur = tb[RULE_ATTR_ACTION]) != NULL)
+		action = blobmsg_get_string(cur);
+
+	if (!strcmp(action, "drop")) {
+		rule->action = POLICY_ACTION_DROP;
+		return 0;
+	}
+
+	if (!strcmp(action, "notify")) {
+		rule->action = POLICY_ACTION_NOTIFY;
+		return 0;
+	}
+
+	if (strcmp(action, "forward") != 0 || !tb[RULE_ATTR_ADDRESS])
+		return -1;
+
+	rule->action = POLICY_ACTION_FORWARD;
+	rule->forward = dhcprelay_policy_forward_data(tb[RULE_ATTR_ADDRESS],
+						      tb[RULE_ATTR_OPTIONS],
+						      tb[RULE_ATTR_CIRCUIT_ID],
+						      tb[RULE_ATTR_REMOTE_ID]);
+	if (!rule->forward)
+		return -1;
+
+	return 0;
+}
+
+static void
+dhcprelay_policy_free(struct dhcprelay_policy_rule *rules, unsigned int n_rules)
+{
+	unsigned int i;
+
+	for (i = 0; i < n_rules; i++)
+		free(rules[i].forward);
+	free(rules);
+}
+
+/* replaces the rule table, the old one is kept if any rule is invalid */
+int dhcprelay_policy_update(struct blob_attr *data)
+{
+	struct dhcprelay_policy_rule *rules = NULL;
+	struct blob_attr *cur;
+	unsigned int n_rules = 0;
+	int n, rem;
+
+	if (data) {
+		n = blobmsg_check_array(data, BLOBMSG_TYPE_TABLE);
+		if (n < 0)
+			return UBUS_STATUS_INVALID_ARGUMENT;
+
+		data = blob_memdup(data);
+		if (!data)
+			return UBUS_STATUS_UNKNOWN_ERROR;
+
+		rules = calloc(n + 1, sizeof(*rules));
+		if (!rules) {
+			free(data);
+			return UBUS_STATUS_UNKNOWN_ERROR;
+		}
+
+		blobmsg_for_each_attr(cur, data, rem) {
+			if (dhcprelay_policy_parse_rule(&rules[n_rules++], cur))
+				goto error;
+		}
+	}
+
+	dhcprelay_policy_done();
+	policy.rules = rules;
+	policy.n_rules = n_rules;
+	policy.data = data;
+	ULOG_INFO("relay policy updated, %u rules\n", n_rules);
+
+	return 0;
+
+error:
+	ULOG_ERR("invalid relay policy rule %u\n", n_rules - 1);
+	dhcprelay_policy_free(rules, n_rules);
+	free(data);
+
+	return UBUS_STATUS_INVALID_ARGUMENT;
+}
+
+void dhcprelay_policy_done(void)
+{
+	dhcprelay_policy_free(policy.rules, policy.n_rules);
+	free(policy.data);
+	memset(&policy, 0, sizeof(policy));
+	blob_buf_free(&b);
+}
+
+static bool
+dhcprelay_policy_match_option(struct packet *pkt, struct dhcprelay_policy_rule *rule)
+{
+	struct dhcpv4_message *msg = pkt->data;
+	const uint8_t *pos = msg->options;
+	const uint8_t *end = pkt->data + pkt->dhcp_tail;
+
+	while (pos < end) {
+		const uint8_t *opt = pos++;
+
+		if (*opt == DHCPV4_OPT_PAD)
+			continue;
+
+		if (*opt == DHCPV4_OPT_END)
+			break;
+
+		if (pos >= end || 1 + *pos > end - pos)
+			break;
+
+		pos += *pos + 1;
+		if (*opt != rule->option)
+			continue;
+
+		if (!rule->value)
+			return true;
+
+		if (opt[1] == rule->value_len &&
+		    !memcmp(&opt[2], rule->value, rule->value_len))
+			return true;
+	}
+
+	return false;
+}
+
+static struct dhcprelay_policy_rule *
+dhcprelay_policy_match(struct packet *pkt)
+{
+	int vlan = pkt->l2.vlan_proto ? pkt->l2.vlan_tci & 0xfff : 0;
+	const char *ifname = NULL;
+	unsigned int i;
+
+	for (i = 0; i < policy.n_rules; i++) {
+		struct dhcprelay_policy_rule *rule = &policy.rules[i];
+
+		if (rule->vlan >= 0 && rule->vlan != vlan)
+			continue;
+
+		if (rule->device) {
+			if (!ifname)
+				ifname = dhcprelay_dev_name(pkt->l2.ifindex);
+
+			if (!ifname || fnmatch(rule->device, ifname, 0) != 0)
+				continue;
+		}
+
+		if (rule->option >= 0 && !dhcprelay_policy_match_option(pkt, rule))
+			continue;
+
+		return rule;
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns true if the request was handled by a local rule, false if it
+ * needs to go to the ubus subscriber.
+ */
+bool dhcprelay_policy_handle(struct packet *pkt)
+{
+	struct dhcprelay_policy_rule *rule;
+	int ret;
+
+	rule = dhcprelay_policy_match(pkt);
+	if (!rule)
+		return false;
+
+	switch (rule->action) {
+	case POLICY_ACTION_DROP:
+		return true;
+	case POLICY_ACTION_FORWARD:
+		ret = dhcprelay_forward_request(pkt, rule->forward);
+		if (ret)
+			ULOG_DBG("failed to forward request: %s\n", ubus_strerror(ret));
+		return true;
+	default:
+		return false;
+	}
+}
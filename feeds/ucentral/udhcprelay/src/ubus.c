@@ -38,6 +38,28 @@ dhcprelay_ubus_config(struct ubus_context *ctx, struct ubus_object *obj,
 }
 
 
+enum {
+	DS_POLICY_RULES,
+	__DS_POLICY_MAX
+};
+
+static const struct blobmsg_policy dhcprelay_policy_policy[__DS_POLICY_MAX] = {
+	[DS_POLICY_RULES] = { "rules", BLOBMSG_TYPE_ARRAY },
+};
+
+static int
+dhcprelay_ubus_policy(struct ubus_context *ctx, struct ubus_object *obj,
+		      struct ubus_request_data *req, const char *method,
+		      struct blob_attr *msg)
+{
+	struct blob_attr *tb[__DS_POLICY_MAX];
+
+	blobmsg_parse(dhcprelay_policy_policy, __DS_POLICY_MAX, tb,
+		      blobmsg_data(msg), blobmsg_len(msg));
+
+	return dhcprelay_policy_update(tb[DS_POLICY_RULES]);
+}
+
 static int
 dhcprelay_ubus_check_devices(struct ubus_context *ctx, struct ubus_object *obj,
 			  struct ubus_request_data *req, const char *method,
@@ -50,6 +72,7 @@ dhcprelay_ubus_check_devices(struct ubus_context *ctx, struct ubus_object *obj,
 
 static const struct ubus_method dhcprelay_methods[] = {
 	UBUS_METHOD("config", dhcprelay_ubus_config, dhcprelay_config_policy),
+	UBUS_METHOD("policy", dhcprelay_ubus_policy, dhcprelay_policy_policy),
 	UBUS_METHOD_NOARG("check_devices", dhcprelay_ubus_check_devices),
 };
 
@@ -0,0 +1,383 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/pkt_cls.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+#include <linux/tcp.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "dhcpsnoop-bpf.h"
+
+/*
+ * Runs the DHCP classifier on synthetic frames through BPF_PROG_TEST_RUN,
+ * covering every encapsulation the previous u32 filter set handled. The
+ * classifier never changes the verdict, matches are detected through its
+ * stats map. The mirror target ifindex is left at 0, so nothing is sent.
+ */
+
+#define BENCH_VLAN	100
+#define BENCH_GRE_VLAN	200
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#endif
+
+struct test_case {
+	const char *name;
+	uint16_t vlan_proto;
+	/* GRE protocol of an outer IPv4/GRE header, 0 for none */
+	uint16_t gre;
+	bool gre_vlan;
+	int family;
+	uint8_t proto;
+	uint16_t sport;
+	uint16_t dport;
+
+	bool match;
+};
+
+static const struct test_case tests[] = {
+	{ "ipv4 server", 0, 0, false, AF_INET, IPPROTO_UDP, 67, 68, true },
+	{ "ipv4 client", 0, 0, false, AF_INET, IPPROTO_UDP, 68, 67, true },
+	{ "vlan ipv4 server", ETH_P_8021Q, 0, false, AF_INET, IPPROTO_UDP, 67, 68, true },
+	{ "vlan ipv4 client", ETH_P_8021Q, 0, false, AF_INET, IPPROTO_UDP, 68, 67, true },
+	{ "802.1ad ipv4 client", ETH_P_8021AD, 0, false, AF_INET, IPPROTO_UDP, 68, 67, true },
+	{ "gre ipv4 server", 0, DHCPSNOOP_ETH_P_TEB, false, AF_INET, IPPROTO_UDP, 67, 68, true },
+	{ "gre ipv4 client", 0, DHCPSNOOP_ETH_P_TEB, false, AF_INET, IPPROTO_UDP, 68, 67, true },
+	{ "gre vlan ipv4 server", 0, DHCPSNOOP_ETH_P_TEB, true, AF_INET, IPPROTO_UDP, 67, 68, true },
+	{ "gre vlan ipv4 client", 0, DHCPSNOOP_ETH_P_TEB, true, AF_INET, IPPROTO_UDP, 68, 67, true },
+	{ "vlan gre ipv4 client", ETH_P_8021Q, DHCPSNOOP_ETH_P_TEB, false, AF_INET, IPPROTO_UDP, 68, 67, true },
+	{ "gre ipv6 client", 0, DHCPSNOOP_ETH_P_TEB, false, AF_INET6, IPPROTO_UDP, 546, 547, true },
+	{ "ipv6 client", 0, 0, false, AF_INET6, IPPROTO_UDP, 546, 547, true },
+	{ "ipv6 server", 0, 0, false, AF_INET6, IPPROTO_UDP, 547, 546, true },
+	{ "vlan ipv6 client", ETH_P_8021Q, 0, false, AF_INET6, IPPROTO_UDP, 546, 547, true },
+	{ "vlan ipv6 server", ETH_P_8021Q, 0, false, AF_INET6, IPPROTO_UDP, 547, 546, true },
+
+	{ "ipv4 dns", 0, 0, false, AF_INET, IPPROTO_UDP, 40000, 53, false },
+	{ "ipv4 to port 67", 0, 0, false, AF_INET, IPPROTO_UDP, 40000, 67, false },
+	{ "ipv4 tcp port 67", 0, 0, false, AF_INET, IPPROTO_TCP, 67, 40000, false },
+	{ "ipv4 v6 ports", 0, 0, false, AF_INET, IPPROTO_UDP, 546, 547, false },
+	{ "ipv6 v4 ports", 0, 0, false, AF_INET6, IPPROTO_UDP, 68, 67, false },
+	{ "ipv6 dns", 0, 0, false, AF_INET6, IPPROTO_UDP, 40000, 53, false },
+	{ "vlan ipv4 dns", ETH_P_8021Q, 0, false, AF_INET, IPPROTO_UDP, 40000, 53, false },
+	{ "gre ipv4 dns", 0, DHCPSNOOP_ETH_P_TEB, false, AF_INET, IPPROTO_UDP, 40000, 53, false },
+	{ "gre non-ethernet", 0, ETH_P_IP, false, AF_INET, IPPROTO_UDP, 68, 67, false },
+};
+
+struct frame {
+	uint8_t data[256];
+	unsigned int len;
+};
+
+static const uint8_t bench_src_mac[ETH_ALEN] = { 0x02, 0x5f, 0, 0, 0, 1 };
+static const uint8_t bench_dest_mac[ETH_ALEN] = { 0x02, 0x9a, 0x7e, 0, 0, 1 };
+
+static struct bpf_object *obj;
+static int prog_fd, stats_fd;
+static int repeat = 10000;
+
+static void *
+frame_put(struct frame *f, unsigned int len)
+{
+	void *ptr = f->data + f->len;
+
+	memset(ptr, 0, len);
+	f->len += len;
+
+	return ptr;
+}
+
+static void
+frame_put_eth(struct frame *f, uint16_t vlan_proto, uint16_t vlan, uint16_t proto)
+{
+	struct ethhdr *eth = frame_put(f, sizeof(*eth));
+
+	memcpy(eth->h_source, bench_src_mac, ETH_ALEN);
+	memcpy(eth->h_dest, bench_dest_mac, ETH_ALEN);
+	eth->h_proto = htons(proto);
+
+	if (vlan_proto) {
+		uint16_t *vlh = frame_put(f, 4);
+
+		eth->h_proto = htons(vlan_proto);
+		vlh[0] = htons(vlan);
+		vlh[1] = htons(proto);
+	}
+}
+
+static struct iphdr *
+frame_put_ipv4(struct frame *f, uint8_t proto, const char *saddr, const char *daddr)
+{
+	struct iphdr *iph = frame_put(f, sizeof(*iph));
+
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->ttl = 64;
+	iph->protocol = proto;
+	inet_pton(AF_INET, saddr, &iph->saddr);
+	inet_pton(AF_INET, daddr, &iph->daddr);
+
+	return iph;
+}
+
+static void
+frame_build(struct frame *f, const struct test_case *t)
+{
+	uint16_t proto = t->family == AF_INET ? ETH_P_IP : ETH_P_IPV6;
+	unsigned int outer_l3 = 0, l3;
+
+	f->len = 0;
+
+	if (t->gre) {
+		uint16_t *greh;
+
+		frame_put_eth(f, t->vlan_proto, BENCH_VLAN, ETH_P_IP);
+		outer_l3 = f->len;
+		frame_put_ipv4(f, IPPROTO_GRE, "198.51.100.2", "198.51.100.1");
+
+		greh = frame_put(f, 4);
+		greh[1] = htons(t->gre);
+
+		if (t->gre == DHCPSNOOP_ETH_P_TEB)
+			frame_put_eth(f, t->gre_vlan ? ETH_P_8021Q : 0, BENCH_GRE_VLAN, proto);
+	} else {
+		frame_put_eth(f, t->vlan_proto, BENCH_VLAN, proto);
+	}
+
+	l3 = f->len;
+	if (t->family == AF_INET) {
+		frame_put_ipv4(f, t->proto, "192.0.2.10", "192.0.2.1");
+	} else {
+		struct ipv6hdr *ip6h = frame_put(f, sizeof(*ip6h));
+
+		ip6h->version = 6;
+		ip6h->hop_limit = 64;
+		ip6h->nexthdr = t->proto;
+		inet_pton(AF_INET6, "fe80::10", &ip6h->saddr);
+		inet_pton(AF_INET6, "ff02::1:2", &ip6h->daddr);
+	}
+
+	if (t->proto == IPPROTO_UDP) {
+		struct udphdr *udph = frame_put(f, sizeof(*udph));
+
+		udph->source = htons(t->sport);
+		udph->dest = htons(t->dport);
+		udph->len = htons(sizeof(*udph) + 64);
+	} else {
+		struct tcphdr *tcph = frame_put(f, sizeof(*tcph));
+
+		tcph->source = htons(t->sport);
+		tcph->dest = htons(t->dport);
+		tcph->doff = sizeof(*tcph) / 4;
+		tcph->syn = 1;
+	}
+
+	/* the parsers want data beyond the headers they look at */
+	frame_put(f, 64);
+
+	if (t->family == AF_INET) {
+		struct iphdr *iph = (struct iphdr *)(f->data + l3);
+
+		iph->tot_len = htons(f->len - l3);
+	} else {
+		struct ipv6hdr *ip6h = (struct ipv6hdr *)(f->data + l3);
+
+		ip6h->payload_len = htons(f->len - l3 - sizeof(*ip6h));
+	}
+
+	if (t->gre) {
+		struct iphdr *iph = (struct iphdr *)(f->data + outer_l3);
+
+		iph->tot_len = htons(f->len - outer_l3);
+	}
+}
+
+static int
+stats_get(uint64_t *packets)
+{
+	struct dhcpsnoop_bpf_stats stats;
+	uint32_t key = 0;
+
+	if (bpf_map_lookup_elem(stats_fd, &key, &stats))
+		return -1;
+
+	*packets = stats.packets;
+
+	return 0;
+}
+
+static int
+prog_load(const char *path)
+{
+	struct dhcpsnoop_bpf_config config = {};
+	struct bpf_program *prog;
+	struct bpf_map *map = NULL;
+
+	obj = bpf_object__open_file(path, NULL);
+	if (libbpf_get_error(obj)) {
+		fprintf(stderr, "Can't open %s\n", path);
+		obj = NULL;
+		return -1;
+	}
+
+	prog = bpf_object__find_program_by_name(obj, "dhcpsnoop_filter");
+	if (!prog) {
+		fprintf(stderr, "Can't find the DHCP classifier\n");
+		return -1;
+	}
+
+	bpf_program__set_type(prog, BPF_PROG_TYPE_SCHED_CLS);
+
+	while ((map = bpf_object__next_map(obj, map)) != NULL) {
+		if (strstr(bpf_map__name(map), ".rodata"))
+			bpf_map__set_initial_value(map, &config, sizeof(config));
+	}
+
+	if (bpf_object__load(obj)) {
+		fprintf(stderr, "Can't load %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	prog_fd = bpf_program__fd(prog);
+	stats_fd = bpf_object__find_map_fd_by_name(obj, "stats");
+	if (stats_fd < 0) {
+		fprintf(stderr, "Can't find map stats\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+run_test(const struct test_case *t, bool *match, uint32_t *ns)
+{
+	struct frame f;
+	LIBBPF_OPTS(bpf_test_run_opts, opts,
+		.data_in = f.data,
+		.repeat = repeat,
+	);
+	uint64_t before, after;
+
+	frame_build(&f, t);
+	opts.data_size_in = f.len;
+
+	if (stats_get(&before))
+		return -1;
+
+	if (bpf_prog_test_run_opts(prog_fd, &opts)) {
+		fprintf(stderr, "%s: test run failed: %s\n", t->name, strerror(errno));
+		return -1;
+	}
+
+	if (stats_get(&after))
+		return -1;
+
+	if (opts.retval != TC_ACT_UNSPEC) {
+		fprintf(stderr, "%s: verdict %d, expected %d\n", t->name,
+			(int)opts.retval, TC_ACT_UNSPEC);
+		return -1;
+	}
+
+	if (after - before != 0 && after - before != (uint64_t)repeat) {
+		fprintf(stderr, "%s: %llu matches in %d runs\n", t->name,
+			(unsigned long long)(after - before), repeat);
+		return -1;
+	}
+
+	*match = after != before;
+	*ns = opts.duration;
+
+	return *match == t->match ? 0 : -1;
+}
+
+static int
+run_tests(const char *filter)
+{
+	int failed = 0;
+	unsigned int i;
+
+	printf("%-24s %-8s %8s   %s\n", "case", "mirror", "ns/pkt", "result");
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		const struct test_case *t = &tests[i];
+		bool match = false;
+		uint32_t ns = 0;
+		bool ok;
+
+		if (filter && !strstr(t->name, filter))
+			continue;
+
+		ok = !run_test(t, &match, &ns);
+		printf("%-24s %-8s %8u   %s\n", t->name, match ? "yes" : "no", ns,
+		       ok ? "ok" : "FAIL");
+
+		failed += !ok;
+	}
+
+	if (failed)
+		fprintf(stderr, "%d case(s) failed\n", failed);
+
+	return !!failed;
+}
+
+static int
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] [<case filter>]\n"
+		"Options:\n"
+		"	-o <file>	BPF object (default: dhcpsnoop-bpf.o)\n"
+		"	-r <repeat>	Runs per case (default: 10000)\n"
+		"\n", prog);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit limit = {
+		.rlim_cur = RLIM_INFINITY,
+		.rlim_max = RLIM_INFINITY,
+	};
+	const char *path = "dhcpsnoop-bpf.o";
+	int ret = 1;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "o:r:")) != -1) {
+		switch (ch) {
+		case 'o':
+			path = optarg;
+			break;
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (repeat <= 0)
+		return usage(argv[0]);
+
+	setrlimit(RLIMIT_MEMLOCK, &limit);
+
+	if (!prog_load(path))
+		ret = run_tests(optind < argc ? argv[optind] : NULL);
+
+	bpf_object__close(obj);
+
+	return ret;
+}
@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#include <sys/resource.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "dhcpsnoop.h"
+#include "dhcpsnoop-bpf.h"
+
+static struct bpf_object *obj;
+static int prog_fd = -1;
+
+static int dhcpsnoop_bpf_pr(enum libbpf_print_level level, const char *format,
+			    va_list args)
+{
+	if (level == LIBBPF_DEBUG)
+		return 0;
+
+	return vfprintf(stderr, format, args);
+}
+
+static void
+dhcpsnoop_fill_rodata(struct bpf_object *obj, struct dhcpsnoop_bpf_config *val)
+{
+	struct bpf_map *map = NULL;
+
+	while ((map = bpf_object__next_map(obj, map)) != NULL) {
+		if (!strstr(bpf_map__name(map), ".rodata"))
+			continue;
+
+		bpf_map__set_initial_value(map, val, sizeof(*val));
+	}
+}
+
+int dhcpsnoop_bpf_init(int ifb_ifindex)
+{
+	struct dhcpsnoop_bpf_config config = {
+		.ifb_ifindex = ifb_ifindex,
+	};
+	struct rlimit limit = {
+		.rlim_cur = RLIM_INFINITY,
+		.rlim_max = RLIM_INFINITY,
+	};
+	struct bpf_program *prog;
+
+	dhcpsnoop_bpf_done();
+
+	libbpf_set_print(dhcpsnoop_bpf_pr);
+	setrlimit(RLIMIT_MEMLOCK, &limit);
+
+	obj = bpf_object__open_file(DHCPSNOOP_PROG_PATH, NULL);
+	if (libbpf_get_error(obj)) {
+		ULOG_ERR("failed to open "DHCPSNOOP_PROG_PATH"\n");
+		obj = NULL;
+		return -1;
+	}
+
+	prog = bpf_object__find_program_by_name(obj, "dhcpsnoop_filter");
+	if (!prog) {
+		ULOG_ERR("can't find the DHCP classifier\n");
+		goto error;
+	}
+
+	bpf_program__set_type(prog, BPF_PROG_TYPE_SCHED_CLS);
+	dhcpsnoop_fill_rodata(obj, &config);
+
+	if (bpf_object__load(obj)) {
+		ULOG_ERR("failed to load "DHCPSNOOP_PROG_PATH": %s\n", strerror(errno));
+		goto error;
+	}
+
+	prog_fd = bpf_program__fd(prog);
+
+	return 0;
+
+error:
+	dhcpsnoop_bpf_done();
+	return -1;
+}
+
+void dhcpsnoop_bpf_done(void)
+{
+	bpf_object__close(obj);
+	obj = NULL;
+	prog_fd = -1;
+}
+
+void dhcpsnoop_bpf_set_device(int ifindex, bool egress, bool enabled)
+{
+	DECLARE_LIBBPF_OPTS(bpf_tc_hook, hook,
+			    .attach_point = egress ? BPF_TC_EGRESS : BPF_TC_INGRESS,
+			    .ifindex = ifindex);
+	DECLARE_LIBBPF_OPTS(bpf_tc_opts, attach_tc,
+			    .handle = 1,
+			    .priority = DHCPSNOOP_PRIO_BASE);
+
+	if (!enabled) {
+		bpf_tc_detach(&hook, &attach_tc);
+		return;
+	}
+
+	if (prog_fd < 0)
+		return;
+
+	attach_tc.prog_fd = prog_fd;
+	attach_tc.flags = BPF_TC_F_REPLACE;
+
+	bpf_tc_hook_create(&hook);
+	if (bpf_tc_attach(&hook, &attach_tc))
+		ULOG_ERR("failed to attach the DHCP classifier to ifindex %d %sgress\n",
+			 ifindex, egress ? "e" : "in");
+}
@@ -0,0 +1,214 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "dhcpsnoop.h"
+#include "msg.h"
+
+/*
+ * Inserts leases into the snooping cache and, for comparison, arms one
+ * uloop timeout per lease the way the cache used to. With -f, the cache
+ * is also reloaded from a snapshot file and compared with the original.
+ */
+
+static struct blob_buf b;
+
+static uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+lease_msg(struct dhcpv4_message *msg, uint32_t i)
+{
+	memset(msg, 0, sizeof(*msg));
+	msg->chaddr[0] = 0x02;
+	msg->chaddr[1] = 0x5f;
+	msg->chaddr[2] = i >> 24;
+	msg->chaddr[3] = i >> 16;
+	msg->chaddr[4] = i >> 8;
+	msg->chaddr[5] = i;
+	msg->yiaddr.s_addr = htonl(0x0a000000 | i);
+}
+
+/* spread between 30 minutes and one day */
+static uint32_t
+lease_time(uint32_t i)
+{
+	return 1800 + (i * 7919) % (86400 - 1800);
+}
+
+static void
+leases_add(uint32_t n, uint32_t offset)
+{
+	struct dhcpv4_message msg;
+	uint32_t i;
+
+	for (i = 0; i < n; i++) {
+		lease_msg(&msg, i);
+		cache_entry(&msg, lease_time(i + offset));
+	}
+}
+
+static void
+bench_uloop(uint32_t n)
+{
+	struct uloop_timeout *t;
+	uint64_t start;
+	uint32_t i;
+
+	t = calloc(n, sizeof(*t));
+	if (!t)
+		return;
+
+	start = bench_now();
+	for (i = 0; i < n; i++)
+		uloop_timeout_set(&t[i], lease_time(i) * 1000);
+	printf("uloop timeouts: %u inserts, %.2f ms\n", n,
+	       (double)(bench_now() - start) / 1000000);
+
+	for (i = 0; i < n; i++)
+		uloop_timeout_cancel(&t[i]);
+	free(t);
+}
+
+static void
+bench_cache(uint32_t n)
+{
+	uint64_t start;
+
+	cache_init(NULL, 0);
+
+	start = bench_now();
+	leases_add(n, 0);
+	printf("cache: %u inserts, %.2f ms\n", n,
+	       (double)(bench_now() - start) / 1000000);
+
+	start = bench_now();
+	leases_add(n, 1);
+	printf("cache: %u renewals, %.2f ms\n", n,
+	       (double)(bench_now() - start) / 1000000);
+
+	cache_done();
+}
+
+static int
+cache_count(struct blob_attr *data)
+{
+	struct blob_attr *cur;
+	int rem, n = 0;
+
+	blobmsg_for_each_attr(cur, data, rem)
+		n++;
+
+	return n;
+}
+
+static int
+test_restart(const char *path, uint32_t n)
+{
+	struct blob_attr *orig;
+	uint64_t start;
+	int ret = 0;
+
+	unlink(path);
+	if (cache_init(path, n))
+		return -1;
+
+	leases_add(n, 0);
+
+	blob_buf_init(&b, 0);
+	cache_dump(&b);
+	orig = blob_memdup(b.head);
+	cache_done();
+
+	start = bench_now();
+	if (cache_init(path, n)) {
+		free(orig);
+		return -1;
+	}
+	printf("snapshot: restored in %.2f ms\n",
+	       (double)(bench_now() - start) / 1000000);
+
+	blob_buf_init(&b, 0);
+	cache_dump(&b);
+
+	if (blob_len(orig) != blob_len(b.head) ||
+	    memcmp(blob_data(orig), blob_data(b.head), blob_len(orig)) != 0) {
+		fprintf(stderr, "snapshot: %d entries before restart, %d after, "
+			"contents differ\n", cache_count(orig), cache_count(b.head));
+		ret = -1;
+	} else {
+		printf("snapshot: %d entries restored\n", cache_count(b.head));
+	}
+
+	cache_done();
+	unlink(path);
+	free(orig);
+
+	return ret;
+}
+
+static int
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"Options:\n"
+		"	-n <leases>	Number of leases (default: 50000)\n"
+		"	-f <file>	Run the restart test with this snapshot file\n"
+		"	-u		Skip the uloop timeout comparison\n"
+		"\n", prog);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = NULL;
+	bool skip_uloop = false;
+	int n = 50000;
+	int ret = 0;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "n:f:u")) != -1) {
+		switch (ch) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'f':
+			path = optarg;
+			break;
+		case 'u':
+			skip_uloop = true;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (n <= 0 || n > 0xffffff)
+		return usage(argv[0]);
+
+	ulog_open(ULOG_STDIO, LOG_DAEMON, "cache-bench");
+
+	if (!skip_uloop)
+		bench_uloop(n);
+	bench_cache(n);
+
+	if (path && test_restart(path, n))
+		ret = 1;
+
+	blob_buf_free(&b);
+
+	return ret;
+}
@@ -3,10 +3,21 @@
  * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
 #include <libubox/avl.h>
 
 #include "dhcpsnoop.h"
 #include "msg.h"
+#include "timer-wheel.h"
 
 #define MAC_FMT "%02x:%02x:%02x:%02x:%02x:%02x"
 #define MAC_VAR(x) x[0], x[1], x[2], x[3], x[4], x[5]
@@ -14,13 +25,47 @@
 #define IP_FMT  "%d.%d.%d.%d"
 #define IP_VAR(x) x[0], x[1], x[2], x[3]
 
+/* keeps expiry times within the signed range of the timer wheel */
+#define CACHE_TIMEOUT_MAX	(1U << 30)
+
+#define CACHE_SNAPSHOT_MAGIC	0x64736331
+#define CACHE_BOOT_ID_LEN	40
+
 struct mac {
         struct avl_node avl;
 	uint8_t mac[6];
 	uint8_t ip[4];
-	struct uloop_timeout rebind;
+	struct timer_wheel_entry timer;
+	int slot;
+};
+
+/*
+ * The snapshot file mirrors the cache in fixed size slots, entries are
+ * written in place on every update. Expiry times are monotonic seconds,
+ * so the file is only valid within the boot it was written in.
+ */
+struct cache_snapshot_hdr {
+	uint32_t magic;
+	uint32_t entries;
+	char boot_id[CACHE_BOOT_ID_LEN];
 };
 
+struct cache_snapshot_entry {
+	uint8_t mac[6];
+	uint8_t ip[4];
+	uint8_t used;
+	uint8_t pad;
+	uint32_t expires;
+};
+
+static struct {
+	struct cache_snapshot_hdr *hdr;
+	struct cache_snapshot_entry *entries;
+	size_t len;
+	uint32_t *free;
+	uint32_t n_free;
+} snap;
+
 static int
 avl_mac_cmp(const void *k1, const void *k2, void *ptr)
 {
@@ -28,36 +73,127 @@ avl_mac_cmp(const void *k1, const void *k2, void *ptr)
 }
 
 static struct avl_tree mac_tree = AVL_TREE_INIT(mac_tree, avl_mac_cmp, false, NULL);
+static struct timer_wheel cache_timers;
+static struct uloop_timeout gc_timer;
+
+static uint32_t
+cache_gettime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec;
+}
 
 static void
-cache_expire(struct uloop_timeout *t)
+cache_snapshot_store(struct mac *mac)
 {
-	struct mac *mac = container_of(t, struct mac, rebind);
+	struct cache_snapshot_entry *e;
+
+	if (!snap.hdr)
+		return;
+
+	if (mac->slot < 0) {
+		if (!snap.n_free)
+			return;
 
+		mac->slot = snap.free[--snap.n_free];
+	}
+
+	e = &snap.entries[mac->slot];
+	memcpy(e->mac, mac->mac, sizeof(e->mac));
+	memcpy(e->ip, mac->ip, sizeof(e->ip));
+	e->expires = mac->timer.expires;
+	e->used = 1;
+}
+
+static void
+cache_snapshot_release(struct mac *mac)
+{
+	if (!snap.hdr || mac->slot < 0)
+		return;
+
+	snap.entries[mac->slot].used = 0;
+	snap.free[snap.n_free++] = mac->slot;
+	mac->slot = -1;
+}
+
+static struct mac *
+cache_entry_alloc(const uint8_t *addr)
+{
+	struct mac *mac;
+
+	mac = calloc(1, sizeof(*mac));
+	if (!mac)
+		return NULL;
+
+	memcpy(mac->mac, addr, 6);
+	mac->avl.key = mac->mac;
+	mac->slot = -1;
+	avl_insert(&mac_tree, &mac->avl);
+
+	return mac;
+}
+
+static void
+cache_entry_free(struct mac *mac)
+{
+	timer_wheel_del(&cache_timers, &mac->timer);
+	cache_snapshot_release(mac);
 	avl_delete(&mac_tree, &mac->avl);
 	free(mac);
 }
 
+static void
+cache_expire(struct timer_wheel *w, struct timer_wheel_entry *t)
+{
+	struct mac *mac = container_of(t, struct mac, timer);
+
+	cache_entry_free(mac);
+}
+
+static void
+cache_gc(struct uloop_timeout *t)
+{
+	timer_wheel_advance(&cache_timers, cache_gettime(), cache_expire);
+
+	if (cache_timers.count)
+		uloop_timeout_set(t, 1000);
+}
+
+static void
+cache_entry_set_timeout(struct mac *mac, uint32_t now, uint32_t timeout)
+{
+	if (timeout > CACHE_TIMEOUT_MAX)
+		timeout = CACHE_TIMEOUT_MAX;
+
+	timer_wheel_add(&cache_timers, &mac->timer, now + timeout);
+
+	if (!gc_timer.pending)
+		uloop_timeout_set(&gc_timer, 1000);
+}
+
 void
 cache_entry(void *_msg, uint32_t rebind)
 {
 	struct dhcpv4_message *msg = (struct dhcpv4_message *) _msg;
+	uint32_t now = cache_gettime();
 	struct mac *mac;
 
-	mac = avl_find_element(&mac_tree, msg->chaddr, mac, avl);
+	/* catch up first, the gc timer is stopped while the cache is empty */
+	timer_wheel_advance(&cache_timers, now, cache_expire);
 
+	mac = avl_find_element(&mac_tree, msg->chaddr, mac, avl);
 	if (!mac) {
-		mac = malloc(sizeof(*mac));
+		mac = cache_entry_alloc(msg->chaddr);
 		if (!mac)
 			return;
-		memset(mac, 0, sizeof(*mac));
-		memcpy(mac->mac, msg->chaddr, 6);
-		mac->avl.key = mac->mac;
-		mac->rebind.cb = cache_expire;
-		avl_insert(&mac_tree, &mac->avl);
 	}
+
 	memcpy(mac->ip, &msg->yiaddr.s_addr, 4);
-	uloop_timeout_set(&mac->rebind, rebind * 1000);
+	cache_entry_set_timeout(mac, now, rebind);
+	cache_snapshot_store(mac);
 }
 
 void
@@ -75,3 +211,129 @@ cache_dump(struct blob_buf *b)
 		blobmsg_add_string(b, addr, ip);
 	}
 }
+
+static void
+cache_boot_id(char *buf)
+{
+	FILE *f;
+
+	memset(buf, 0, CACHE_BOOT_ID_LEN);
+
+	f = fopen("/proc/sys/kernel/random/boot_id", "r");
+	if (!f)
+		return;
+
+	if (fgets(buf, CACHE_BOOT_ID_LEN, f))
+		buf[strcspn(buf, "\n")] = 0;
+
+	fclose(f);
+}
+
+static void
+cache_snapshot_restore(uint32_t now)
+{
+	uint32_t i;
+
+	for (i = snap.hdr->entries; i > 0; i--) {
+		struct cache_snapshot_entry *e = &snap.entries[i - 1];
+		struct mac *mac;
+
+		if (e->used &&
+		    (int32_t)(e->expires - now) > 0 &&
+		    !avl_find(&mac_tree, e->mac) &&
+		    (mac = cache_entry_alloc(e->mac)) != NULL) {
+			memcpy(mac->ip, e->ip, sizeof(mac->ip));
+			mac->slot = i - 1;
+			cache_entry_set_timeout(mac, now, e->expires - now);
+			continue;
+		}
+
+		e->used = 0;
+		snap.free[snap.n_free++] = i - 1;
+	}
+}
+
+static int
+cache_snapshot_open(const char *path, uint32_t entries)
+{
+	char boot_id[CACHE_BOOT_ID_LEN];
+	size_t len;
+	struct stat st;
+	void *map;
+	int fd;
+
+	len = sizeof(*snap.hdr) + entries * sizeof(*snap.entries);
+
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		ULOG_ERR("failed to open cache snapshot %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if ((fstat(fd, &st) || st.st_size != len) &&
+	    (ftruncate(fd, 0) || ftruncate(fd, len))) {
+		ULOG_ERR("failed to resize cache snapshot %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		ULOG_ERR("failed to map cache snapshot %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	snap.free = calloc(entries, sizeof(*snap.free));
+	if (!snap.free) {
+		munmap(map, len);
+		return -1;
+	}
+
+	snap.hdr = map;
+	snap.entries = (struct cache_snapshot_entry *)(snap.hdr + 1);
+	snap.len = len;
+	snap.n_free = 0;
+
+	cache_boot_id(boot_id);
+	if (snap.hdr->magic != CACHE_SNAPSHOT_MAGIC ||
+	    snap.hdr->entries != entries ||
+	    memcmp(snap.hdr->boot_id, boot_id, sizeof(boot_id)) != 0) {
+		memset(map, 0, len);
+		memcpy(snap.hdr->boot_id, boot_id, sizeof(boot_id));
+		snap.hdr->entries = entries;
+		snap.hdr->magic = CACHE_SNAPSHOT_MAGIC;
+	}
+
+	cache_snapshot_restore(cache_gettime());
+	ULOG_INFO("restored %u cache entries from %s\n", cache_timers.count, path);
+
+	return 0;
+}
+
+int cache_init(const char *snapshot, uint32_t entries)
+{
+	timer_wheel_init(&cache_timers, cache_gettime());
+	gc_timer.cb = cache_gc;
+
+	if (!snapshot || !entries)
+		return 0;
+
+	return cache_snapshot_open(snapshot, entries);
+}
+
+/* leaves the snapshot contents in place for the next start */
+void cache_done(void)
+{
+	struct mac *mac, *tmp;
+
+	uloop_timeout_cancel(&gc_timer);
+
+	avl_remove_all_elements(&mac_tree, mac, avl, tmp)
+		free(mac);
+
+	if (snap.hdr)
+		munmap(snap.hdr, snap.len);
+	free(snap.free);
+	memset(&snap, 0, sizeof(snap));
+}
@@ -20,8 +20,6 @@
 
 #include "dhcpsnoop.h"
 
-#define APPEND(_buf, _ofs, _format, ...) _ofs += snprintf(_buf + _ofs, sizeof(_buf) - _ofs, _format, ##__VA_ARGS__)
-
 struct vlan_hdr {
 	uint16_t tci;
 	uint16_t proto;
@@ -161,7 +159,7 @@ inside_tunnel:
 	if (!type)
 		return;
 
-	dhcpsnoop_ubus_notify(type, pkt->buffer, pkt->len);
+	dhcpsnoop_ubus_notify(type, pkt->buffer, pkt->len, ipv6);
 	if (!ipv6 && !strcmp(type, "ack") && rebind)
 		cache_entry(pkt->buffer, rebind);
 }
@@ -225,136 +223,26 @@ error:
 	return -1;
 }
 
-static int
-prepare_filter_cmd(char *buf, int len, const char *dev, int prio, bool add, bool egress)
-{
-	return snprintf(buf, len, "tc filter %s dev '%s' %sgress prio %d",
-			add ? "add" : "del", dev, egress ? "e" : "in", prio);
-}
-
-#define MATCH_GRE_ETH_IP_UDP_DHCP_67 \
-	" match u16 0x6558 0xffff at 22 " \
-	" match u16 0x0800 0xffff at 36 " \
-	" match u8 17 0xff at 47 " \
-	" match u16 67 0xffff at 58 "
-
-#define MATCH_GRE_ETH_VLAN_IP_UDP_DHCP_67 \
-	" match u16 0x6558 0xffff at 22 " \
-	" match u16 0x8100 0xffff at 36 " \
-	" match u16 0x0800 0xffff at 40 " \
-	" match u8 17 0xff at 51 " \
-	" match u16 67 0xffff at 62 "
-
-#define MATCH_GRE_ETH_IP_UDP_DHCP_68 \
-	" match u16 0x6558 0xffff at 22 " \
-	" match u16 0x0800 0xffff at 36 " \
-	" match u8 17 0xff at 47 " \
-	" match u16 68 0xffff at 58 "
-
-#define MATCH_GRE_ETH_VLAN_IP_UDP_DHCP_68 \
-	" match u16 0x6558 0xffff at 22 " \
-	" match u16 0x8100 0xffff at 36 " \
-	" match u16 0x0800 0xffff at 40 " \
-	" match u8 17 0xff at 51 " \
-	" match u16 68 0xffff at 62 "
-
-static void
-dhcpsnoop_dev_attach_filters(struct device *dev, bool egress)
-{
-	int prio = DHCPSNOOP_PRIO_BASE;
-	char buf[350];
-	int ofs;
-
-	ofs = prepare_filter_cmd(buf, sizeof(buf), dev->ifname, prio++, true, egress);
-	APPEND(buf, ofs, " protocol ip u32 match ip sport 67 0xffff"
-			 " flowid 1:1 action mirred ingress mirror dev " DHCPSNOOP_IFB_NAME " continue");
-	dhcpsnoop_run_cmd(buf, false);
-
-	ofs = prepare_filter_cmd(buf, sizeof(buf), dev->ifname, prio++, true, egress);
-	APPEND(buf, ofs, " protocol 802.1Q u32 offset plus 4 match ip sport 67 0xffff"
-			 " flowid 1:1 action mirred ingress mirror dev " DHCPSNOOP_IFB_NAME " continue");
-	dhcpsnoop_run_cmd(buf, false);
-
-	ofs = prepare_filter_cmd(buf, sizeof(buf), dev->ifname, prio++, true, egress);
-	APPEND(buf, ofs, " protocol ip u32 match ip sport 68 0xffff"
-			 " flowid 1:1 action mirred ingress mirror dev " DHCPSNOOP_IFB_NAME " continue");
-	dhcpsnoop_run_cmd(buf, false);
-
-	ofs = prepare_filter_cmd(buf, sizeof(buf), dev->ifname, prio++, true, egress);
-	APPEND(buf, ofs, " protocol 802.1Q u32 offset plus 4 match ip sport 68 0xffff"
-			 " flowid 1:1 action mirred ingress mirror dev " DHCPSNOOP_IFB_NAME " continue");
-	dhcpsnoop_run_cmd(buf, false);
-
-	/* GRE */
-	ofs = prepare_filter_cmd(buf, sizeof(buf), dev->ifname, prio++, true, egress);
-	APPEND(buf, ofs, " protocol ip u32 match ip protocol 47 0xff"
-			 MATCH_GRE_ETH_IP_UDP_DHCP_67
-			 " flowid 1:1 action mirred ingress mirror dev " DHCPSNOOP_IFB_NAME " continue");
-	dhcpsnoop_run_cmd(buf, false);
-
-	ofs = prepare_filter_cmd(buf, sizeof(buf), dev->ifname, prio++, true, egress);
-	APPEND(buf, ofs, " protocol ip u32 match ip protocol 47 0xff"
-			 MATCH_GRE_ETH_IP_UDP_DHCP_68
-			 " flowid 1:1 action mirred ingress mirror dev " DHCPSNOOP_IFB_NAME " continue");
-	dhcpsnoop_run_cmd(buf, false);
-
-	ofs = prepare_filter_cmd(buf, sizeof(buf), dev->ifname, prio++, true, egress);
-	APPEND(buf, ofs, " protocol ip u32 match ip protocol 47 0xff "
-			 MATCH_GRE_ETH_VLAN_IP_UDP_DHCP_67
-			 " flowid 1:1 action mirred ingress mirror dev " DHCPSNOOP_IFB_NAME " continue");
-	dhcpsnoop_run_cmd(buf, false);
-
-	ofs = prepare_filter_cmd(buf, sizeof(buf), dev->ifname, prio++, true, egress);
-	APPEND(buf, ofs, " protocol ip u32 match ip protocol 47 0xff"
-			 MATCH_GRE_ETH_VLAN_IP_UDP_DHCP_68
-			 " flowid 1:1 action mirred ingress mirror dev " DHCPSNOOP_IFB_NAME " continue");
-	dhcpsnoop_run_cmd(buf, false);
-
-	/* IPv6 */
-	ofs = prepare_filter_cmd(buf, sizeof(buf), dev->ifname, prio++, true, egress);
-	APPEND(buf, ofs, " protocol ipv6 u32 match ip6 sport 546 0xfffe"
-			 " flowid 1:1 action mirred ingress mirror dev " DHCPSNOOP_IFB_NAME " continue");
-	dhcpsnoop_run_cmd(buf, false);
-
-	ofs = prepare_filter_cmd(buf, sizeof(buf), dev->ifname, prio++, true, egress);
-	APPEND(buf, ofs, " protocol 802.1Q u32 offset plus 4 match ip6 sport 546 0xfffe"
-			 " flowid 1:1 action mirred ingress mirror dev " DHCPSNOOP_IFB_NAME " continue");
-	dhcpsnoop_run_cmd(buf, false);
-}
-
-static void
-dhcpsnoop_dev_cleanup_filters(struct device *dev, bool egress)
-{
-	char buf[128];
-	int i;
-
-	for (i = DHCPSNOOP_PRIO_BASE; i < DHCPSNOOP_PRIO_BASE + 10; i++) {
-		prepare_filter_cmd(buf, sizeof(buf), dev->ifname, i, false, egress);
-		dhcpsnoop_run_cmd(buf, true);
-	}
-}
-
 static void
 dhcpsnoop_dev_attach(struct device *dev)
 {
-	char buf[64];
-
 	dev->active = true;
-	snprintf(buf, sizeof(buf), "tc qdisc add dev '%s' clsact", dev->ifname);
-	dhcpsnoop_run_cmd(buf, true);
 
 	if (dev->ingress)
-		dhcpsnoop_dev_attach_filters(dev, false);
+		dhcpsnoop_bpf_set_device(dev->ifindex, false, true);
 	if (dev->egress)
-		dhcpsnoop_dev_attach_filters(dev, true);
+		dhcpsnoop_bpf_set_device(dev->ifindex, true, true);
 }
 
 static void
 dhcpsnoop_dev_cleanup(struct device *dev)
 {
 	dev->active = false;
-	dhcpsnoop_dev_cleanup_filters(dev, true);
-	dhcpsnoop_dev_cleanup_filters(dev, false);
+	if (!dev->ifindex)
+		return;
+
+	dhcpsnoop_bpf_set_device(dev->ifindex, true, false);
+	dhcpsnoop_bpf_set_device(dev->ifindex, false, false);
 }
 
 static void
@@ -478,6 +366,7 @@ int dhcpsnoop_dev_init(void)
 
 	if (dhcpsnoop_run_cmd("ip link add "DHCPSNOOP_IFB_NAME" type ifb", false) ||
 	    dhcpsnoop_run_cmd("ip link set dev "DHCPSNOOP_IFB_NAME" up", false) ||
+	    dhcpsnoop_bpf_init(if_nametoindex(DHCPSNOOP_IFB_NAME)) ||
 	    dhcpsnoop_open_socket())
 		return -1;
 
@@ -493,4 +382,5 @@ void dhcpsnoop_dev_done(void)
 
 	dhcpsnoop_run_cmd("ip link del "DHCPSNOOP_IFB_NAME, true);
 	vlist_flush_all(&devices);
+	dhcpsnoop_bpf_done();
 }
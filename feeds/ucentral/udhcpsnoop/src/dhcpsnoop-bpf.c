@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#define KBUILD_MODNAME "dhcpsnoop"
+#include <uapi/linux/bpf.h>
+#include <uapi/linux/if_ether.h>
+#include <uapi/linux/if_packet.h>
+#include <uapi/linux/ip.h>
+#include <uapi/linux/ipv6.h>
+#include <uapi/linux/in.h>
+#include <uapi/linux/udp.h>
+#include <uapi/linux/filter.h>
+#include <uapi/linux/pkt_cls.h>
+#include <linux/if_vlan.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+#include "bpf_skb_utils.h"
+#include "dhcpsnoop-bpf.h"
+
+static const volatile struct dhcpsnoop_bpf_config config = {};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(key_size, sizeof(uint32_t));
+	__type(value, struct dhcpsnoop_bpf_stats);
+	__uint(max_entries, 1);
+} stats SEC(".maps");
+
+struct dhcpsnoop_gre_hdr {
+	__be16 flags;
+	__be16 protocol;
+};
+
+/* everything up to the inner IPv4 header of an ethernet over GRE frame */
+#define DHCPSNOOP_GRE_PULL \
+	(sizeof(struct dhcpsnoop_gre_hdr) + sizeof(struct ethhdr) + \
+	 sizeof(struct vlan_hdr) + sizeof(struct iphdr))
+
+static __always_inline bool
+dhcpsnoop_parse_ip(struct skb_parser_info *info, bool *ipv6)
+{
+	if (skb_parse_ipv4(info, sizeof(struct udphdr))) {
+		*ipv6 = false;
+		return true;
+	}
+
+	if (skb_parse_ipv6(info, sizeof(struct udphdr))) {
+		*ipv6 = true;
+		return true;
+	}
+
+	return false;
+}
+
+static __always_inline bool
+dhcpsnoop_parse_gre(struct skb_parser_info *info)
+{
+	struct dhcpsnoop_gre_hdr *gre;
+	struct ethhdr *eth;
+	__u32 pull_len;
+
+	if (info->proto != IPPROTO_GRE)
+		return false;
+
+	pull_len = info->offset + DHCPSNOOP_GRE_PULL;
+	if (pull_len > info->skb->len)
+		pull_len = info->skb->len;
+
+	if (bpf_skb_pull_data(info->skb, pull_len))
+		return false;
+
+	gre = skb_info_ptr(info, sizeof(*gre));
+	if (!gre || gre->protocol != bpf_htons(DHCPSNOOP_ETH_P_TEB))
+		return false;
+
+	info->offset += sizeof(*gre);
+
+	eth = skb_info_ptr(info, sizeof(*eth));
+	if (!eth)
+		return false;
+
+	info->proto = eth->h_proto;
+	info->offset += sizeof(*eth);
+	skb_parse_vlan(info);
+
+	return true;
+}
+
+static __always_inline bool
+dhcpsnoop_check_udp(struct skb_parser_info *info, bool ipv6)
+{
+	struct udphdr *udph;
+	__u16 port;
+
+	if (info->proto != IPPROTO_UDP)
+		return false;
+
+	udph = skb_info_ptr(info, sizeof(*udph));
+	if (!udph)
+		return false;
+
+	port = bpf_ntohs(udph->source);
+	if (ipv6)
+		return port == 546 || port == 547;
+
+	return port == 67 || port == 68;
+}
+
+/*
+ * Matches DHCPv4/DHCPv6 packets by UDP source port, untagged or with one
+ * VLAN tag, and inside ethernet over GRE (with an optional inner tag).
+ */
+static __always_inline bool
+dhcpsnoop_match(struct __sk_buff *skb)
+{
+	struct skb_parser_info info;
+	bool ipv6;
+
+	skb_parse_init(&info, skb);
+	if (!skb_parse_ethernet(&info))
+		return false;
+
+	skb_parse_vlan(&info);
+	if (!dhcpsnoop_parse_ip(&info, &ipv6))
+		return false;
+
+	if (dhcpsnoop_parse_gre(&info) && !dhcpsnoop_parse_ip(&info, &ipv6))
+		return false;
+
+	return dhcpsnoop_check_udp(&info, ipv6);
+}
+
+SEC("tc")
+int dhcpsnoop_filter(struct __sk_buff *skb)
+{
+	struct dhcpsnoop_bpf_stats *s;
+	uint32_t key = 0;
+
+	if (!dhcpsnoop_match(skb))
+		return TC_ACT_UNSPEC;
+
+	s = bpf_map_lookup_elem(&stats, &key);
+	if (s) {
+		__sync_fetch_and_add(&s->packets, 1);
+		__sync_fetch_and_add(&s->bytes, skb->len);
+	}
+
+	bpf_clone_redirect(skb, config.ifb_ifindex, BPF_F_INGRESS);
+
+	return TC_ACT_UNSPEC;
+}
+
+char _license[] SEC("license") = "GPL";
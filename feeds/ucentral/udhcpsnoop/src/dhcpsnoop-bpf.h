@@ -0,0 +1,19 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#ifndef __BPF_DHCPSNOOP_H
+#define __BPF_DHCPSNOOP_H
+
+#define DHCPSNOOP_ETH_P_TEB	0x6558
+
+struct dhcpsnoop_bpf_config {
+	uint32_t ifb_ifindex;
+};
+
+struct dhcpsnoop_bpf_stats {
+	uint64_t packets;
+	uint64_t bytes;
+};
+
+#endif
@@ -11,6 +11,8 @@
 
 #define DHCPSNOOP_IFB_NAME "ifb-dhcp"
 #define DHCPSNOOP_PRIO_BASE	0x100
+#define DHCPSNOOP_PROG_PATH	"/lib/bpf/dhcpsnoop.o"
+#define DHCPSNOOP_CACHE_ENTRIES	16384
 
 int dhcpsnoop_run_cmd(char *cmd, bool ignore_error);
 
@@ -19,13 +21,38 @@ void dhcpsnoop_dev_done(void);
 void dhcpsnoop_dev_config_update(struct blob_attr *data, bool add_only);
 void dhcpsnoop_dev_check(void);
 
+int dhcpsnoop_bpf_init(int ifb_ifindex);
+void dhcpsnoop_bpf_done(void);
+void dhcpsnoop_bpf_set_device(int ifindex, bool egress, bool enabled);
+
+#define DHCPSNOOP_BATCH_SIZE	64
+
+enum dhcpsnoop_notify_format {
+	DHCPSNOOP_NOTIFY_HEX,
+	DHCPSNOOP_NOTIFY_PARSED,
+};
+
+/* identifies retransmits: same message type, transaction and client */
+struct dhcpsnoop_notify_key {
+	const char *type;
+	uint32_t xid;
+	uint32_t client;
+};
+
 void dhcpsnoop_ubus_init(void);
 void dhcpsnoop_ubus_done(void);
-void dhcpsnoop_ubus_notify(const char *type, const uint8_t *msg, size_t len);
+void dhcpsnoop_ubus_notify(const char *type, const uint8_t *msg, size_t len, bool ipv6);
+
+void dhcpsnoop_notify_fill(struct blob_buf *b, enum dhcpsnoop_notify_format format,
+			   const uint8_t *msg, size_t len, bool ipv6);
+bool dhcpsnoop_notify_key(struct dhcpsnoop_notify_key *key, const char *type,
+			  const uint8_t *msg, size_t len, bool ipv6);
 
 const char *dhcpsnoop_parse_ipv4(const void *buf, size_t len, uint16_t port, uint32_t *rebind);
 const char *dhcpsnoop_parse_ipv6(const void *buf, size_t len, uint16_t port);
 
+int cache_init(const char *snapshot, uint32_t entries);
+void cache_done(void);
 void cache_entry(void *msg, uint32_t rebind);
 void cache_dump(struct blob_buf *b);
 
@@ -4,6 +4,7 @@
  */
 #include <sys/wait.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include "dhcpsnoop.h"
 
@@ -65,18 +66,55 @@ out:
 	return status;
 }
 
+static int usage(const char *progname)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"Options:\n"
+		"	-c <file>	Keep a snapshot of the lease cache in <file>\n"
+		"	-n <entries>	Snapshot size (default: %d)\n"
+		"	-d		Log every snooped message\n"
+		"\n", progname, DHCPSNOOP_CACHE_ENTRIES);
+	return 1;
+}
+
 int main(int argc, char **argv)
 {
+	const char *snapshot = NULL;
+	int entries = DHCPSNOOP_CACHE_ENTRIES;
+	int log_level = LOG_INFO;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "c:dn:")) != -1) {
+		switch (ch) {
+		case 'd':
+			log_level = LOG_DEBUG;
+			break;
+		case 'c':
+			snapshot = optarg;
+			break;
+		case 'n':
+			entries = atoi(optarg);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (entries <= 0)
+		return usage(argv[0]);
+
 	ulog_open(ULOG_STDIO | ULOG_SYSLOG, LOG_DAEMON, "udhcpsnoop");
 	uloop_init();
+	cache_init(snapshot, entries);
 	dhcpsnoop_ubus_init();
 	dhcpsnoop_dev_init();
 
-	ulog_threshold(LOG_INFO);
+	ulog_threshold(log_level);
 	uloop_run();
 
 	dhcpsnoop_ubus_done();
 	dhcpsnoop_dev_done();
+	cache_done();
 	uloop_done();
 
 	return 0;
@@ -32,6 +32,7 @@ enum dhcpv4_opt {
 	DHCPV4_OPT_REQOPTS = 55,
 	DHCPV4_OPT_RENEW = 58,
 	DHCPV4_OPT_REBIND = 59,
+	DHCPV4_OPT_VENDOR_CLASS = 60,
 	DHCPV4_OPT_IPADDRESS = 50,
 	DHCPV4_OPT_MSG_TYPE = 53,
 	DHCPV4_OPT_HOSTNAME = 12,
@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "dhcpsnoop.h"
+#include "msg.h"
+
+/*
+ * Compares the cost of building one ubus notification per snooped packet:
+ * the old per-packet stderr trace plus hex encoding, hex encoding alone and
+ * the parsed format. The trace goes to /dev/null unless -t is given, so the
+ * first mode is a lower bound for the logging overhead.
+ */
+
+static struct blob_buf b;
+
+static uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint8_t *
+opt_put(uint8_t *pos, uint8_t code, const void *data, uint8_t len)
+{
+	*pos++ = code;
+	*pos++ = len;
+	memcpy(pos, data, len);
+
+	return pos + len;
+}
+
+/* a typical client DISCOVER */
+static size_t
+build_discover(uint8_t *buf)
+{
+	static const uint8_t reqopts[] = { 1, 3, 6, 15, 26, 28, 51, 58, 59, 43, 119 };
+	static const uint8_t client_id[] = { 1, 0x02, 0x5f, 0, 0, 0, 1 };
+	static const uint8_t maxsize[] = { 0x05, 0xdc };
+	struct dhcpv4_message *msg = (struct dhcpv4_message *)buf;
+	uint8_t type = DHCPV4_MSG_DISCOVER;
+	uint8_t *pos;
+
+	memset(msg, 0, sizeof(*msg));
+	msg->op = 1;
+	msg->htype = 1;
+	msg->hlen = 6;
+	msg->xid = htonl(0x12345678);
+	memcpy(msg->chaddr, &client_id[1], 6);
+	msg->magic = htonl(DHCPV4_MAGIC);
+
+	pos = msg->options;
+	pos = opt_put(pos, DHCPV4_OPT_MSG_TYPE, &type, 1);
+	pos = opt_put(pos, 61, client_id, sizeof(client_id));
+	pos = opt_put(pos, 57, maxsize, sizeof(maxsize));
+	pos = opt_put(pos, 60, "android-dhcp-13", 15);
+	pos = opt_put(pos, DHCPV4_OPT_HOSTNAME, "Pixel-7", 7);
+	pos = opt_put(pos, DHCPV4_OPT_REQOPTS, reqopts, sizeof(reqopts));
+	*pos++ = DHCPV4_OPT_END;
+
+	/* BOOTP minimum size */
+	while (pos - buf < 300)
+		*pos++ = DHCPV4_OPT_PAD;
+
+	return pos - buf;
+}
+
+/* a SOLICIT with client id, ORO, elapsed time and IA_NA */
+static size_t
+build_solicit(uint8_t *buf)
+{
+	static const uint8_t opts[] = {
+		0x00, 0x01, 0x00, 0x0e, 0x00, 0x01, 0x00, 0x01, 0x2a, 0x2b,
+		0x2c, 0x2d, 0x02, 0x5f, 0x00, 0x00, 0x00, 0x01,
+		0x00, 0x06, 0x00, 0x04, 0x00, 0x17, 0x00, 0x18,
+		0x00, 0x08, 0x00, 0x02, 0x00, 0x00,
+		0x00, 0x03, 0x00, 0x0c, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	};
+	struct dhcpv6_message *msg = (struct dhcpv6_message *)buf;
+
+	msg->msg_type = DHCPV6_MSG_SOLICIT;
+	msg->transaction_id[0] = 0x12;
+	msg->transaction_id[1] = 0x34;
+	msg->transaction_id[2] = 0x56;
+	memcpy(msg->options, opts, sizeof(opts));
+
+	return sizeof(*msg) + sizeof(opts);
+}
+
+static void
+bench_mode(const char *name, FILE *trace, enum dhcpsnoop_notify_format format,
+	   const char *type, const uint8_t *msg, size_t len, bool ipv6, int rounds)
+{
+	uint64_t start;
+	int i;
+
+	start = bench_now();
+	for (i = 0; i < rounds; i++) {
+		if (trace)
+			fprintf(trace, "dhcp message type=%s\n", type);
+
+		blob_buf_init(&b, 0);
+		dhcpsnoop_notify_fill(&b, format, msg, len, ipv6);
+	}
+
+	printf("%-8s %-12s %4zu byte packet: %7.0f ns/msg, %4u byte message\n",
+	       type, name, len, (double)(bench_now() - start) / rounds,
+	       blob_pad_len(b.head));
+}
+
+static int
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"Options:\n"
+		"	-r <rounds>	Messages per mode (default: 100000)\n"
+		"	-t <file>	Trace output of the old mode (default: /dev/null)\n"
+		"\n", prog);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	const char *trace_path = "/dev/null";
+	uint8_t v4[512], v6[128];
+	size_t v4_len, v6_len;
+	int rounds = 100000;
+	FILE *trace;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "r:t:")) != -1) {
+		switch (ch) {
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 't':
+			trace_path = optarg;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (rounds <= 0)
+		return usage(argv[0]);
+
+	trace = fopen(trace_path, "w");
+	if (!trace) {
+		perror("fopen");
+		return 1;
+	}
+
+	/* unbuffered like stderr */
+	setvbuf(trace, NULL, _IONBF, 0);
+
+	v4_len = build_discover(v4);
+	v6_len = build_solicit(v6);
+
+	bench_mode("hex+trace", trace, DHCPSNOOP_NOTIFY_HEX, "discover", v4, v4_len, false, rounds);
+	bench_mode("hex", NULL, DHCPSNOOP_NOTIFY_HEX, "discover", v4, v4_len, false, rounds);
+	bench_mode("parsed", NULL, DHCPSNOOP_NOTIFY_PARSED, "discover", v4, v4_len, false, rounds);
+	bench_mode("hex+trace", trace, DHCPSNOOP_NOTIFY_HEX, "solicit", v6, v6_len, true, rounds);
+	bench_mode("hex", NULL, DHCPSNOOP_NOTIFY_HEX, "solicit", v6, v6_len, true, rounds);
+	bench_mode("parsed", NULL, DHCPSNOOP_NOTIFY_PARSED, "solicit", v6, v6_len, true, rounds);
+
+	fclose(trace);
+	blob_buf_free(&b);
+
+	return 0;
+}
@@ -0,0 +1,269 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dhcpsnoop.h"
+#include "msg.h"
+
+#define MAC_FMT "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC_VAR(x) x[0], x[1], x[2], x[3], x[4], x[5]
+
+static void
+notify_add_hex(struct blob_buf *b, const char *name, const uint8_t *data, size_t len)
+{
+	static const char hexdigits[] = "0123456789abcdef";
+	char *buf;
+
+	buf = blobmsg_alloc_string_buffer(b, name, 2 * len + 1);
+	while (len > 0) {
+		*buf++ = hexdigits[*data >> 4];
+		*buf++ = hexdigits[*data & 0xf];
+		data++;
+		len--;
+	}
+	*buf = 0;
+	blobmsg_add_string_buffer(b);
+}
+
+static void
+notify_add_addr(struct blob_buf *b, const char *name, const struct in_addr *addr)
+{
+	char buf[INET_ADDRSTRLEN];
+
+	inet_ntop(AF_INET, addr, buf, sizeof(buf));
+	blobmsg_add_string(b, name, buf);
+}
+
+static void
+notify_add_string(struct blob_buf *b, const char *name, const void *data, size_t len)
+{
+	char *buf;
+
+	buf = blobmsg_alloc_string_buffer(b, name, len + 1);
+	memcpy(buf, data, len);
+	buf[len] = 0;
+	blobmsg_add_string_buffer(b);
+}
+
+/*
+ * DHCPv4 options used by the in-tree subscribers are sent as typed values,
+ * all other options as hex strings of the option data.
+ */
+static void
+notify_add_option4(struct blob_buf *b, unsigned int code, const uint8_t *data, size_t len)
+{
+	char name[8];
+	size_t i;
+	void *c;
+
+	snprintf(name, sizeof(name), "%u", code);
+
+	switch (code) {
+	case DHCPV4_OPT_MSG_TYPE:
+		if (len != 1)
+			break;
+
+		blobmsg_add_u32(b, name, data[0]);
+		return;
+	case DHCPV4_OPT_HOSTNAME:
+	case DHCPV4_OPT_DOMAIN:
+	case DHCPV4_OPT_VENDOR_CLASS:
+		notify_add_string(b, name, data, len);
+		return;
+	case DHCPV4_OPT_REQOPTS:
+		c = blobmsg_open_array(b, name);
+		for (i = 0; i < len; i++)
+			blobmsg_add_u32(b, NULL, data[i]);
+		blobmsg_close_array(b, c);
+		return;
+	case DHCPV4_OPT_IPADDRESS:
+	case DHCPV4_OPT_SERVERID:
+		if (len != 4)
+			break;
+
+		notify_add_addr(b, name, (const struct in_addr *)data);
+		return;
+	}
+
+	notify_add_hex(b, name, data, len);
+}
+
+static void
+notify_add_option6(struct blob_buf *b, unsigned int code, const uint8_t *data, size_t len)
+{
+	char name[8];
+
+	snprintf(name, sizeof(name), "%u", code);
+	notify_add_hex(b, name, data, len);
+}
+
+static void
+notify_add_ipv4(struct blob_buf *b, const uint8_t *buf, size_t len)
+{
+	const struct dhcpv4_message *msg = (const void *)buf;
+	const uint8_t *pos, *end;
+	uint8_t type = 0;
+	char addr[18];
+	void *c;
+
+	if (len < sizeof(*msg))
+		return;
+
+	snprintf(addr, sizeof(addr), MAC_FMT, MAC_VAR(msg->chaddr));
+	blobmsg_add_string(b, "client", addr);
+	blobmsg_add_u32(b, "xid", ntohl(msg->xid));
+	notify_add_addr(b, "ciaddr", &msg->ciaddr);
+	notify_add_addr(b, "yiaddr", &msg->yiaddr);
+	notify_add_addr(b, "siaddr", &msg->siaddr);
+	notify_add_addr(b, "giaddr", &msg->giaddr);
+
+	pos = msg->options;
+	end = buf + len;
+
+	c = blobmsg_open_table(b, "options");
+	while (pos < end) {
+		const uint8_t *opt = pos++;
+
+		if (*opt == DHCPV4_OPT_END)
+			break;
+
+		if (*opt == DHCPV4_OPT_PAD)
+			continue;
+
+		if (pos >= end || 1 + *pos > end - pos)
+			break;
+
+		if (*opt == DHCPV4_OPT_MSG_TYPE && opt[1])
+			type = opt[2];
+
+		notify_add_option4(b, *opt, &opt[2], opt[1]);
+		pos += *pos + 1;
+	}
+	blobmsg_close_table(b, c);
+
+	blobmsg_add_u32(b, "msg_type", type);
+}
+
+static void
+notify_add_ipv6(struct blob_buf *b, const uint8_t *buf, size_t len)
+{
+	const struct dhcpv6_message *msg = (const void *)buf;
+	const uint8_t *pos, *end;
+	void *c;
+
+	if (len < sizeof(*msg))
+		return;
+
+	blobmsg_add_u32(b, "msg_type", msg->msg_type);
+	blobmsg_add_u32(b, "xid", (msg->transaction_id[0] << 16) |
+				  (msg->transaction_id[1] << 8) |
+				  msg->transaction_id[2]);
+
+	pos = msg->options;
+	end = buf + len;
+
+	c = blobmsg_open_table(b, "options");
+	while (end - pos >= 4) {
+		unsigned int code = (pos[0] << 8) | pos[1];
+		unsigned int optlen = (pos[2] << 8) | pos[3];
+
+		pos += 4;
+		if (optlen > end - pos)
+			break;
+
+		notify_add_option6(b, code, pos, optlen);
+		pos += optlen;
+	}
+	blobmsg_close_table(b, c);
+}
+
+/*
+ * DHCPSNOOP_NOTIFY_HEX sends the packet as a hex string only.
+ * DHCPSNOOP_NOTIFY_PARSED adds the decoded header fields and options
+ * (keyed by option code) to the same hex packet. Binary data is never sent
+ * as BLOBMSG_TYPE_UNSPEC, which blobmsg_json and the ucode binding drop.
+ */
+void dhcpsnoop_notify_fill(struct blob_buf *b, enum dhcpsnoop_notify_format format,
+			   const uint8_t *msg, size_t len, bool ipv6)
+{
+	if (format == DHCPSNOOP_NOTIFY_HEX) {
+		notify_add_hex(b, "packet", msg, len);
+		return;
+	}
+
+	blobmsg_add_u8(b, "ipv6", ipv6);
+	if (ipv6)
+		notify_add_ipv6(b, msg, len);
+	else
+		notify_add_ipv4(b, msg, len);
+
+	notify_add_hex(b, "packet", msg, len);
+}
+
+static uint32_t
+notify_hash(uint32_t hash, const uint8_t *data, size_t len)
+{
+	while (len--) {
+		hash ^= *data++;
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+/*
+ * DHCPv4 clients are identified by chaddr, DHCPv6 clients by a hash of
+ * their client identifier (DUID). Returns false if the client can't be
+ * identified.
+ */
+bool dhcpsnoop_notify_key(struct dhcpsnoop_notify_key *key, const char *type,
+			  const uint8_t *buf, size_t len, bool ipv6)
+{
+	const struct dhcpv6_message *msg6 = (const void *)buf;
+	const struct dhcpv4_message *msg = (const void *)buf;
+	const uint8_t *pos, *end;
+
+	memset(key, 0, sizeof(*key));
+	key->type = type;
+	key->client = 2166136261;
+
+	if (!ipv6) {
+		if (len < sizeof(*msg))
+			return false;
+
+		key->xid = msg->xid;
+		key->client = notify_hash(key->client, msg->chaddr, 6);
+
+		return true;
+	}
+
+	if (len < sizeof(*msg6))
+		return false;
+
+	memcpy(&key->xid, msg6->transaction_id, sizeof(msg6->transaction_id));
+
+	pos = msg6->options;
+	end = buf + len;
+	while (end - pos >= 4) {
+		unsigned int code = (pos[0] << 8) | pos[1];
+		unsigned int optlen = (pos[2] << 8) | pos[3];
+
+		pos += 4;
+		if (optlen > end - pos)
+			break;
+
+		/* OPTION_CLIENTID */
+		if (code == 1) {
+			key->client = notify_hash(key->client, pos, optlen);
+			return true;
+		}
+
+		pos += optlen;
+	}
+
+	return false;
+}
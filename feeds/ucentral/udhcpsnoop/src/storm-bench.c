@@ -0,0 +1,460 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#include <sys/socket.h>
+#include <netpacket/packet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <linux/if_ether.h>
+#include <arpa/inet.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <libubox/uloop.h>
+#include <libubox/blobmsg.h>
+#include <libubus.h>
+
+#include "msg.h"
+
+/*
+ * Simulates a reconnect storm: DISCOVERs from many clients, each sent
+ * several times like client retransmits, are injected into one end of a
+ * veth pair while udhcpsnoop snoops the other end. As a subscriber, counts
+ * the notifications (wakeups) and the DHCP messages they carry, and the
+ * latency from a client's first DISCOVER to its first notification.
+ */
+
+#define STORM_FRAME_LEN		342
+
+static struct ubus_context *ctx;
+static struct ubus_subscriber sub;
+static struct blob_buf b;
+static uint32_t obj_id;
+
+static const char *prefix = "dsstorm";
+static char tx_ifname[IFNAMSIZ], rx_ifname[IFNAMSIZ];
+static int n_clients = 500, retransmits = 3, rate = 5000;
+static int sock = -1;
+
+static struct uloop_timeout send_timer, done_timer;
+static uint64_t *sent_at, *seen_at;
+static uint64_t first_send, last_notify;
+static unsigned int n_sent, n_notify, n_msgs, n_seen;
+
+static uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+run_cmd(const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	return system(buf);
+}
+
+static uint16_t
+ip_csum(const void *data, size_t len)
+{
+	const uint16_t *p = data;
+	uint32_t sum = 0;
+
+	while (len > 1) {
+		sum += *p++;
+		len -= 2;
+	}
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return ~sum;
+}
+
+static size_t
+build_discover(uint8_t *buf, unsigned int client)
+{
+	uint8_t mac[ETH_ALEN] = { 0x02, 0x5f, 0, client >> 16, client >> 8, client };
+	struct ethhdr *eth = (struct ethhdr *)buf;
+	struct iphdr *iph = (struct iphdr *)(eth + 1);
+	struct udphdr *udph = (struct udphdr *)(iph + 1);
+	struct dhcpv4_message *msg = (struct dhcpv4_message *)(udph + 1);
+	uint8_t *pos;
+
+	memset(buf, 0, STORM_FRAME_LEN);
+	memset(eth->h_dest, 0xff, ETH_ALEN);
+	memcpy(eth->h_source, mac, ETH_ALEN);
+	eth->h_proto = htons(ETH_P_IP);
+
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->ttl = 64;
+	iph->protocol = IPPROTO_UDP;
+	iph->daddr = INADDR_BROADCAST;
+	iph->tot_len = htons(STORM_FRAME_LEN - sizeof(*eth));
+	iph->check = ip_csum(iph, sizeof(*iph));
+
+	udph->source = htons(68);
+	udph->dest = htons(67);
+	udph->len = htons(STORM_FRAME_LEN - sizeof(*eth) - sizeof(*iph));
+
+	msg->op = 1;
+	msg->htype = 1;
+	msg->hlen = ETH_ALEN;
+	msg->xid = htonl(0x5f000000 | client);
+	memcpy(msg->chaddr, mac, ETH_ALEN);
+	msg->magic = htonl(DHCPV4_MAGIC);
+
+	pos = msg->options;
+	*pos++ = DHCPV4_OPT_MSG_TYPE;
+	*pos++ = 1;
+	*pos++ = DHCPV4_MSG_DISCOVER;
+	*pos++ = 61;
+	*pos++ = 1 + ETH_ALEN;
+	*pos++ = 1;
+	memcpy(pos, mac, ETH_ALEN);
+	pos += ETH_ALEN;
+	*pos = DHCPV4_OPT_END;
+
+	return STORM_FRAME_LEN;
+}
+
+static void
+send_cb(struct uloop_timeout *t)
+{
+	unsigned int total = n_clients * retransmits;
+	unsigned int burst = rate / 1000;
+	uint8_t buf[STORM_FRAME_LEN];
+	unsigned int i;
+
+	if (!burst)
+		burst = 1;
+
+	for (i = 0; i < burst && n_sent < total; i++, n_sent++) {
+		unsigned int client = n_sent % n_clients;
+		size_t len = build_discover(buf, client);
+
+		if (!sent_at[client])
+			sent_at[client] = bench_now();
+		if (!first_send)
+			first_send = sent_at[client];
+
+		if (send(sock, buf, len, 0) < 0)
+			perror("send");
+	}
+
+	if (n_sent < total)
+		uloop_timeout_set(t, rate < 1000 ? 1000 / rate : 1);
+	else
+		uloop_timeout_set(&done_timer, 2000);
+}
+
+static void
+done_cb(struct uloop_timeout *t)
+{
+	uloop_end();
+}
+
+static int
+client_index(const char *addr)
+{
+	unsigned int mac[ETH_ALEN];
+	int idx;
+
+	if (sscanf(addr, "%02x:%02x:%02x:%02x:%02x:%02x",
+		   &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) != ETH_ALEN)
+		return -1;
+
+	if (mac[0] != 0x02 || mac[1] != 0x5f)
+		return -1;
+
+	idx = (mac[3] << 16) | (mac[4] << 8) | mac[5];
+	if (idx >= n_clients)
+		return -1;
+
+	return idx;
+}
+
+static void
+handle_msg(struct blob_attr *data, unsigned int len, uint64_t now)
+{
+	enum {
+		MSG_CLIENT,
+		MSG_PACKET,
+		__MSG_MAX
+	};
+	static const struct blobmsg_policy policy[__MSG_MAX] = {
+		[MSG_CLIENT] = { "client", BLOBMSG_TYPE_STRING },
+		[MSG_PACKET] = { "packet", BLOBMSG_TYPE_UNSPEC },
+	};
+	struct blob_attr *tb[__MSG_MAX], *cur;
+	char addr[18];
+	int idx = -1;
+
+	blobmsg_parse(policy, __MSG_MAX, tb, data, len);
+
+	n_msgs++;
+	if ((cur = tb[MSG_CLIENT]) != NULL) {
+		idx = client_index(blobmsg_get_string(cur));
+	} else if ((cur = tb[MSG_PACKET]) != NULL &&
+		   blobmsg_type(cur) == BLOBMSG_TYPE_STRING &&
+		   strlen(blobmsg_get_string(cur)) >= 2 * (28 + ETH_ALEN)) {
+		const char *hex = blobmsg_get_string(cur) + 2 * 28;
+
+		/* chaddr in the hex encoded packet */
+		snprintf(addr, sizeof(addr), "%.2s:%.2s:%.2s:%.2s:%.2s:%.2s",
+			 hex, hex + 2, hex + 4, hex + 6, hex + 8, hex + 10);
+		idx = client_index(addr);
+	}
+
+	if (idx < 0 || seen_at[idx])
+		return;
+
+	seen_at[idx] = now;
+	n_seen++;
+}
+
+static int
+notify_cb(struct ubus_context *ctx, struct ubus_object *obj,
+	  struct ubus_request_data *req, const char *method,
+	  struct blob_attr *msg)
+{
+	static const struct blobmsg_policy policy = {
+		"messages", BLOBMSG_TYPE_ARRAY
+	};
+	uint64_t now = bench_now();
+	struct blob_attr *attr, *cur;
+	int rem;
+
+	n_notify++;
+	last_notify = now;
+
+	if (strcmp(method, "batch") != 0) {
+		handle_msg(blob_data(msg), blob_len(msg), now);
+		return 0;
+	}
+
+	blobmsg_parse(&policy, 1, &attr, blob_data(msg), blob_len(msg));
+	if (!attr)
+		return 0;
+
+	blobmsg_for_each_attr(cur, attr, rem)
+		handle_msg(blobmsg_data(cur), blobmsg_len(cur), now);
+
+	return 0;
+}
+
+static int
+setup(void)
+{
+	struct sockaddr_ll sll = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_ALL),
+	};
+	void *c, *d;
+	int ret;
+
+	snprintf(tx_ifname, sizeof(tx_ifname), "%s0", prefix);
+	snprintf(rx_ifname, sizeof(rx_ifname), "%s1", prefix);
+
+	if (run_cmd("ip link add %s type veth peer name %s", tx_ifname, rx_ifname) ||
+	    run_cmd("ip link set dev %s up", tx_ifname) ||
+	    run_cmd("ip link set dev %s up", rx_ifname)) {
+		fprintf(stderr, "Failed to set up the veth pair\n");
+		return -1;
+	}
+
+	blob_buf_init(&b, 0);
+	c = blobmsg_open_table(&b, "devices");
+	d = blobmsg_open_table(&b, rx_ifname);
+	blobmsg_add_u8(&b, "ingress", 1);
+	blobmsg_close_table(&b, d);
+	blobmsg_close_table(&b, c);
+
+	ret = ubus_invoke(ctx, obj_id, "add_devices", b.head, NULL, NULL, 5000);
+	if (ret) {
+		fprintf(stderr, "add_devices failed: %s\n", ubus_strerror(ret));
+		return -1;
+	}
+
+	sub.cb = notify_cb;
+	if (ubus_register_subscriber(ctx, &sub) ||
+	    ubus_subscribe(ctx, &sub, obj_id)) {
+		fprintf(stderr, "Failed to subscribe to dhcpsnoop\n");
+		return -1;
+	}
+
+	sock = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (sock < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	sll.sll_ifindex = if_nametoindex(tx_ifname);
+	if (bind(sock, (struct sockaddr *)&sll, sizeof(sll))) {
+		perror("bind");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+cleanup(void)
+{
+	if (sock >= 0)
+		close(sock);
+
+	run_cmd("ip link del %s 2>/dev/null", tx_ifname);
+	ubus_invoke(ctx, obj_id, "check_devices", NULL, NULL, NULL, 5000);
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+	const uint64_t *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+static void
+report(void)
+{
+	uint64_t *lat, sum = 0;
+	double duration;
+	unsigned int i, n = 0;
+
+	duration = last_notify > first_send ?
+		   (double)(last_notify - first_send) / 1000000000 : 0;
+
+	printf("sent %u frames (%d clients x %d)\n", n_sent, n_clients, retransmits);
+	printf("received %u notifications with %u messages, %u/%d clients seen\n",
+	       n_notify, n_msgs, n_seen, n_clients);
+	if (duration > 0)
+		printf("%.1f notifications/s over %.2f s\n", n_notify / duration, duration);
+
+	lat = calloc(n_clients, sizeof(*lat));
+	if (!lat)
+		return;
+
+	for (i = 0; i < n_clients; i++) {
+		if (!seen_at[i] || !sent_at[i])
+			continue;
+
+		lat[n] = seen_at[i] - sent_at[i];
+		sum += lat[n++];
+	}
+
+	if (n) {
+		qsort(lat, n, sizeof(*lat), cmp_u64);
+		printf("latency: avg %.2f ms, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+		       (double)sum / n / 1000000, (double)lat[n / 2] / 1000000,
+		       (double)lat[n * 99 / 100] / 1000000, (double)lat[n - 1] / 1000000);
+	}
+
+	free(lat);
+}
+
+static int
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"Options:\n"
+		"	-c <clients>	Number of clients (default: 500)\n"
+		"	-n <count>	DISCOVERs sent per client (default: 3)\n"
+		"	-r <rate>	Frames per second (default: 5000)\n"
+		"	-i <prefix>	veth name prefix (default: dsstorm)\n"
+		"\n"
+		"udhcpsnoop has to be running. Notification format and batching\n"
+		"are taken from its current configuration.\n"
+		"\n", prog);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 1;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "c:n:r:i:")) != -1) {
+		switch (ch) {
+		case 'c':
+			n_clients = atoi(optarg);
+			break;
+		case 'n':
+			retransmits = atoi(optarg);
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'i':
+			prefix = optarg;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (n_clients <= 0 || n_clients > 0xffffff || retransmits <= 0 || rate <= 0 ||
+	    strlen(prefix) > IFNAMSIZ - 2)
+		return usage(argv[0]);
+
+	sent_at = calloc(n_clients, sizeof(*sent_at));
+	seen_at = calloc(n_clients, sizeof(*seen_at));
+	if (!sent_at || !seen_at)
+		return 1;
+
+	uloop_init();
+
+	ctx = ubus_connect(NULL);
+	if (!ctx) {
+		fprintf(stderr, "Failed to connect to ubus\n");
+		return 1;
+	}
+
+	if (ubus_lookup_id(ctx, "dhcpsnoop", &obj_id)) {
+		fprintf(stderr, "dhcpsnoop is not running\n");
+		goto out;
+	}
+
+	ubus_add_uloop(ctx);
+
+	if (setup())
+		goto cleanup;
+
+	/* give the daemon time to attach to the new device */
+	send_timer.cb = send_cb;
+	done_timer.cb = done_cb;
+	uloop_timeout_set(&send_timer, 500);
+	uloop_run();
+
+	report();
+	ret = 0;
+
+cleanup:
+	cleanup();
+out:
+	ubus_free(ctx);
+	uloop_done();
+	blob_buf_free(&b);
+	free(sent_at);
+	free(seen_at);
+
+	return ret;
+}
@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#include "timer-wheel.h"
+
+#define TIMER_WHEEL_MASK	(TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_RANGE(level) (1ULL << (TIMER_WHEEL_BITS * ((level) + 1)))
+
+void timer_wheel_init(struct timer_wheel *w, uint32_t now)
+{
+	int i, j;
+
+	for (i = 0; i < TIMER_WHEEL_LEVELS; i++)
+		for (j = 0; j < TIMER_WHEEL_SIZE; j++)
+			INIT_LIST_HEAD(&w->slots[i][j]);
+
+	w->now = now;
+	w->count = 0;
+}
+
+/*
+ * The current slot is already done, except while cascading: that happens
+ * before it is processed.
+ */
+static void
+__timer_wheel_add(struct timer_wheel *w, struct timer_wheel_entry *e, bool cascade)
+{
+	int32_t delta = e->expires - w->now;
+	int32_t min_delta = cascade ? 0 : 1;
+	uint32_t expires = e->expires;
+	int level;
+
+	if (delta < min_delta) {
+		expires = w->now + min_delta;
+		delta = min_delta;
+	}
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++)
+		if (delta < TIMER_WHEEL_RANGE(level))
+			break;
+
+	if (delta >= TIMER_WHEEL_RANGE(level))
+		expires = w->now + TIMER_WHEEL_RANGE(level) - 1;
+
+	list_add_tail(&e->list, &w->slots[level][(expires >> (TIMER_WHEEL_BITS * level)) &
+						  TIMER_WHEEL_MASK]);
+}
+
+void timer_wheel_add(struct timer_wheel *w, struct timer_wheel_entry *e,
+		     uint32_t expires)
+{
+	if (timer_wheel_pending(e))
+		list_del(&e->list);
+	else
+		w->count++;
+
+	e->expires = expires;
+	__timer_wheel_add(w, e, false);
+}
+
+void timer_wheel_del(struct timer_wheel *w, struct timer_wheel_entry *e)
+{
+	if (!timer_wheel_pending(e))
+		return;
+
+	list_del_init(&e->list);
+	w->count--;
+}
+
+static void
+timer_wheel_cascade(struct timer_wheel *w, int level)
+{
+	struct list_head *slot, list;
+	struct timer_wheel_entry *e, *tmp;
+	int idx;
+
+	idx = (w->now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+	slot = &w->slots[level][idx];
+
+	INIT_LIST_HEAD(&list);
+	list_splice_init(slot, &list);
+	list_for_each_entry_safe(e, tmp, &list, list)
+		__timer_wheel_add(w, e, true);
+}
+
+/*
+ * Runs cb for all entries expiring up to now. The entry is removed from
+ * the wheel before cb is called, cb may add it again or free it.
+ * Returns the number of expired entries.
+ */
+int timer_wheel_advance(struct timer_wheel *w, uint32_t now,
+			void (*cb)(struct timer_wheel *w, struct timer_wheel_entry *e))
+{
+	struct timer_wheel_entry *e;
+	struct list_head *slot;
+	int n = 0;
+	int level;
+
+	while ((int32_t)(now - w->now) > 0) {
+		w->now++;
+
+		for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+			if (w->now & ((1U << (TIMER_WHEEL_BITS * level)) - 1))
+				break;
+
+			timer_wheel_cascade(w, level);
+		}
+
+		slot = &w->slots[0][w->now & TIMER_WHEEL_MASK];
+		while (!list_empty(slot)) {
+			e = list_first_entry(slot, struct timer_wheel_entry, list);
+			list_del_init(&e->list);
+			w->count--;
+			n++;
+			cb(w, e);
+		}
+
+		if (!w->count) {
+			w->now = now;
+			break;
+		}
+	}
+
+	return n;
+}
@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
+ */
+#ifndef __DHCPSNOOP_TIMER_WHEEL_H
+#define __DHCPSNOOP_TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libubox/list.h>
+
+#define TIMER_WHEEL_BITS	6
+#define TIMER_WHEEL_SIZE	(1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS	4
+
+/*
+ * Hierarchical timer wheel with a resolution of one second. Level n slots
+ * cover 64^n seconds each, entries are moved down a level when the lower
+ * level wraps around. Expiry times beyond 64^4 seconds are clamped and
+ * re-queued when reached.
+ */
+struct timer_wheel {
+	struct list_head slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+	uint32_t now;
+	unsigned int count;
+};
+
+struct timer_wheel_entry {
+	struct list_head list;
+	uint32_t expires;
+};
+
+void timer_wheel_init(struct timer_wheel *w, uint32_t now);
+void timer_wheel_add(struct timer_wheel *w, struct timer_wheel_entry *e,
+		     uint32_t expires);
+void timer_wheel_del(struct timer_wheel *w, struct timer_wheel_entry *e);
+int timer_wheel_advance(struct timer_wheel *w, uint32_t now,
+			void (*cb)(struct timer_wheel *w, struct timer_wheel_entry *e));
+
+static inline bool
+timer_wheel_pending(struct timer_wheel_entry *e)
+{
+	return e->list.next && !list_empty(&e->list);
+}
+
+#endif
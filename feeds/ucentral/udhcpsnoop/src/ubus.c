@@ -2,20 +2,162 @@
 /*
  * Copyright (C) 2022 Felix Fietkau <nbd@nbd.name>
  */
+#include <string.h>
+
 #include <libubus.h>
 
 #include "dhcpsnoop.h"
 
 enum {
 	DS_CONFIG_DEVICES,
+	DS_CONFIG_NOTIFY,
+	DS_CONFIG_BATCH_INTERVAL,
+	DS_CONFIG_BATCH_SIZE,
 	__DS_CONFIG_MAX
 };
 
 static const struct blobmsg_policy dhcpsnoop_config_policy[__DS_CONFIG_MAX] = {
 	[DS_CONFIG_DEVICES] = { "devices", BLOBMSG_TYPE_TABLE },
+	[DS_CONFIG_NOTIFY] = { "notify", BLOBMSG_TYPE_STRING },
+	[DS_CONFIG_BATCH_INTERVAL] = { "batch_interval", BLOBMSG_TYPE_INT32 },
+	[DS_CONFIG_BATCH_SIZE] = { "batch_size", BLOBMSG_TYPE_INT32 },
 };
 
 static struct blob_buf b;
+static enum dhcpsnoop_notify_format notify_format;
+
+/*
+ * With a batch interval set, messages are collected for up to interval ms
+ * or size messages and sent as a single "batch" notification. Retransmits
+ * of a message already in the batch are dropped.
+ */
+static struct {
+	struct blob_buf buf;
+	struct uloop_timeout timer;
+	struct dhcpsnoop_notify_key *keys;
+	bool *keys_valid;
+	void *array;
+	unsigned int interval;
+	unsigned int size;
+	unsigned int count;
+} batch;
+
+static struct ubus_object dhcpsnoop_object;
+static struct ubus_auto_conn conn;
+
+static void
+dhcpsnoop_batch_flush(void)
+{
+	if (!batch.count)
+		return;
+
+	uloop_timeout_cancel(&batch.timer);
+	blobmsg_close_array(&batch.buf, batch.array);
+	batch.count = 0;
+
+	if (dhcpsnoop_object.has_subscribers)
+		ubus_notify(&conn.ctx, &dhcpsnoop_object, "batch", batch.buf.head, -1);
+}
+
+static void
+dhcpsnoop_batch_timer_cb(struct uloop_timeout *t)
+{
+	dhcpsnoop_batch_flush();
+}
+
+static bool
+dhcpsnoop_batch_dup(struct dhcpsnoop_notify_key *key)
+{
+	unsigned int i;
+
+	for (i = 0; i < batch.count; i++)
+		if (batch.keys_valid[i] &&
+		    !memcmp(&batch.keys[i], key, sizeof(*key)))
+			return true;
+
+	return false;
+}
+
+static void
+dhcpsnoop_batch_add(const char *type, const uint8_t *msg, size_t len, bool ipv6)
+{
+	struct dhcpsnoop_notify_key key;
+	bool valid;
+	void *c;
+
+	valid = dhcpsnoop_notify_key(&key, type, msg, len, ipv6);
+	if (valid && dhcpsnoop_batch_dup(&key))
+		return;
+
+	if (!batch.count) {
+		blob_buf_init(&batch.buf, 0);
+		batch.array = blobmsg_open_array(&batch.buf, "messages");
+		uloop_timeout_set(&batch.timer, batch.interval);
+	}
+
+	batch.keys[batch.count] = key;
+	batch.keys_valid[batch.count] = valid;
+	batch.count++;
+
+	c = blobmsg_open_table(&batch.buf, NULL);
+	blobmsg_add_string(&batch.buf, "type", type);
+	dhcpsnoop_notify_fill(&batch.buf, notify_format, msg, len, ipv6);
+	blobmsg_close_table(&batch.buf, c);
+
+	if (batch.count >= batch.size)
+		dhcpsnoop_batch_flush();
+}
+
+static void
+dhcpsnoop_ubus_set_batch(struct blob_attr *interval, struct blob_attr *size)
+{
+	unsigned int new_size = DHCPSNOOP_BATCH_SIZE;
+
+	dhcpsnoop_batch_flush();
+
+	batch.interval = interval ? blobmsg_get_u32(interval) : 0;
+	if (size && blobmsg_get_u32(size) > 0)
+		new_size = blobmsg_get_u32(size);
+
+	if (!batch.interval)
+		new_size = 0;
+
+	if (new_size == batch.size)
+		return;
+
+	free(batch.keys);
+	free(batch.keys_valid);
+	batch.keys = NULL;
+	batch.keys_valid = NULL;
+	batch.size = 0;
+
+	if (!new_size)
+		return;
+
+	batch.keys = calloc(new_size, sizeof(*batch.keys));
+	batch.keys_valid = calloc(new_size, sizeof(*batch.keys_valid));
+	if (!batch.keys || !batch.keys_valid) {
+		free(batch.keys);
+		free(batch.keys_valid);
+		batch.keys = NULL;
+		batch.keys_valid = NULL;
+		batch.interval = 0;
+		return;
+	}
+
+	batch.size = new_size;
+}
+
+static void
+dhcpsnoop_ubus_set_notify(struct blob_attr *attr)
+{
+	const char *val = attr ? blobmsg_get_string(attr) : "hex";
+
+	if (!strcmp(val, "parsed"))
+		notify_format = DHCPSNOOP_NOTIFY_PARSED;
+	else
+		notify_format = DHCPSNOOP_NOTIFY_HEX;
+}
 
 static int
 dhcpsnoop_ubus_config(struct ubus_context *ctx, struct ubus_object *obj,
@@ -27,6 +169,8 @@ dhcpsnoop_ubus_config(struct ubus_context *ctx, struct ubus_object *obj,
 	blobmsg_parse(dhcpsnoop_config_policy, __DS_CONFIG_MAX, tb,
 		      blobmsg_data(msg), blobmsg_len(msg));
 
+	dhcpsnoop_ubus_set_notify(tb[DS_CONFIG_NOTIFY]);
+	dhcpsnoop_ubus_set_batch(tb[DS_CONFIG_BATCH_INTERVAL], tb[DS_CONFIG_BATCH_SIZE]);
 	dhcpsnoop_dev_config_update(tb[DS_CONFIG_DEVICES], false);
 
 	dhcpsnoop_dev_check();
@@ -99,37 +243,37 @@ ubus_connect_handler(struct ubus_context *ctx)
 	ubus_add_object(ctx, &dhcpsnoop_object);
 }
 
-static struct ubus_auto_conn conn;
-
 void dhcpsnoop_ubus_init(void)
 {
+	batch.timer.cb = dhcpsnoop_batch_timer_cb;
 	conn.cb = ubus_connect_handler;
 	ubus_auto_connect(&conn);
 }
 
 void dhcpsnoop_ubus_done(void)
 {
+	dhcpsnoop_batch_flush();
 	ubus_auto_shutdown(&conn);
 	blob_buf_free(&b);
+	blob_buf_free(&batch.buf);
+	free(batch.keys);
+	free(batch.keys_valid);
 }
 
-void dhcpsnoop_ubus_notify(const char *type, const uint8_t *msg, size_t len)
+void dhcpsnoop_ubus_notify(const char *type, const uint8_t *msg, size_t len, bool ipv6)
 {
-	char *buf;
-
-	fprintf(stderr, "dhcp message type=%s\n", type);
+	ULOG_DBG("dhcp message type=%s\n", type);
 
 	if (!dhcpsnoop_object.has_subscribers)
 		return;
 
-	blob_buf_init(&b, 0);
-	buf = blobmsg_alloc_string_buffer(&b, "packet", 2 * len + 1);
-	while (len > 0) {
-		buf += sprintf(buf, "%02x", *msg);
-		msg++;
-		len--;
+	if (batch.interval) {
+		dhcpsnoop_batch_add(type, msg, len, ipv6);
+		return;
 	}
-	blobmsg_add_string_buffer(&b);
+
+	blob_buf_init(&b, 0);
+	dhcpsnoop_notify_fill(&b, notify_format, msg, len, ipv6);
 
 	ubus_notify(&conn.ctx, &dhcpsnoop_object, type, b.head, -1);
 }
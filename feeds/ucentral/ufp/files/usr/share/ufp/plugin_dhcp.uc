@@ -66,11 +66,38 @@ function parse_macaddr(addr)
 	return join(":", parse_array(addr));
 }
 
-function dhcp_cb(msg) {
-	if (msg.type != "discover" && msg.type != "request")
+function dhcp_add_option(macaddr, id, data) {
+	let typestr;
+
+	switch (id) {
+	case 12:
+		typestr = "%device_name|dhcp_device_name";
+		break;
+	case 55:
+		typestr = "dhcp_req";
+		data = join(",", data);
+		break;
+	case 60:
+		typestr = "dhcp_vendorid";
+		break;
+	default:
 		return;
+	}
+	global.device_add_data(macaddr, `${typestr}|${data}`);
+}
+
+// udhcpsnoop "notify parsed" format, options keyed by code
+function dhcp_parsed_cb(data) {
+	if (data.ipv6 || !data.client)
+		return;
+
+	for (let id, val in data.options)
+		dhcp_add_option(data.client, +id, val);
+}
 
-	let packet = msg.data.packet;
+// default format, raw packet as hex string
+function dhcp_hex_cb(data) {
+	let packet = data.packet;
 	if (!packet)
 		return;
 
@@ -85,24 +112,40 @@ function dhcp_cb(msg) {
 		let id = data[0];
 		switch (id) {
 		case 12:
-			typestr = "%device_name|dhcp_device_name";
+		case 60:
 			data = parse_string(data);
 			break;
 		case 55:
-			typestr = "dhcp_req";
-			data = join(",", map(parse_array(data[1]), (val) => hex(val)));
-			break;
-		case 60:
-			typestr = "dhcp_vendorid";
-			data = parse_string(data);
+			data = map(parse_array(data[1]), (val) => hex(val));
 			break;
 		default:
 			return;
 		}
-		global.device_add_data(macaddr, `${typestr}|${data}`);
+		dhcp_add_option(macaddr, id, data);
 	});
 }
 
+function dhcp_msg(type, data) {
+	if (type != "discover" && type != "request")
+		return;
+
+	if (data.options)
+		dhcp_parsed_cb(data);
+	else
+		dhcp_hex_cb(data);
+}
+
+function dhcp_cb(msg) {
+	// udhcpsnoop "batch_interval", messages carry their own type
+	if (msg.type == "batch") {
+		for (let data in msg.data.messages)
+			dhcp_msg(data.type, data);
+		return;
+	}
+
+	dhcp_msg(msg.type, msg.data);
+}
+
 function init(gl) {
 	global = gl;
 	ubus = gl.ubus;
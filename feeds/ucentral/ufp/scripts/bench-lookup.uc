@@ -0,0 +1,57 @@
+#!/usr/bin/env ucode
+'use strict';
+import { basename } from "fs";
+let uht = require("uht");
+
+function now()
+{
+	let t = clock(true);
+	return t[0] * 1000000000 + t[1];
+}
+
+let file = shift(ARGV);
+let rounds = +(shift(ARGV) ?? 1000);
+let overlays = ARGV;
+if (!file) {
+	warn(`Syntax: ${basename(sourcepath())} <uht file> [<rounds> [<overlay> ...]]\n`);
+	exit(1);
+}
+
+let ht = uht.open(file);
+if (!ht) {
+	warn(`Failed to open ${file}\n`);
+	exit(1);
+}
+
+let key_list = filter(keys(ht.get(null, null, true)), (key) => substr(key, 0, 2) != "##");
+for (let i = 0; i < length(key_list) / 4; i++)
+	push(key_list, `miss-${i}|1`);
+
+let start = now();
+for (let i = 0; i < rounds; i++)
+	for (let key in key_list)
+		ht.get(null, key);
+let time_get = now() - start;
+
+start = now();
+for (let i = 0; i < rounds; i++)
+	ht.get_many(null, key_list);
+let time_get_many = now() - start;
+
+let n = rounds * length(key_list);
+printf("%d keys, %d rounds\n", length(key_list), rounds);
+printf("get:      %.1f ns/key\n", time_get / n);
+printf("get_many: %.1f ns/key\n", time_get_many / n);
+
+for (let i = 0; i <= length(overlays); i++) {
+	let stack = uht.open([ file, ...slice(overlays, 0, i) ]);
+	if (!stack) {
+		warn(`Failed to open overlay stack\n`);
+		exit(1);
+	}
+
+	start = now();
+	for (let j = 0; j < rounds; j++)
+		stack.get_many(null, key_list);
+	printf("stack with %d overlays: %.1f ns/key\n", i, (now() - start) / n);
+}
@@ -0,0 +1,50 @@
+#!/usr/bin/env ucode
+'use strict';
+import { basename, stat, unlink } from "fs";
+let uht = require("uht");
+
+function now()
+{
+	let t = clock(true);
+	return t[0] * 1000000000 + t[1];
+}
+
+let file = shift(ARGV);
+let rounds = +(shift(ARGV) ?? 1000);
+if (!file) {
+	warn(`Syntax: ${basename(sourcepath())} <uht file> [<rounds>]\n`);
+	exit(1);
+}
+
+let ht = uht.open(file);
+if (!ht) {
+	warn(`Failed to open ${file}\n`);
+	exit(1);
+}
+
+let data = ht.get(null, null, true);
+let key_list = filter(keys(data), (key) => substr(key, 0, 2) != "##");
+for (let i = 0; i < length(key_list) / 4; i++)
+	push(key_list, `miss-${i}|1`);
+
+printf("%d keys, %d rounds\n", length(key_list), rounds);
+for (let type in [ "chained", "mph" ]) {
+	let out = `/tmp/bench-${type}.bin`;
+
+	uht.mark_hashtable(data, type == "mph" ? "mph" : null);
+	let start = now();
+	uht.save(out, data);
+	let time_build = now() - start;
+
+	let cur = uht.open(out);
+	start = now();
+	for (let i = 0; i < rounds; i++)
+		cur.get_many(null, key_list);
+	let time_lookup = now() - start;
+
+	printf("%-8s build: %.2f ms, size: %d bytes, lookup: %.1f ns/key\n", type,
+	       time_build / 1000000, stat(out).size,
+	       time_lookup / (rounds * length(key_list)));
+	cur = null;
+	unlink(out);
+}
@@ -0,0 +1,316 @@
+#!/usr/bin/env ucode
+'use strict';
+import { readfile, basename, dirname } from "fs";
+import * as struct from "struct";
+import { rand, srand } from "math";
+let ufp = require("ufp");
+
+// struct based IE parser and fingerprinting that plugin_wifi.uc used before
+// ufp.ie_parse(), unchanged apart from the function names
+const ie_tags = {
+	PWR_CAPABILITY: 33,
+	HT_CAP: 45,
+	EXT_CAPAB: 127,
+	VHT_CAP: 191,
+	__EXT_START: 0x100,
+	HE_CAP: 0x100 | 35,
+	VENDOR_WPS: 0x0050f204,
+};
+
+const ie_parser_proto = {
+	reset: function() {
+		this.offset = 0;
+	},
+
+	parseAt: function(offset) {
+		let hdr = substr(this.buffer, offset, 2);
+		if (length(hdr) != 2)
+			return null;
+
+		let data = this.hdr.unpack(hdr);
+		if (length(data != 2))
+			return null;
+
+		let len = data[1];
+		offset += 2;
+		data[1] += 2;
+
+		if (data[0] == 221 && len >= 4) {
+			hdr = substr(this.buffer, offset, 4);
+			if (length(hdr) != 4)
+				return null;
+
+			let val = this.vendor_hdr.unpack(hdr);
+			if (length(val) != 1 || val[0] < 0x200)
+				return null;
+
+			data[0] = val[0];
+			len -= 4;
+			offset += 4;
+		} else if (data[0] == 255 && len >= 1) {
+			hdr = substr(this.buffer, offset, 2);
+			if (length(hdr) != 2)
+				return null;
+			data[0] = 0x100 + this.hdr.unpack(hdr)[0];
+			len -= 1;
+			offset += 1;
+		}
+
+		data[2] = data[1];
+		data[1] = substr(this.buffer, offset, len);
+		if (length(data[1]) != len)
+			return null;
+
+		return data;
+	},
+
+	next: function() {
+		let data = this.parseAt(this.offset);
+		if (!data)
+			return null;
+
+		this.offset += data[2];
+		return data;
+	},
+
+	foreach: function(cb) {
+		let offset = 0;
+		let data;
+
+		while ((data = this.parseAt(offset)) != null) {
+			offset += data[2];
+			let ret = cb(data);
+			if (type(ret) == "boolean" && !ret)
+				break;
+		}
+	},
+};
+
+function ie_parser(data) {
+	let parser = {
+		offset: 0,
+		buffer: data,
+		hdr: struct.new("BB"),
+		vendor_hdr: struct.new(">I"),
+	};
+
+	proto(parser, ie_parser_proto);
+
+	return parser;
+}
+
+function format_fn(unpack_str, format)
+{
+	return (data) => {
+		data = struct.unpack(unpack_str, data);
+		if (data && data[0])
+			data = data[0];
+		else
+			data = 0;
+		return sprintf(format, data)
+	};
+}
+
+let unpack;
+unpack = {
+	u8: format_fn("B", "%02x"),
+	le16: format_fn("<H", "%04x"),
+	le32: format_fn("<I", "%08x"),
+	bytes: (data) => join("", map(split(data, ""), unpack.u8)),
+};
+let fingerprint_order = [
+	"htcap", "htagg", "htmcs", "vhtcap", "vhtrxmcs", "vhttxmcs",
+	"txpow", "extcap", "wps", "hemac", "hephy"
+];
+
+function format_wps_ie(data) {
+	let offset = 0;
+	let len = length(data);
+	let s = struct.new("<HH");
+
+	while (offset + 4 <= len) {
+		let hdr = s.unpack(substr(data, offset, 4));
+		let val = substr(data, offset + 4, hdr[1]);
+
+		offset += 4 + hdr[1];
+		if (hdr[0] != 0x1023)
+			continue;
+
+		if (length(val) != hdr[1])
+			break;
+
+		return replace(val, /[^A-Za-z0-9]/, "_");
+	}
+
+	return null;
+}
+
+function ie_fingerprint_str(id) {
+	if (id >= 0x200)
+		return sprintf("221(%08x)", id);
+	if (id >= 0x100)
+		return sprintf("255(%d)", id - 0x100);
+	return sprintf("%d", id);
+}
+
+let vendor_ie_filter = [
+	0x0050f2, // Microsoft WNN
+	0x506f9a, // WBA
+	0x8cfdf0, // Qualcom
+	0x001018, // Broadcom
+	0x000c43, // Ralink
+];
+
+function script_fingerprint(data, mode) {
+	let caps = {
+		tags: [],
+		vendor_list: {}
+	};
+	let parser = ie_parser(data);
+
+	parser.foreach(function(ie) {
+		let skip = false;
+		let val = ie[1];
+		switch (ie[0]) {
+		case ie_tags.HT_CAP:
+			caps.htcap = unpack.le16(substr(val, 0, 2));
+			caps.htagg = unpack.u8(substr(val, 2, 1));
+			caps.htmcs = unpack.le32(substr(val, 3, 4));
+			break;
+		case ie_tags.VHT_CAP:
+			caps.vhtcap = unpack.le32(substr(val, 0, 4));
+			caps.vhtrxmcs = unpack.le32(substr(val, 4, 4));
+			caps.vhttxmcs = unpack.le32(substr(val, 8, 4));
+			break;
+		case ie_tags.EXT_CAPAB:
+			caps.extcap = unpack.bytes(val);
+			break;
+		case ie_tags.PWR_CAPABILITY:
+			caps.txpow = unpack.le16(val);
+			break;
+		case ie_tags.VENDOR_WPS:
+			caps.wps = format_wps_ie(val);
+			break;
+		case ie_tags.HE_CAP:
+			if (mode != "wifi6") {
+				skip = true;
+				break;
+			}
+			caps.hemac =
+				unpack.le16(substr(val, 4, 2)) +
+				unpack.le32(substr(val, 0, 4));
+			caps.hephy =
+				unpack.le16(substr(val, 15, 2)) +
+				unpack.le32(substr(val, 11, 4)) +
+				unpack.le32(substr(val, 7, 4));
+			break;
+		}
+		if (ie[0] > 0x200) {
+			let vendor = ie[0] >> 8;
+			if (!(vendor in vendor_ie_filter))
+				caps.vendor_list[sprintf("%06x", vendor)] = 1;
+		}
+		if (!skip)
+			push(caps.tags, ie[0]);
+		return null;
+	});
+
+	switch (mode) {
+	case "wifi6":
+		if (mode == "wifi6" && !caps.hemac)
+			return null;
+		break;
+	case "wifi-vendor-oui":
+		return caps.vendor_list;
+	default:
+		break;
+	}
+
+	let tags = map(caps.tags, ie_fingerprint_str);
+	return
+		join(",", tags) + "," +
+		join(",", map(
+			filter(fingerprint_order, (key) => !!caps[key]),
+			(key) => `${key}:${caps[key]}`
+		));
+}
+
+const fingerprint_modes = [ "wifi4", "wifi6", "wifi-vendor-oui" ];
+
+// truncated and corrupted copies of the recorded vectors
+function mutate(ie)
+{
+	let len = length(ie);
+
+	switch (rand() % 3) {
+	case 0:
+		return substr(ie, 0, len ? rand() % len : 0);
+	case 1:
+		if (!len)
+			break;
+
+		for (let i = rand() % 3; i >= 0; i--) {
+			let pos = rand() % len;
+			ie = substr(ie, 0, pos) + chr(rand() % 256) + substr(ie, pos + 1);
+		}
+		return ie;
+	}
+
+	let ret = "";
+	for (let i = rand() % 64; i > 0; i--)
+		ret += chr(rand() % 256);
+
+	return ie + ret;
+}
+
+let file = shift(ARGV) ?? `${dirname(sourcepath())}/test-ie-parse.json`;
+let plugin_path = shift(ARGV) ?? `${dirname(sourcepath())}/../files/usr/share/ufp/plugin_wifi.uc`;
+let rounds = +(shift(ARGV) ?? 1000);
+let vectors = json(readfile(file) ?? "null");
+if (type(vectors) != "object") {
+	warn(`Syntax: ${basename(sourcepath())} [<ie test vectors> [<plugin_wifi.uc> [<random rounds>]]]\n`);
+	exit(1);
+}
+
+let plugin = loadfile(plugin_path)();
+let total = 0, failed = 0, skipped = 0;
+
+function check(name, ie)
+{
+	let caps = ufp.ie_parse(ie);
+
+	total++;
+	for (let mode in fingerprint_modes) {
+		let expected;
+
+		// the script version raised an exception, which dropped the client
+		try {
+			expected = sprintf("%J", script_fingerprint(ie, mode));
+		} catch (e) {
+			skipped++;
+			return;
+		}
+
+		let result = sprintf("%J", plugin.ie_fingerprint(caps, mode));
+		if (result == expected)
+			continue;
+
+		warn(`${name} (${mode}): fingerprint mismatch\nie: ${hexenc(ie)}\nexpected: ${expected}\nresult:   ${result}\n`);
+		failed++;
+		return;
+	}
+}
+
+srand(1);
+let names = keys(vectors);
+for (let name in names)
+	check(name, hexdec(vectors[name]));
+
+for (let i = 0; i < rounds; i++) {
+	let name = names[rand() % length(names)];
+	check(`${name} mutation ${i}`, mutate(hexdec(vectors[name])));
+}
+
+printf("%d/%d IE blobs with identical fingerprints, %d not comparable (script exception)\n",
+       total - failed - skipped, total, skipped);
+exit(failed ? 1 : 0);
@@ -0,0 +1,79 @@
+#!/usr/bin/env ucode
+'use strict';
+import { readfile, basename, dirname } from "fs";
+let ufp = require("ufp");
+
+// pairwise matching code that ufpd used before ufp.match()
+function match_script(match_devs)
+{
+	let ret = {};
+
+	for (let i = 0; i < length(match_devs); i++) {
+		let match = match_devs[i];
+		let match_data = match[0];
+		let match_weight = match[1];
+		let match_fp = [ match[2] ];
+		let meta_entry = {};
+
+		for (let j = 0; j < length(match_devs); j++) {
+			if (j == i)
+				continue;
+
+			let cur = match_devs[j];
+			let cur_data = cur[0];
+			for (let key in cur_data) {
+				if (lc(match_data[key]) == lc(cur_data[key])) {
+					match_weight += cur[1];
+					push(match_fp, cur[2]);
+					break;
+				}
+			}
+		}
+
+		for (let key in match_data) {
+			let val = match_data[key];
+			ret[key] ??= {};
+			let ret_key = ret[key];
+
+			ret_key[val] ??= [ 0.0, {} ];
+			let ret_val = ret_key[val];
+
+			ret_val[0] += match_weight;
+			for (let fp in match_fp)
+				ret_val[1][fp]++;
+		}
+	}
+
+	for (let key in ret) {
+		let ret_key = ret[key];
+		for (let val in ret_key) {
+			let ret_val = ret_key[val];
+			ret_val[1] = keys(ret_val[1]);
+		}
+	}
+
+	return ret;
+}
+
+let file = shift(ARGV) ?? `${dirname(sourcepath())}/test-match.json`;
+let cases = json(readfile(file) ?? "null");
+if (type(cases) != "object") {
+	warn(`Syntax: ${basename(sourcepath())} [<recorded match lists>]\n`);
+	exit(1);
+}
+
+let failed = 0;
+for (let name, match_devs in cases) {
+	// compare the JSON output to also catch key and fingerprint order changes
+	let expected = sprintf("%J", match_script(match_devs));
+	let result = sprintf("%J", ufp.match(match_devs));
+
+	if (result == expected)
+		continue;
+
+	warn(`${name}: result mismatch\nexpected: ${expected}\nresult:   ${result}\n`);
+	failed++;
+}
+
+printf("%d/%d match lists identical\n", length(cases) - failed, length(cases));
+exit(failed ? 1 : 0);
@@ -1,12 +1,18 @@
 #include <ucode/module.h>
 #include "uht.h"
 
-static uc_resource_type_t *reader_type, *hashtbl_type;
+static uc_resource_type_t *reader_type, *stack_type, *hashtbl_type;
 static char *hash_key;
 
+struct uht_stack {
+	size_t n_layers;
+	struct uht_reader layers[];
+};
+
 static uint32_t
-writer_store_data(struct uht_writer *wr, uc_value_t *val)
+writer_store_data(struct uht_writer *wr, uc_value_t *val, bool overlay)
 {
+	uc_value_t *hash_type;
 	uint32_t *data, ret;
 	size_t i, len;
 
@@ -23,19 +29,30 @@ writer_store_data(struct uht_writer *wr, uc_value_t *val)
 		len = ucv_array_length(val);
 		data = calloc(len, sizeof(*data));
 		for (i = 0; i < len; i++)
-			data[i] = writer_store_data(wr, ucv_array_get(val, i));
+			data[i] = writer_store_data(wr, ucv_array_get(val, i), false);
 		ret = uht_writer_add_array(wr, data, len);
 		free(data);
 		return ret;
 	case UC_OBJECT:
 		len = ucv_object_length(val);
-		if (ucv_is_truish(ucv_object_get(val, hash_key, NULL))) {
-			ret = uht_writer_hashtbl_alloc(wr, len - 1);
+		hash_type = ucv_object_get(val, hash_key, NULL);
+		if (ucv_is_truish(hash_type)) {
+			if (ucv_type(hash_type) == UC_STRING &&
+			    !strcmp(ucv_string_get(hash_type), "mph"))
+				ret = uht_writer_mph_alloc(wr, len - 1);
+			else
+				ret = uht_writer_hashtbl_alloc(wr, len - 1);
 			ucv_object_foreach(val, key, value) {
+				uint32_t elem;
+
 				if (!strcmp(key, hash_key))
 					continue;
-				uht_writer_hashtbl_add_element(wr, ret, key,
-							       writer_store_data(wr, value));
+
+				/* in an overlay, null values hide the key in lower layers */
+				elem = writer_store_data(wr, value, false);
+				if (!elem && overlay)
+					elem = UHT_DELETED;
+				uht_writer_hashtbl_add_element(wr, ret, key, elem);
 			}
 			uht_writer_hashtbl_done(wr, ret);
 			return ret;
@@ -44,7 +61,7 @@ writer_store_data(struct uht_writer *wr, uc_value_t *val)
 		i = 0;
 		ucv_object_foreach(val, key, value) {
 			data[i] = uht_writer_add_string(wr, key);
-			data[len + i] = writer_store_data(wr, value);
+			data[len + i] = writer_store_data(wr, value, false);
 			i++;
 		}
 		ret = uht_writer_add_object(wr, data, data + len, len);
@@ -61,6 +78,8 @@ writer_save(uc_vm_t *vm, size_t nargs)
 	struct uht_writer wr = {};
 	uc_value_t *file = uc_fn_arg(0);
 	uc_value_t *data = uc_fn_arg(1);
+	uc_value_t *opts = uc_fn_arg(2);
+	uc_value_t *mem_limit, *tmpdir, *overlay;
 	uint32_t val;
 	int ret = -1;
 	FILE *f;
@@ -68,12 +87,25 @@ writer_save(uc_vm_t *vm, size_t nargs)
 	if (ucv_type(file) != UC_STRING || !data)
 		return NULL;
 
-	f = fopen(ucv_string_get(file), "w");
+	/* streaming mode reads back flushed data for de-duplication */
+	f = fopen(ucv_string_get(file), "w+");
 	if (!f)
 		return NULL;
 
-	uht_writer_init(&wr);
-	val = writer_store_data(&wr, data);
+	mem_limit = ucv_object_get(opts, "memory_limit", NULL);
+	tmpdir = ucv_object_get(opts, "tmpdir", NULL);
+	overlay = ucv_object_get(opts, "overlay", NULL);
+	if (ucv_type(mem_limit) == UC_INTEGER) {
+		if (uht_writer_init_stream(&wr, f, ucv_int64_get(mem_limit),
+					   ucv_string_get(tmpdir))) {
+			fclose(f);
+			return NULL;
+		}
+	} else {
+		uht_writer_init(&wr);
+	}
+
+	val = writer_store_data(&wr, data, ucv_is_truish(overlay));
 	if (val)
 		ret = uht_writer_save(&wr, f, val);
 	fflush(f);
@@ -102,6 +134,7 @@ __reader_get_value(uc_vm_t *vm, struct uht_reader *r, uint32_t attr, bool dump)
 	case UHT_BOOL:
 		return ucv_boolean_new(uht_reader_get_bool(r, attr));
 	case UHT_HASHTBL:
+	case UHT_HASHTBL_MPH:
 		if (!dump)
 			return ucv_resource_new(hashtbl_type, (void *)(uintptr_t)attr);
 		/* fallthrough */
@@ -109,6 +142,8 @@ __reader_get_value(uc_vm_t *vm, struct uht_reader *r, uint32_t attr, bool dump)
 		val = ucv_object_new(vm);
 		if (type == UHT_HASHTBL)
 			ucv_object_add(val, hash_key, ucv_boolean_new(true));
+		else if (type == UHT_HASHTBL_MPH)
+			ucv_object_add(val, hash_key, ucv_string_new("mph"));
 		uht_for_each(r, iter, attr)
 			ucv_object_add(val, iter.key, ucv_get(__reader_get_value(vm, r, iter.val, dump)));
 		return val;
@@ -123,12 +158,44 @@ __reader_get_value(uc_vm_t *vm, struct uht_reader *r, uint32_t attr, bool dump)
 	return NULL;
 }
 
+static uc_value_t *
+stack_open(uc_vm_t *vm, uc_value_t *files)
+{
+	size_t n = ucv_array_length(files);
+	struct uht_stack *s;
+
+	if (!n)
+		return NULL;
+
+	s = calloc(1, sizeof(*s) + n * sizeof(s->layers[0]));
+	for (size_t i = 0; i < n; i++) {
+		uc_value_t *file = ucv_array_get(files, i);
+
+		if (ucv_type(file) != UC_STRING ||
+		    uht_reader_open(&s->layers[i], ucv_string_get(file)))
+			goto error;
+
+		s->n_layers++;
+	}
+
+	return ucv_resource_new(stack_type, s);
+
+error:
+	while (s->n_layers > 0)
+		uht_reader_close(&s->layers[--s->n_layers]);
+	free(s);
+	return NULL;
+}
+
 static uc_value_t *
 reader_open(uc_vm_t *vm, size_t nargs)
 {
 	uc_value_t *file = uc_fn_arg(0);
 	struct uht_reader *r;
 
+	if (ucv_type(file) == UC_ARRAY)
+		return stack_open(vm, file);
+
 	if (ucv_type(file) != UC_STRING)
 		return NULL;
 
@@ -150,6 +217,16 @@ reader_free(void *ptr)
 	free(r);
 }
 
+static void
+stack_free(void *ptr)
+{
+	struct uht_stack *s = ptr;
+
+	for (size_t i = 0; i < s->n_layers; i++)
+		uht_reader_close(&s->layers[i]);
+	free(s);
+}
+
 static uc_value_t *
 set_hashtbl_key(uc_vm_t *vm, size_t nargs)
 {
@@ -168,11 +245,15 @@ static uc_value_t *
 mark_hashtbl(uc_vm_t *vm, size_t nargs)
 {
 	uc_value_t *obj = uc_fn_arg(0);
+	uc_value_t *type = uc_fn_arg(1);
 
 	if (ucv_type(obj) != UC_OBJECT)
 		return NULL;
 
-	ucv_object_add(obj, hash_key, ucv_boolean_new(true));
+	if (ucv_type(type) == UC_STRING && !strcmp(ucv_string_get(type), "mph"))
+		ucv_object_add(obj, hash_key, ucv_string_new("mph"));
+	else
+		ucv_object_add(obj, hash_key, ucv_boolean_new(true));
 	return ucv_boolean_new(true);
 }
 
@@ -209,7 +290,7 @@ reader_get(uc_vm_t *vm, size_t nargs)
 		val = r->val;
 
 	if (key) {
-		if (uht_entry_type(val) != UHT_HASHTBL)
+		if (!uht_entry_is_hashtbl(val))
 			return 0;
 
 		val = uht_reader_hashtbl_lookup(r, val, ucv_string_get(key));
@@ -218,10 +299,107 @@ reader_get(uc_vm_t *vm, size_t nargs)
 	return __reader_get_value(vm, r, val, ucv_is_truish(dump));
 }
 
+static uc_value_t *
+reader_get_many(uc_vm_t *vm, size_t nargs)
+{
+	struct uht_reader *r = uc_fn_thisval("uht.reader");
+	uc_value_t *tbl = uc_fn_arg(0);
+	uc_value_t *keys = uc_fn_arg(1);
+	uc_value_t *dump = uc_fn_arg(2);
+	uc_value_t *ret;
+	uint32_t htbl;
+	size_t len;
+
+	if (!r || ucv_type(keys) != UC_ARRAY)
+		return NULL;
+
+	if (tbl)
+		htbl = reader_get_htable(tbl);
+	else
+		htbl = r->val;
+
+	if (!uht_entry_is_hashtbl(htbl))
+		return NULL;
+
+	len = ucv_array_length(keys);
+	ret = ucv_array_new_length(vm, len);
+	for (size_t i = 0; i < len; i++) {
+		uc_value_t *key = ucv_array_get(keys, i);
+		uint32_t val = 0;
+
+		if (ucv_type(key) == UC_STRING)
+			val = uht_reader_hashtbl_lookup(r, htbl, ucv_string_get(key));
+
+		ucv_array_push(ret, __reader_get_value(vm, r, val, ucv_is_truish(dump)));
+	}
+
+	return ret;
+}
+
+/*
+ * Values returned from a stack are always fully dumped, since embedded
+ * hashtable handles can't refer to a specific layer.
+ */
+static uc_value_t *
+stack_get_value(uc_vm_t *vm, struct uht_stack *s, uc_value_t *key)
+{
+	struct uht_reader *r;
+	uint32_t val;
+
+	if (ucv_type(key) != UC_STRING)
+		return NULL;
+
+	val = uht_reader_layers_lookup(s->layers, s->n_layers,
+				       ucv_string_get(key), &r);
+	if (!val)
+		return NULL;
+
+	return __reader_get_value(vm, r, val, true);
+}
+
+static uc_value_t *
+stack_get(uc_vm_t *vm, size_t nargs)
+{
+	struct uht_stack *s = uc_fn_thisval("uht.stack");
+	uc_value_t *tbl = uc_fn_arg(0);
+	uc_value_t *key = uc_fn_arg(1);
+
+	if (!s || tbl)
+		return NULL;
+
+	return stack_get_value(vm, s, key);
+}
+
+static uc_value_t *
+stack_get_many(uc_vm_t *vm, size_t nargs)
+{
+	struct uht_stack *s = uc_fn_thisval("uht.stack");
+	uc_value_t *tbl = uc_fn_arg(0);
+	uc_value_t *keys = uc_fn_arg(1);
+	uc_value_t *ret;
+	size_t len;
+
+	if (!s || tbl || ucv_type(keys) != UC_ARRAY)
+		return NULL;
+
+	len = ucv_array_length(keys);
+	ret = ucv_array_new_length(vm, len);
+	for (size_t i = 0; i < len; i++)
+		ucv_array_push(ret, stack_get_value(vm, s, ucv_array_get(keys, i)));
+
+	return ret;
+}
+
 static const uc_function_list_t no_fns[] = {};
 
 static const uc_function_list_t reader_fns[] = {
 	{ "get", reader_get },
+	{ "get_many", reader_get_many },
+};
+
+static const uc_function_list_t stack_fns[] = {
+	{ "get", stack_get },
+	{ "get_many", stack_get_many },
 };
 
 static const uc_function_list_t hashtbl_fns[] = {
@@ -235,6 +413,7 @@ void uc_module_init(uc_vm_t *vm, uc_value_t *scope)
 {
 	hash_key = strdup("##hash_table");
 	reader_type = uc_type_declare(vm, "uht.reader", reader_fns, reader_free);
+	stack_type = uc_type_declare(vm, "uht.stack", stack_fns, stack_free);
 	hashtbl_type = uc_type_declare(vm, "uht.hashtbl", no_fns, NULL);
 	uc_function_list_register(scope, hashtbl_fns);
 }
@@ -0,0 +1,450 @@
+#include <stdarg.h>
+#include <ctype.h>
+#include <ucode/module.h>
+#include "xxhash32.h"
+
+#define IE_TAG_EXT		0x100
+#define IE_TAG_VENDOR_MIN	0x200
+
+enum ie_tag {
+	IE_PWR_CAPABILITY = 33,
+	IE_HT_CAP = 45,
+	IE_EXT_CAPAB = 127,
+	IE_VHT_CAP = 191,
+	IE_VENDOR = 221,
+	IE_EXT = 255,
+	IE_HE_CAP = IE_TAG_EXT | 35,
+	IE_VENDOR_WPS = 0x0050f204,
+};
+
+#define WPS_ATTR_MODEL_NAME	0x1023
+
+struct ie {
+	uint32_t id;
+	const uint8_t *data;
+	size_t len;
+};
+
+struct match_pair {
+	uint32_t hash;
+	uint32_t entry;
+	const char *key;
+	char *val;
+};
+
+struct match_entry {
+	uc_value_t *data;
+	const char *fp;
+	double weight;
+	size_t first_pair;
+	size_t n_pairs;
+};
+
+static double
+match_weight_get(uc_value_t *val)
+{
+	switch (ucv_type(val)) {
+	case UC_INTEGER:
+		return ucv_int64_get(val);
+	case UC_DOUBLE:
+		return ucv_double_get(val);
+	default:
+		return 0;
+	}
+}
+
+static int
+match_pair_cmp(const void *a1, const void *a2)
+{
+	const struct match_pair *p1 = *(const struct match_pair **)a1;
+	const struct match_pair *p2 = *(const struct match_pair **)a2;
+
+	if (p1->hash != p2->hash)
+		return p1->hash < p2->hash ? -1 : 1;
+
+	return 0;
+}
+
+static int
+match_index_cmp(const void *a1, const void *a2)
+{
+	uint32_t i1 = *(const uint32_t *)a1, i2 = *(const uint32_t *)a2;
+
+	return i1 < i2 ? -1 : i1 > i2;
+}
+
+static size_t
+match_pair_find(struct match_pair **sorted, size_t n, uint32_t hash)
+{
+	size_t lo = 0, hi = n;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (sorted[mid]->hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void
+match_fp_add(uc_value_t *fp_set, const char *fp)
+{
+	if (!ucv_object_get(fp_set, fp, NULL))
+		ucv_object_add(fp_set, fp, ucv_boolean_new(true));
+}
+
+static void
+match_result_add(uc_vm_t *vm, uc_value_t *ret, struct match_entry *entries,
+		 uint32_t cur, double weight, uint32_t *match, size_t n_match)
+{
+	ucv_object_foreach(entries[cur].data, key, val) {
+		uc_value_t *ret_key, *ret_val, *fp_set;
+		char *val_str;
+		double sum;
+
+		ret_key = ucv_object_get(ret, key, NULL);
+		if (!ret_key) {
+			ret_key = ucv_object_new(vm);
+			ucv_object_add(ret, key, ret_key);
+		}
+
+		val_str = ucv_to_string(vm, val);
+		ret_val = ucv_object_get(ret_key, val_str, NULL);
+		if (!ret_val) {
+			ret_val = ucv_array_new(vm);
+			ucv_array_push(ret_val, ucv_double_new(0));
+			ucv_array_push(ret_val, ucv_object_new(vm));
+			ucv_object_add(ret_key, val_str, ret_val);
+		}
+		free(val_str);
+
+		sum = ucv_double_get(ucv_array_get(ret_val, 0)) + weight;
+		ucv_array_set(ret_val, 0, ucv_double_new(sum));
+
+		fp_set = ucv_array_get(ret_val, 1);
+		match_fp_add(fp_set, entries[cur].fp);
+		for (size_t i = 0; i < n_match; i++)
+			match_fp_add(fp_set, entries[match[i]].fp);
+	}
+}
+
+static void
+match_result_finish(uc_vm_t *vm, uc_value_t *ret)
+{
+	ucv_object_foreach(ret, key, ret_key) {
+		ucv_object_foreach(ret_key, val, ret_val) {
+			uc_value_t *fp_set = ucv_get(ucv_array_get(ret_val, 1));
+			uc_value_t *fp_list = ucv_array_new(vm);
+
+			ucv_object_foreach(fp_set, fp, fp_val)
+				ucv_array_push(fp_list, ucv_string_new(fp));
+			ucv_array_set(ret_val, 1, fp_list);
+			ucv_put(fp_set);
+		}
+	}
+}
+
+/*
+ * match(list): list is an array of [ <data>, <weight>, <fingerprint> ] entries.
+ * Every entry receives the weight of all other entries that share at least
+ * one key with the same (case insensitive) value.
+ * Returns { "<key>": { "<val>": [ <weight>, [ <fingerprints> ] ] } }
+ */
+static uc_value_t *
+uc_ufp_match(uc_vm_t *vm, size_t nargs)
+{
+	uc_value_t *list = uc_fn_arg(0);
+	struct match_pair *pairs, **sorted;
+	struct match_entry *entries;
+	uint32_t *seen, *match;
+	size_t n, n_pairs = 0;
+	uc_value_t *ret;
+
+	if (ucv_type(list) != UC_ARRAY)
+		return NULL;
+
+	n = ucv_array_length(list);
+	entries = calloc(n, sizeof(*entries));
+	for (size_t i = 0; i < n; i++) {
+		uc_value_t *cur = ucv_array_get(list, i);
+		uc_value_t *data = ucv_array_get(cur, 0);
+		uc_value_t *fp = ucv_array_get(cur, 2);
+
+		if (ucv_type(cur) != UC_ARRAY || ucv_type(data) != UC_OBJECT ||
+		    ucv_type(fp) != UC_STRING) {
+			free(entries);
+			return NULL;
+		}
+
+		entries[i].data = data;
+		entries[i].weight = match_weight_get(ucv_array_get(cur, 1));
+		entries[i].fp = ucv_string_get(fp);
+		entries[i].first_pair = n_pairs;
+		entries[i].n_pairs = ucv_object_length(data);
+		n_pairs += entries[i].n_pairs;
+	}
+
+	/* normalize all values once, then index them by hash */
+	pairs = calloc(n_pairs + 1, sizeof(*pairs));
+	sorted = calloc(n_pairs + 1, sizeof(*sorted));
+	n_pairs = 0;
+	for (size_t i = 0; i < n; i++) {
+		ucv_object_foreach(entries[i].data, key, val) {
+			struct match_pair *p = &pairs[n_pairs];
+
+			p->entry = i;
+			p->key = key;
+			p->val = ucv_to_string(vm, val);
+			for (char *c = p->val; *c; c++)
+				*c = tolower((unsigned char)*c);
+
+			p->hash = XXH32(p->val, strlen(p->val), XXH32(key, strlen(key), 0));
+			sorted[n_pairs++] = p;
+		}
+	}
+	qsort(sorted, n_pairs, sizeof(*sorted), match_pair_cmp);
+
+	ret = ucv_object_new(vm);
+	seen = calloc(2 * n + 1, sizeof(*seen));
+	match = seen + n;
+	for (size_t cur = 0; cur < n; cur++) {
+		struct match_entry *e = &entries[cur];
+		double weight = e->weight;
+		size_t n_match = 0;
+
+		for (size_t i = 0; i < e->n_pairs; i++) {
+			struct match_pair *p = &pairs[e->first_pair + i];
+
+			for (size_t j = match_pair_find(sorted, n_pairs, p->hash);
+			     j < n_pairs && sorted[j]->hash == p->hash; j++) {
+				struct match_pair *p2 = sorted[j];
+
+				if (p2->entry == cur || seen[p2->entry] == cur + 1)
+					continue;
+
+				if (strcmp(p->key, p2->key) || strcmp(p->val, p2->val))
+					continue;
+
+				seen[p2->entry] = cur + 1;
+				match[n_match++] = p2->entry;
+			}
+		}
+
+		/* keep the accumulation order of the pairwise comparison */
+		qsort(match, n_match, sizeof(*match), match_index_cmp);
+		for (size_t i = 0; i < n_match; i++)
+			weight += entries[match[i]].weight;
+
+		match_result_add(vm, ret, entries, cur, weight, match, n_match);
+	}
+
+	match_result_finish(vm, ret);
+
+	for (size_t i = 0; i < n_pairs; i++)
+		free(pairs[i].val);
+	free(sorted);
+	free(pairs);
+	free(entries);
+	free(seen);
+
+	return ret;
+}
+
+/*
+ * Vendor elements are identified by OUI + type, extension elements by
+ * IE_TAG_EXT + extension id. Parsing stops at the first malformed element.
+ */
+static bool
+ie_next(const uint8_t *buf, size_t buf_len, size_t *ofs, struct ie *ie)
+{
+	size_t cur = *ofs, len;
+
+	if (cur + 2 > buf_len)
+		return false;
+
+	ie->id = buf[cur];
+	len = buf[cur + 1];
+	cur += 2;
+
+	if (ie->id == IE_VENDOR && len >= 4) {
+		if (cur + 4 > buf_len)
+			return false;
+
+		ie->id = ((uint32_t)buf[cur] << 24) | (buf[cur + 1] << 16) |
+			 (buf[cur + 2] << 8) | buf[cur + 3];
+		if (ie->id < IE_TAG_VENDOR_MIN)
+			return false;
+
+		len -= 4;
+		cur += 4;
+	} else if (ie->id == IE_EXT && len >= 1) {
+		/* the header check covers two bytes, like the old script parser */
+		if (cur + 2 > buf_len)
+			return false;
+
+		ie->id = IE_TAG_EXT + buf[cur];
+		len--;
+		cur++;
+	}
+
+	if (cur + len > buf_len)
+		return false;
+
+	ie->data = buf + cur;
+	ie->len = len;
+	*ofs = cur + len;
+
+	return true;
+}
+
+/* little endian field, missing bytes read as zero */
+static uint32_t
+ie_get(const struct ie *ie, size_t ofs, size_t size)
+{
+	uint32_t val = 0;
+
+	for (size_t i = 0; i < size && ofs + i < ie->len; i++)
+		val |= (uint32_t)ie->data[ofs + i] << (8 * i);
+
+	return val;
+}
+
+static void
+ie_add_hex(uc_value_t *ret, const char *name, const char *fmt, ...)
+{
+	char buf[32];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	ucv_object_add(ret, name, ucv_string_new(buf));
+}
+
+static void
+ie_add_bytes(uc_value_t *ret, const char *name, const struct ie *ie)
+{
+	char buf[2 * 255 + 1] = "";
+
+	for (size_t i = 0; i < ie->len; i++)
+		sprintf(buf + 2 * i, "%02x", ie->data[i]);
+
+	ucv_object_add(ret, name, ucv_string_new(buf));
+}
+
+/*
+ * Attribute headers are read as little endian and only the first
+ * non-alphanumeric character of the model name is replaced, which keeps
+ * the strings compatible with existing fingerprint data.
+ */
+static void
+ie_add_wps(uc_value_t *ret, const struct ie *ie)
+{
+	size_t ofs = 0;
+
+	while (ofs + 4 <= ie->len) {
+		uint16_t type = ie_get(ie, ofs, 2);
+		uint16_t len = ie_get(ie, ofs + 2, 2);
+		char *val;
+
+		ofs += 4;
+		if (type != WPS_ATTR_MODEL_NAME) {
+			ofs += len;
+			continue;
+		}
+
+		if (ofs + len > ie->len)
+			break;
+
+		val = malloc(len + 1);
+		memcpy(val, ie->data + ofs, len);
+		for (char *c = val; c < val + len; c++) {
+			if (isalnum((unsigned char)*c))
+				continue;
+
+			*c = '_';
+			break;
+		}
+		ucv_object_add(ret, "wps", ucv_string_new_length(val, len));
+		free(val);
+		return;
+	}
+
+	ucv_object_delete(ret, "wps");
+}
+
+/*
+ * ie_parse(buf): parses a buffer of 802.11 information elements.
+ * Returns { tags: [ <id>, ... ], <field>: "<hex>", ... } with the fields
+ * htcap, htagg, htmcs, vhtcap, vhtrxmcs, vhttxmcs, txpow, extcap, wps,
+ * hemac and hephy, formatted for use in fingerprint strings.
+ */
+static uc_value_t *
+uc_ufp_ie_parse(uc_vm_t *vm, size_t nargs)
+{
+	uc_value_t *buf = uc_fn_arg(0);
+	uc_value_t *ret, *tags;
+	const uint8_t *data;
+	size_t len, ofs = 0;
+	struct ie ie;
+
+	if (ucv_type(buf) != UC_STRING)
+		return NULL;
+
+	data = (const uint8_t *)ucv_string_get(buf);
+	len = ucv_string_length(buf);
+
+	ret = ucv_object_new(vm);
+	tags = ucv_array_new(vm);
+	ucv_object_add(ret, "tags", tags);
+
+	while (ie_next(data, len, &ofs, &ie)) {
+		switch (ie.id) {
+		case IE_HT_CAP:
+			ie_add_hex(ret, "htcap", "%04x", ie_get(&ie, 0, 2));
+			ie_add_hex(ret, "htagg", "%02x", ie_get(&ie, 2, 1));
+			ie_add_hex(ret, "htmcs", "%08x", ie_get(&ie, 3, 4));
+			break;
+		case IE_VHT_CAP:
+			ie_add_hex(ret, "vhtcap", "%08x", ie_get(&ie, 0, 4));
+			ie_add_hex(ret, "vhtrxmcs", "%08x", ie_get(&ie, 4, 4));
+			ie_add_hex(ret, "vhttxmcs", "%08x", ie_get(&ie, 8, 4));
+			break;
+		case IE_EXT_CAPAB:
+			ie_add_bytes(ret, "extcap", &ie);
+			break;
+		case IE_PWR_CAPABILITY:
+			ie_add_hex(ret, "txpow", "%04x", ie_get(&ie, 0, 2));
+			break;
+		case IE_VENDOR_WPS:
+			ie_add_wps(ret, &ie);
+			break;
+		case IE_HE_CAP:
+			ie_add_hex(ret, "hemac", "%04x%08x",
+				   ie_get(&ie, 4, 2), ie_get(&ie, 0, 4));
+			ie_add_hex(ret, "hephy", "%04x%08x%08x",
+				   ie_get(&ie, 15, 2), ie_get(&ie, 11, 4),
+				   ie_get(&ie, 7, 4));
+			break;
+		}
+
+		ucv_array_push(tags, ucv_int64_new(ie.id));
+	}
+
+	return ret;
+}
+
+static const uc_function_list_t ufp_fns[] = {
+	{ "match", uc_ufp_match },
+	{ "ie_parse", uc_ufp_ie_parse },
+};
+
+void uc_module_init(uc_vm_t *vm, uc_value_t *scope)
+{
+	uc_function_list_register(scope, ufp_fns);
+}
@@ -0,0 +1,572 @@
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "uht.h"
+
+enum {
+	BENCH_CHAINED,
+	BENCH_MPH,
+	BENCH_STREAM,
+};
+
+struct bench_opts {
+	const char *file;
+	size_t n_keys;
+	size_t key_len;
+	size_t n_lookups;
+	size_t fuzz_rounds;
+	size_t mem_limit;
+	bool overlay;
+	uint8_t version;
+	int mode;
+	unsigned int seed;
+};
+
+static const char *mode_names[] = {
+	[BENCH_CHAINED] = "chained",
+	[BENCH_MPH] = "mph",
+	[BENCH_STREAM] = "stream",
+};
+
+static uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static long
+bench_max_rss(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+static char *
+corpus_key(struct bench_opts *o, size_t i, bool miss)
+{
+	char *key = malloc(o->key_len + 1);
+	int len;
+
+	/* unique prefix, padded with deterministic filler */
+	len = snprintf(key, o->key_len + 1, "%s%zu|", miss ? "miss-" : "key-", i);
+	for (size_t j = len; j < o->key_len; j++)
+		key[j] = 'a' + (i * 31 + j) % 26;
+	key[o->key_len] = 0;
+
+	return key;
+}
+
+static char **
+corpus_generate(struct bench_opts *o, bool miss)
+{
+	char **keys = calloc(o->n_keys, sizeof(*keys));
+
+	for (size_t i = 0; i < o->n_keys; i++)
+		keys[i] = corpus_key(o, i, miss);
+
+	return keys;
+}
+
+static void
+corpus_free(struct bench_opts *o, char **keys)
+{
+	for (size_t i = 0; i < o->n_keys; i++)
+		free(keys[i]);
+	free(keys);
+}
+
+static int
+bench_build(struct bench_opts *o, char **keys, const char *file)
+{
+	struct uht_writer wr = {};
+	uint32_t ht, val[2];
+	FILE *f;
+	int ret;
+
+	/* streaming mode reads back flushed data for de-duplication */
+	f = fopen(file, "w+");
+	if (!f)
+		return -1;
+
+	if (o->mode == BENCH_STREAM) {
+		if (uht_writer_init_stream(&wr, f, o->mem_limit, NULL)) {
+			fclose(f);
+			return -1;
+		}
+	} else {
+		uht_writer_init_version(&wr, o->version);
+	}
+
+	if (o->mode == BENCH_MPH)
+		ht = uht_writer_mph_alloc(&wr, o->n_keys);
+	else
+		ht = uht_writer_hashtbl_alloc(&wr, o->n_keys);
+
+	for (size_t i = 0; i < o->n_keys; i++) {
+		/* fingerprint style values: small arrays of repeated strings */
+		val[0] = uht_writer_add_string(&wr, keys[i % 64]);
+		val[1] = uht_writer_add_int(&wr, i);
+		uht_writer_hashtbl_add_element(&wr, ht, keys[i],
+					       uht_writer_add_array(&wr, val, 2));
+	}
+	uht_writer_hashtbl_done(&wr, ht);
+
+	ret = uht_writer_save(&wr, f, ht);
+	uht_writer_free(&wr);
+	fclose(f);
+
+	return ret;
+}
+
+static int
+u64_cmp(const void *a1, const void *a2)
+{
+	uint64_t v1 = *(const uint64_t *)a1, v2 = *(const uint64_t *)a2;
+
+	return v1 < v2 ? -1 : v1 > v2;
+}
+
+static void
+bench_lookup(struct bench_opts *o, struct uht_reader *r, char **keys,
+	     const char *name, bool hit)
+{
+	uint64_t *lat = calloc(o->n_lookups, sizeof(*lat));
+	uint64_t start, total;
+	size_t found = 0;
+
+	start = bench_now();
+	for (size_t i = 0; i < o->n_lookups; i++)
+		found += !!uht_reader_hashtbl_lookup(r, r->val, keys[rand_r(&o->seed) % o->n_keys]);
+	total = bench_now() - start;
+
+	for (size_t i = 0; i < o->n_lookups; i++) {
+		const char *key = keys[rand_r(&o->seed) % o->n_keys];
+
+		start = bench_now();
+		uht_reader_hashtbl_lookup(r, r->val, key);
+		lat[i] = bench_now() - start;
+	}
+	qsort(lat, o->n_lookups, sizeof(*lat), u64_cmp);
+
+	printf("%s: %.0f lookups/s, p50 %llu ns, p90 %llu ns, p99 %llu ns, p99.9 %llu ns%s\n",
+	       name, o->n_lookups * 1e9 / total,
+	       (unsigned long long)lat[o->n_lookups / 2],
+	       (unsigned long long)lat[o->n_lookups * 9 / 10],
+	       (unsigned long long)lat[o->n_lookups * 99 / 100],
+	       (unsigned long long)lat[o->n_lookups * 999 / 1000],
+	       found != (hit ? o->n_lookups : 0) ? " (unexpected results)" : "");
+	free(lat);
+}
+
+static int
+bench_run(struct bench_opts *o)
+{
+	char **keys, **miss_keys;
+	struct uht_reader r;
+	long rss_start;
+	uint64_t start;
+	struct stat st;
+
+	keys = corpus_generate(o, false);
+	miss_keys = corpus_generate(o, true);
+	rss_start = bench_max_rss();
+
+	start = bench_now();
+	if (bench_build(o, keys, o->file)) {
+		fprintf(stderr, "Failed to build %s\n", o->file);
+		return 1;
+	}
+
+	if (stat(o->file, &st) || uht_reader_open(&r, o->file)) {
+		fprintf(stderr, "Failed to open %s\n", o->file);
+		return 1;
+	}
+
+	printf("%s v%d, %zu keys of %zu bytes\n", mode_names[o->mode],
+	       o->version == UHT_VERSION_1 ? 1 : 2, o->n_keys, o->key_len);
+	printf("build: %.2f ms, file size: %lld bytes, peak rss: %ld kB (+%ld kB)\n",
+	       (bench_now() - start) / 1e6, (long long)st.st_size,
+	       bench_max_rss(), bench_max_rss() - rss_start);
+
+	bench_lookup(o, &r, keys, "hit", true);
+	bench_lookup(o, &r, miss_keys, "miss", false);
+
+	uht_reader_close(&r);
+	corpus_free(o, keys);
+	corpus_free(o, miss_keys);
+
+	return 0;
+}
+
+static void
+fuzz_mutate(struct bench_opts *o, uint8_t *buf, size_t *len)
+{
+	int n = 1 + rand_r(&o->seed) % 8;
+
+	while (n-- > 0) {
+		size_t ofs = rand_r(&o->seed) % *len;
+
+		switch (rand_r(&o->seed) % 4) {
+		case 0:
+			buf[ofs] ^= 1 << (rand_r(&o->seed) % 8);
+			break;
+		case 1:
+			buf[ofs] = rand_r(&o->seed);
+			break;
+		case 2:
+			if (ofs + 4 <= *len)
+				memset(buf + ofs, 0xff, 4);
+			break;
+		case 3:
+			if (ofs >= 8)
+				*len = ofs;
+			break;
+		}
+	}
+}
+
+/*
+ * Open and query randomly corrupted copies of a valid file. Any invalid
+ * memory access in the reader shows up as a crash (or a sanitizer report).
+ */
+static int
+fuzz_run(struct bench_opts *o)
+{
+	char **keys, **miss_keys;
+	uint8_t *orig, *buf;
+	size_t found = 0, opened = 0;
+	size_t orig_len;
+	struct stat st;
+	FILE *f;
+
+	keys = corpus_generate(o, false);
+	miss_keys = corpus_generate(o, true);
+	if (bench_build(o, keys, o->file) || stat(o->file, &st))
+		return 1;
+
+	orig_len = st.st_size;
+	orig = malloc(orig_len);
+	buf = malloc(orig_len);
+	f = fopen(o->file, "r");
+	if (!f || fread(orig, 1, orig_len, f) != orig_len)
+		return 1;
+	fclose(f);
+
+	for (size_t i = 0; i < o->fuzz_rounds; i++) {
+		struct uht_reader r;
+		size_t len = orig_len;
+
+		memcpy(buf, orig, len);
+		fuzz_mutate(o, buf, &len);
+
+		f = fopen(o->file, "w");
+		if (!f || fwrite(buf, 1, len, f) != len)
+			return 1;
+		fclose(f);
+
+		if (uht_reader_open(&r, o->file))
+			continue;
+
+		opened++;
+		for (size_t j = 0; j < o->n_keys; j++) {
+			uint32_t val = uht_reader_hashtbl_lookup(&r, r.val, keys[j]);
+
+			if (val && !uht_entry_valid(r.len, val)) {
+				fprintf(stderr, "Invalid value returned in round %zu\n", i);
+				return 1;
+			}
+
+			found += !!val;
+			uht_reader_hashtbl_lookup(&r, r.val, miss_keys[j]);
+		}
+		uht_reader_close(&r);
+	}
+
+	printf("fuzz: %zu rounds, %zu files opened, %zu keys found\n",
+	       o->fuzz_rounds, opened, found);
+
+	unlink(o->file);
+	free(orig);
+	free(buf);
+	corpus_free(o, keys);
+	corpus_free(o, miss_keys);
+
+	return 0;
+}
+
+enum {
+	OVERLAY_NONE,
+	OVERLAY_VALUE,
+	OVERLAY_DELETED,
+};
+
+/*
+ * Overlay layers used by the stack test. Layer 1 shadows every 8th key and
+ * deletes the ones 4 after it, layer 2 deletes keys shadowed by layer 1,
+ * restores keys deleted by layer 1 and shadows keys only present in the base.
+ */
+static int
+overlay_layer_entry(size_t n, size_t i, int layer, int64_t *val)
+{
+	switch (layer) {
+	case 0:
+		*val = i;
+		return OVERLAY_VALUE;
+	case 1:
+		*val = i + n;
+		if (i % 8 == 0)
+			return OVERLAY_VALUE;
+		if (i % 8 == 4)
+			return OVERLAY_DELETED;
+		return OVERLAY_NONE;
+	default:
+		*val = i + 2 * n;
+		if (i % 16 == 0)
+			return OVERLAY_DELETED;
+		if (i % 16 == 4 || i % 16 == 1)
+			return OVERLAY_VALUE;
+		return OVERLAY_NONE;
+	}
+}
+
+static bool
+overlay_expect(size_t n, size_t i, int n_overlays, int64_t *val)
+{
+	bool found = true;
+
+	*val = i;
+	if (n_overlays >= 1 && i % 8 == 0)
+		*val = i + n;
+	if (n_overlays >= 1 && i % 8 == 4)
+		found = false;
+	if (n_overlays >= 2 && i % 16 == 0)
+		found = false;
+	if (n_overlays >= 2 && (i % 16 == 4 || i % 16 == 1)) {
+		*val = i + 2 * n;
+		found = true;
+	}
+
+	return found;
+}
+
+static int
+overlay_build(struct bench_opts *o, char **keys, const char *file, int layer)
+{
+	struct uht_writer wr = {};
+	size_t n_elem = 0;
+	int64_t val;
+	uint32_t ht;
+	FILE *f;
+	int ret;
+
+	f = fopen(file, "w+");
+	if (!f)
+		return -1;
+
+	if (o->mode == BENCH_STREAM) {
+		if (uht_writer_init_stream(&wr, f, o->mem_limit, NULL)) {
+			fclose(f);
+			return -1;
+		}
+	} else {
+		uht_writer_init_version(&wr, o->version);
+	}
+
+	for (size_t i = 0; i < o->n_keys; i++)
+		n_elem += overlay_layer_entry(o->n_keys, i, layer, &val) != OVERLAY_NONE;
+
+	if (o->mode == BENCH_MPH)
+		ht = uht_writer_mph_alloc(&wr, n_elem);
+	else
+		ht = uht_writer_hashtbl_alloc(&wr, n_elem);
+
+	for (size_t i = 0; i < o->n_keys; i++) {
+		switch (overlay_layer_entry(o->n_keys, i, layer, &val)) {
+		case OVERLAY_VALUE:
+			uht_writer_hashtbl_add_element(&wr, ht, keys[i],
+						       uht_writer_add_int(&wr, val));
+			break;
+		case OVERLAY_DELETED:
+			uht_writer_hashtbl_add_element(&wr, ht, keys[i], UHT_DELETED);
+			break;
+		}
+	}
+	uht_writer_hashtbl_done(&wr, ht);
+
+	ret = uht_writer_save(&wr, f, ht);
+	uht_writer_free(&wr);
+	fclose(f);
+
+	return ret;
+}
+
+/*
+ * Check shadowing and deletion through overlay layers and measure the
+ * lookup cost of a stack with 0, 1 and 2 overlays on top of the base file.
+ */
+static int
+overlay_run(struct bench_opts *o)
+{
+	struct uht_reader layers[3];
+	char **keys, **miss_keys;
+	char *files[3];
+	int ret = 1;
+
+	keys = corpus_generate(o, false);
+	miss_keys = corpus_generate(o, true);
+
+	for (int i = 0; i < 3; i++) {
+		if (asprintf(&files[i], "%s.%d", o->file, i) < 0)
+			return 1;
+
+		if (overlay_build(o, keys, files[i], i) ||
+		    uht_reader_open(&layers[i], files[i])) {
+			fprintf(stderr, "Failed to build %s\n", files[i]);
+			return 1;
+		}
+	}
+
+	printf("%s v%d, %zu keys of %zu bytes\n", mode_names[o->mode],
+	       o->version == UHT_VERSION_1 ? 1 : 2, o->n_keys, o->key_len);
+
+	for (int n = 0; n < 3; n++) {
+		struct uht_reader *r;
+		uint64_t start, total;
+		size_t found = 0;
+
+		for (size_t i = 0; i < o->n_keys; i++) {
+			uint32_t val;
+			int64_t exp;
+			bool hit;
+
+			hit = overlay_expect(o->n_keys, i, n, &exp);
+			val = uht_reader_layers_lookup(layers, n + 1, keys[i], &r);
+			if (!!val != hit || (val && uht_reader_get_int(r, val) != exp)) {
+				fprintf(stderr, "%d overlays: wrong result for key %zu\n", n, i);
+				goto out;
+			}
+
+			if (uht_reader_layers_lookup(layers, n + 1, miss_keys[i], &r)) {
+				fprintf(stderr, "%d overlays: found missing key %zu\n", n, i);
+				goto out;
+			}
+		}
+
+		start = bench_now();
+		for (size_t i = 0; i < o->n_lookups; i++)
+			found += !!uht_reader_layers_lookup(layers, n + 1,
+							    keys[rand_r(&o->seed) % o->n_keys], &r);
+		total = bench_now() - start;
+
+		printf("%d overlays: %.0f lookups/s, %zu found\n",
+		       n, o->n_lookups * 1e9 / total, found);
+	}
+	ret = 0;
+
+out:
+	for (int i = 0; i < 3; i++) {
+		uht_reader_close(&layers[i]);
+		unlink(files[i]);
+		free(files[i]);
+	}
+	corpus_free(o, keys);
+	corpus_free(o, miss_keys);
+
+	return ret;
+}
+
+static int
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"Options:\n"
+		"	-n <keys>	Number of keys (default: 10000)\n"
+		"	-l <len>	Key length (default: 64)\n"
+		"	-L <lookups>	Number of lookups (default: 100000)\n"
+		"	-m <mode>	Table mode: chained, mph, stream (default: chained)\n"
+		"	-M <bytes>	Memory limit for stream mode (default: 1048576)\n"
+		"	-1		Write version 1 files\n"
+		"	-f <rounds>	Fuzz the reader with corrupted files instead\n"
+		"	-O		Test overlay stacks instead\n"
+		"	-o <file>	Output file (default: /tmp/uht-bench.bin)\n"
+		"	-s <seed>	Random seed\n"
+		"\n", prog);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts o = {
+		.file = "/tmp/uht-bench.bin",
+		.n_keys = 10000,
+		.key_len = 64,
+		.n_lookups = 100000,
+		.mem_limit = 1024 * 1024,
+		.version = UHT_VERSION_2,
+		.mode = BENCH_CHAINED,
+		.seed = 1,
+	};
+	int ch;
+
+	while ((ch = getopt(argc, argv, "n:l:L:m:M:1f:Oo:s:")) != -1) {
+		switch (ch) {
+		case 'n':
+			o.n_keys = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			o.key_len = strtoul(optarg, NULL, 0);
+			break;
+		case 'L':
+			o.n_lookups = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			for (o.mode = 0; o.mode < (int)ARRAY_SIZE(mode_names); o.mode++)
+				if (!strcmp(mode_names[o.mode], optarg))
+					break;
+			if (o.mode == ARRAY_SIZE(mode_names))
+				return usage(argv[0]);
+			break;
+		case 'M':
+			o.mem_limit = strtoul(optarg, NULL, 0);
+			break;
+		case '1':
+			o.version = UHT_VERSION_1;
+			break;
+		case 'f':
+			o.fuzz_rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'O':
+			o.overlay = true;
+			break;
+		case 'o':
+			o.file = optarg;
+			break;
+		case 's':
+			o.seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (!o.n_keys || !o.n_lookups || o.key_len < 16)
+		return usage(argv[0]);
+
+	if (o.fuzz_rounds)
+		return fuzz_run(&o);
+
+	if (o.overlay)
+		return overlay_run(&o);
+
+	return bench_run(&o);
+}
@@ -2,8 +2,11 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
 #include <fcntl.h>
 
+#include <libubox/list.h>
 #include <libubox/utils.h>
 
 #include "xxhash32.h"
@@ -16,6 +19,20 @@
 
 #define UHT_HASHTBL_KEY_FLAG_FIRST	1
 
+/* entry layout: key, value [, key hash, key length] */
+#define UHT_HASHTBL_ENTRY_WORDS_V1	2
+#define UHT_HASHTBL_ENTRY_WORDS_V2	4
+
+/* mph header: elements, buckets, seed */
+#define UHT_MPH_HDR_WORDS		3
+#define UHT_MPH_BUCKET_SIZE		4
+#define UHT_MPH_MAX_SEEDS		32
+#define UHT_MPH_MAX_TRIES		64
+
+#define UHT_STREAM_MIN_MEM		(64 * 1024)
+#define UHT_STREAM_READ_ENTRIES		256
+#define UHT_STREAM_WRITE_WORDS		1024
+
 struct uht_file_hdr {
 	uint8_t version;
 	uint8_t _pad[3];
@@ -32,11 +49,67 @@ struct uht_entry {
 	struct uht_key key;
 };
 
+/* hashtable entry while the table is built in streaming mode */
+struct uht_stream_entry {
+	uint32_t slot;
+	uint32_t key;
+	uint32_t val;
+	uint32_t hash;
+	uint32_t len;
+};
+
+struct uht_stream_run {
+	off_t ofs;
+	size_t len;
+};
+
+struct uht_stream_hashtbl {
+	struct list_head list;
+	uint32_t attr;
+	uint32_t size;
+	uint32_t elements;
+	uint8_t order;
+
+	struct uht_stream_entry *run;
+	size_t run_len;
+
+	struct uht_stream_run *spill;
+	size_t n_spill;
+};
+
+struct uht_stream_dedup {
+	uint32_t hash;
+	uint32_t len;
+	uint32_t entry;
+};
+
+struct uht_writer_stream {
+	int fd;
+	int spill_fd;
+	off_t spill_ofs;
+	bool error;
+
+	/* file offset of the first byte in wr->buf */
+	size_t flush_ofs;
+	size_t window_size;
+
+	size_t run_size;
+	struct list_head hashtbls;
+
+	struct uht_stream_dedup *dedup;
+	uint32_t dedup_mask;
+
+	void *scratch;
+	size_t scratch_len;
+};
+
 struct uht_hashtbl_meta {
 	uint32_t *ht;
 	uint32_t *ht_slot;
 	uint32_t *ht_entry;
 	uint32_t elements;
+	uint32_t buckets;
+	uint8_t entry_words;
 	uint8_t order;
 };
 
@@ -53,11 +126,86 @@ uht_key_comp(const void *k1, const void *k2, void *ptr)
 		      uht_entry_ptr(wr->buf, key2->entry), key1->len);
 }
 
+static size_t
+uht_writer_window_start(struct uht_writer *wr)
+{
+	return wr->stream ? wr->stream->flush_ofs : 0;
+}
+
+static void
+uht_writer_stream_write(struct uht_writer *wr, const void *data, size_t len,
+			size_t ofs)
+{
+	struct uht_writer_stream *s = wr->stream;
+
+	if (pwrite(s->fd, data, len, ofs) != (ssize_t)len)
+		s->error = true;
+}
+
+static void
+uht_writer_stream_flush(struct uht_writer *wr)
+{
+	struct uht_writer_stream *s = wr->stream;
+
+	uht_writer_stream_write(wr, wr->buf, wr->buf_ofs - s->flush_ofs, s->flush_ofs);
+	s->flush_ofs = wr->buf_ofs;
+}
+
+static bool
+uht_writer_stream_data_equal(struct uht_writer *wr, uint32_t entry,
+			     const void *data, size_t len)
+{
+	struct uht_writer_stream *s = wr->stream;
+	size_t ofs = uht_entry_offset(entry);
+
+	if (ofs >= s->flush_ofs)
+		return !memcmp(wr->buf + ofs - s->flush_ofs, data, len);
+
+	if (len > s->scratch_len) {
+		s->scratch_len = len;
+		s->scratch = realloc(s->scratch, len);
+	}
+
+	if (pread(s->fd, s->scratch, len, ofs) != (ssize_t)len) {
+		s->error = true;
+		return false;
+	}
+
+	return !memcmp(s->scratch, data, len);
+}
+
+/*
+ * Streaming mode only keeps a fixed size cache of recently stored values
+ * for de-duplication, which may occasionally store a value twice.
+ */
+static uint32_t
+uht_writer_stream_check_insert(struct uht_writer *wr, struct uht_key *key)
+{
+	struct uht_writer_stream *s = wr->stream;
+	void *data = wr->buf + uht_entry_offset(key->entry) - s->flush_ofs;
+	uint32_t hash = XXH32(data, key->len, 0);
+	struct uht_stream_dedup *d = &s->dedup[hash & s->dedup_mask];
+
+	if (d->len == key->len && d->hash == hash &&
+	    uht_writer_stream_data_equal(wr, d->entry, data, key->len))
+		return d->entry;
+
+	d->hash = hash;
+	d->len = key->len;
+	d->entry = key->entry;
+	wr->buf_ofs += key->len;
+
+	return key->entry;
+}
+
 static uint32_t
 uht_writer_check_insert(struct uht_writer *wr, struct uht_key *key)
 {
 	struct uht_entry *entry;
 
+	if (wr->stream)
+		return uht_writer_stream_check_insert(wr, key);
+
 	entry = avl_find_element(&wr->data, key, entry, node);
 	if (entry)
 		return entry->key.entry;
@@ -71,31 +219,106 @@ uht_writer_check_insert(struct uht_writer *wr, struct uht_key *key)
 	return key->entry;
 }
 
-void uht_writer_init(struct uht_writer *wr)
+void uht_writer_init_version(struct uht_writer *wr, uint8_t version)
 {
 	avl_init(&wr->data, uht_key_comp, false, wr);
 	wr->buf_len = 256;
 	wr->buf = calloc(1, wr->buf_len);
 	wr->buf_ofs = sizeof(struct uht_file_hdr);
+	wr->version = version;
+	wr->error = false;
+	wr->stream = NULL;
+}
+
+void uht_writer_init(struct uht_writer *wr)
+{
+	uht_writer_init_version(wr, UHT_VERSION_2);
+}
+
+/*
+ * out has to be opened for reading and writing ("w+"), values that were
+ * already flushed are read back from it for de-duplication.
+ */
+int uht_writer_init_stream(struct uht_writer *wr, FILE *out, size_t mem_limit,
+			   const char *tmpdir)
+{
+	struct uht_writer_stream *s;
+	char path[PATH_MAX];
+	size_t dedup_size = 1;
+	int fd, flags;
+
+	flags = fcntl(fileno(out), F_GETFL);
+	if (flags < 0 || (flags & O_ACCMODE) != O_RDWR)
+		return -1;
+
+	if (mem_limit < UHT_STREAM_MIN_MEM)
+		mem_limit = UHT_STREAM_MIN_MEM;
+
+	snprintf(path, sizeof(path), "%s/uht-XXXXXX", tmpdir ? tmpdir : "/tmp");
+	fd = mkstemp(path);
+	if (fd < 0)
+		return -1;
+
+	unlink(path);
+
+	/*
+	 * split the budget between the output window, the run buffer of
+	 * each open hashtable and the de-duplication cache
+	 */
+	while (2 * dedup_size * sizeof(struct uht_stream_dedup) <= mem_limit / 4)
+		dedup_size <<= 1;
+
+	s = calloc(1, sizeof(*s));
+	s->fd = fileno(out);
+	s->spill_fd = fd;
+	s->window_size = mem_limit / 4;
+	s->run_size = mem_limit / 4 / sizeof(struct uht_stream_entry);
+	s->dedup = calloc(dedup_size, sizeof(*s->dedup));
+	s->dedup_mask = dedup_size - 1;
+	INIT_LIST_HEAD(&s->hashtbls);
+
+	uht_writer_init(wr);
+	wr->stream = s;
+
+	return 0;
+}
+
+static uint8_t
+uht_hashtbl_entry_words(uint8_t version)
+{
+	if (version == UHT_VERSION_1)
+		return UHT_HASHTBL_ENTRY_WORDS_V1;
+
+	return UHT_HASHTBL_ENTRY_WORDS_V2;
 }
 
 static void *
 __uht_writer_alloc(struct uht_writer *wr, struct uht_key *key, size_t size)
 {
+	size_t ofs;
 	void *ret;
 
 	if (size >= (1 << 24) || wr->buf_ofs + size >= (1 << 30))
 		return NULL;
 
 	size = ALIGN_OFS(size);
-	while (wr->buf_ofs + size > wr->buf_len) {
+	if (wr->stream &&
+	    wr->buf_ofs - wr->stream->flush_ofs + size > wr->stream->window_size)
+		uht_writer_stream_flush(wr);
+
+	ofs = wr->buf_ofs - uht_writer_window_start(wr);
+	while (ofs + size > wr->buf_len) {
 		wr->buf_len <<= 1;
 		wr->buf = realloc(wr->buf, wr->buf_len);
 	}
 
 	key->len = size;
 	key->entry = wr->buf_ofs << (UHT_TYPE_BITS - UHT_ALIGN_BITS);
-	ret = wr->buf + wr->buf_ofs;
+	ret = wr->buf + ofs;
+
+	/* clear alignment padding */
+	if (size)
+		memset(ret + size - 4, 0, 4);
 
 	return ret;
 }
@@ -118,22 +341,306 @@ uht_writer_add_generic(struct uht_writer *wr, const void *data, size_t len)
 }
 
 static int uht_hashtbl_get_meta(struct uht_hashtbl_meta *meta, void *buf, size_t len,
-				uint32_t attr)
+				uint32_t attr, uint8_t version)
 {
 	uint32_t val;
 
 	meta->ht = buf + uht_entry_offset(attr);
-	val = cpu_to_le32(*meta->ht);
-	meta->order = val & UHT_HASHTBL_ORDER_MASK;
-	meta->elements = val >> UHT_HASHTBL_SIZE_SHIFT;
-	meta->ht_slot = meta->ht + 1;
-	meta->ht_entry = meta->ht_slot + (1 << meta->order);
-	if ((void *)&meta->ht_entry[2 * meta->elements] > buf + len)
+	meta->entry_words = uht_hashtbl_entry_words(version);
+	if (uht_entry_type(attr) == UHT_HASHTBL_MPH) {
+		meta->elements = le32_to_cpu(meta->ht[0]);
+		meta->buckets = le32_to_cpu(meta->ht[1]);
+		meta->ht_slot = meta->ht + UHT_MPH_HDR_WORDS;
+		meta->ht_entry = meta->ht_slot + meta->buckets;
+	} else {
+		val = cpu_to_le32(*meta->ht);
+		meta->order = val & UHT_HASHTBL_ORDER_MASK;
+		meta->elements = val >> UHT_HASHTBL_SIZE_SHIFT;
+		meta->ht_slot = meta->ht + 1;
+		meta->ht_entry = meta->ht_slot + (1 << meta->order);
+	}
+	if ((void *)&meta->ht_entry[meta->entry_words * meta->elements] > buf + len)
 		return -1;
 
 	return 0;
 }
 
+static struct uht_stream_hashtbl *
+uht_writer_stream_hashtbl(struct uht_writer *wr, uint32_t attr)
+{
+	struct uht_stream_hashtbl *ht;
+
+	list_for_each_entry(ht, &wr->stream->hashtbls, list)
+		if (ht->attr == attr)
+			return ht;
+
+	return NULL;
+}
+
+static uint32_t
+uht_writer_stream_hashtbl_alloc(struct uht_writer *wr, size_t n_members,
+				uint8_t order, size_t ht_size)
+{
+	struct uht_writer_stream *s = wr->stream;
+	struct uht_stream_hashtbl *ht;
+	uint32_t attr;
+
+	if (wr->buf_ofs + ht_size >= (1 << 30))
+		return 0;
+
+	/* reserve the table in the file, it is written by _done() */
+	uht_writer_stream_flush(wr);
+	attr = wr->buf_ofs << (UHT_TYPE_BITS - UHT_ALIGN_BITS);
+	wr->buf_ofs += ALIGN_OFS(ht_size);
+	s->flush_ofs = wr->buf_ofs;
+
+	ht = calloc(1, sizeof(*ht));
+	ht->attr = attr | UHT_HASHTBL;
+	ht->size = n_members;
+	ht->order = order;
+	ht->run = calloc(min(n_members, s->run_size) + 1, sizeof(*ht->run));
+	list_add(&ht->list, &s->hashtbls);
+
+	return ht->attr;
+}
+
+static int
+uht_stream_entry_cmp(const void *a1, const void *a2)
+{
+	const struct uht_stream_entry *e1 = a1, *e2 = a2;
+
+	if (e1->slot != e2->slot)
+		return e1->slot < e2->slot ? -1 : 1;
+
+	return e1->key < e2->key ? -1 : e1->key > e2->key;
+}
+
+static void
+uht_writer_stream_spill(struct uht_writer *wr, struct uht_stream_hashtbl *ht)
+{
+	struct uht_writer_stream *s = wr->stream;
+	size_t len = ht->run_len * sizeof(*ht->run);
+	struct uht_stream_run *run;
+
+	qsort(ht->run, ht->run_len, sizeof(*ht->run), uht_stream_entry_cmp);
+	if (pwrite(s->spill_fd, ht->run, len, s->spill_ofs) != (ssize_t)len)
+		s->error = true;
+
+	ht->spill = realloc(ht->spill, (ht->n_spill + 1) * sizeof(*ht->spill));
+	run = &ht->spill[ht->n_spill++];
+	run->ofs = s->spill_ofs;
+	run->len = ht->run_len;
+	s->spill_ofs += len;
+	ht->run_len = 0;
+}
+
+static void
+uht_writer_stream_hashtbl_add(struct uht_writer *wr, uint32_t hashtbl,
+			      const char *key, uint32_t key_attr, uint32_t val)
+{
+	struct uht_writer_stream *s = wr->stream;
+	struct uht_stream_hashtbl *ht;
+	struct uht_stream_entry *e;
+
+	ht = uht_writer_stream_hashtbl(wr, hashtbl);
+	if (!ht || ht->elements >= ht->size) {
+		s->error = true;
+		return;
+	}
+
+	if (ht->run_len == min(ht->size, s->run_size))
+		uht_writer_stream_spill(wr, ht);
+
+	e = &ht->run[ht->run_len++];
+	e->len = strlen(key);
+	e->hash = XXH32(key, e->len, 0);
+	e->slot = e->hash & ((1 << ht->order) - 1);
+	e->key = key_attr;
+	e->val = val;
+	ht->elements++;
+}
+
+struct uht_stream_source {
+	struct uht_stream_entry *buf;
+	size_t pos, len;
+	off_t ofs;
+	size_t remaining;
+};
+
+static bool
+uht_stream_source_fill(struct uht_writer *wr, struct uht_stream_source *src)
+{
+	size_t len = min(src->remaining, (size_t)UHT_STREAM_READ_ENTRIES);
+	ssize_t size = len * sizeof(*src->buf);
+
+	if (!len)
+		return false;
+
+	if (pread(wr->stream->spill_fd, src->buf, size, src->ofs) != size) {
+		wr->stream->error = true;
+		return false;
+	}
+
+	src->ofs += size;
+	src->remaining -= len;
+	src->pos = 0;
+	src->len = len;
+
+	return true;
+}
+
+static bool
+uht_stream_source_less(struct uht_stream_source *src, uint32_t a, uint32_t b)
+{
+	uint32_t slot_a = src[a].buf[src[a].pos].slot;
+	uint32_t slot_b = src[b].buf[src[b].pos].slot;
+
+	if (slot_a != slot_b)
+		return slot_a < slot_b;
+
+	return a < b;
+}
+
+static void
+uht_stream_heap_down(struct uht_stream_source *src, uint32_t *heap, size_t n)
+{
+	size_t i = 0;
+
+	while (1) {
+		size_t child = 2 * i + 1;
+		uint32_t tmp;
+
+		if (child >= n)
+			break;
+
+		if (child + 1 < n && uht_stream_source_less(src, heap[child + 1], heap[child]))
+			child++;
+
+		if (!uht_stream_source_less(src, heap[child], heap[i]))
+			break;
+
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+}
+
+static void
+uht_stream_heap_up(struct uht_stream_source *src, uint32_t *heap, size_t i)
+{
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		uint32_t tmp;
+
+		if (!uht_stream_source_less(src, heap[i], heap[parent]))
+			break;
+
+		tmp = heap[i];
+		heap[i] = heap[parent];
+		heap[parent] = tmp;
+		i = parent;
+	}
+}
+
+/*
+ * Merge the sorted runs of a hashtable and write its slot and entry arrays
+ * sequentially into the space reserved in the output file.
+ */
+static void
+uht_writer_stream_hashtbl_done(struct uht_writer *wr, uint32_t hashtbl)
+{
+	uint8_t entry_words = uht_hashtbl_entry_words(wr->version);
+	uint32_t out[UHT_STREAM_WRITE_WORDS], slots[UHT_STREAM_WRITE_WORDS];
+	size_t ht_ofs, slot_ofs, entry_ofs, out_len = 0, slot_base = 0;
+	struct uht_stream_source *src;
+	struct uht_stream_hashtbl *ht;
+	uint32_t last_slot = ~0, hdr;
+	size_t n_src, n_heap = 0;
+	uint32_t *heap;
+
+	ht = uht_writer_stream_hashtbl(wr, hashtbl);
+	if (!ht)
+		return;
+
+	qsort(ht->run, ht->run_len, sizeof(*ht->run), uht_stream_entry_cmp);
+
+	n_src = ht->n_spill + 1;
+	src = calloc(n_src, sizeof(*src));
+	heap = calloc(n_src, sizeof(*heap));
+	for (size_t i = 0; i < ht->n_spill; i++) {
+		src[i].buf = calloc(UHT_STREAM_READ_ENTRIES, sizeof(*src[i].buf));
+		src[i].ofs = ht->spill[i].ofs;
+		src[i].remaining = ht->spill[i].len;
+		if (uht_stream_source_fill(wr, &src[i]))
+			heap[n_heap++] = i;
+	}
+	src[ht->n_spill].buf = ht->run;
+	src[ht->n_spill].len = ht->run_len;
+	if (ht->run_len)
+		heap[n_heap++] = ht->n_spill;
+
+	for (size_t i = 0; i < n_heap; i++)
+		uht_stream_heap_up(src, heap, i);
+
+	ht_ofs = uht_entry_offset(ht->attr);
+	slot_ofs = ht_ofs + 4;
+	entry_ofs = slot_ofs + (4 << ht->order);
+	memset(slots, 0, sizeof(slots));
+
+	for (uint32_t i = 0; n_heap > 0; i++) {
+		struct uht_stream_source *cur = &src[heap[0]];
+		struct uht_stream_entry *e = &cur->buf[cur->pos];
+		uint32_t key = e->key & ~UHT_TYPE_MASK;
+
+		if (e->slot >= slot_base + UHT_STREAM_WRITE_WORDS) {
+			uht_writer_stream_write(wr, slots, sizeof(slots), slot_ofs + 4 * slot_base);
+			memset(slots, 0, sizeof(slots));
+			slot_base = e->slot - e->slot % UHT_STREAM_WRITE_WORDS;
+		}
+
+		if (e->slot != last_slot)
+			key |= UHT_HASHTBL_KEY_FLAG_FIRST;
+		slots[e->slot - slot_base] = cpu_to_le32(i);
+		last_slot = e->slot;
+
+		if (out_len + entry_words > UHT_STREAM_WRITE_WORDS) {
+			uht_writer_stream_write(wr, out, 4 * out_len, entry_ofs);
+			entry_ofs += 4 * out_len;
+			out_len = 0;
+		}
+
+		out[out_len++] = cpu_to_le32(key);
+		out[out_len++] = cpu_to_le32(e->val);
+		if (entry_words == UHT_HASHTBL_ENTRY_WORDS_V2) {
+			out[out_len++] = cpu_to_le32(e->hash);
+			out[out_len++] = cpu_to_le32(e->len);
+		}
+
+		if (++cur->pos == cur->len && !uht_stream_source_fill(wr, cur))
+			heap[0] = heap[--n_heap];
+		uht_stream_heap_down(src, heap, n_heap);
+	}
+
+	uht_writer_stream_write(wr, out, 4 * out_len, entry_ofs);
+	uht_writer_stream_write(wr, slots,
+				4 * min((size_t)UHT_STREAM_WRITE_WORDS, (1U << ht->order) - slot_base),
+				slot_ofs + 4 * slot_base);
+
+	hdr = cpu_to_le32(ht->order | (ht->elements << UHT_HASHTBL_SIZE_SHIFT));
+	uht_writer_stream_write(wr, &hdr, sizeof(hdr), ht_ofs);
+
+	for (size_t i = 0; i < ht->n_spill; i++)
+		free(src[i].buf);
+	free(src);
+	free(heap);
+
+	list_del(&ht->list);
+	free(ht->spill);
+	free(ht->run);
+	free(ht);
+}
+
 uint32_t uht_writer_hashtbl_alloc(struct uht_writer *wr, size_t n_members)
 {
 	struct uht_key key;
@@ -146,7 +653,10 @@ uint32_t uht_writer_hashtbl_alloc(struct uht_writer *wr, size_t n_members)
 	while (n_members > 1U << order)
 		order++;
 
-	ht_size = 4 + (4 << order) + 8 * n_members;
+	ht_size = 4 + (4 << order) + 4 * uht_hashtbl_entry_words(wr->version) * n_members;
+	if (wr->stream)
+		return uht_writer_stream_hashtbl_alloc(wr, n_members, order, ht_size);
+
 	ht = uht_writer_alloc(wr, &key, ht_size);
 	if (!ht)
 		return 0;
@@ -157,6 +667,33 @@ uint32_t uht_writer_hashtbl_alloc(struct uht_writer *wr, size_t n_members)
 	return key.entry | UHT_HASHTBL;
 }
 
+uint32_t uht_writer_mph_alloc(struct uht_writer *wr, size_t n_members)
+{
+	struct uht_key key;
+	uint32_t *ht, ht_size, buckets;
+
+	/* streaming mode can't build the index without keeping all keys in RAM */
+	if (wr->version == UHT_VERSION_1 || wr->stream)
+		return uht_writer_hashtbl_alloc(wr, n_members);
+
+	if (n_members >= 1 << 24)
+		return 0;
+
+	buckets = (n_members + UHT_MPH_BUCKET_SIZE - 1) / UHT_MPH_BUCKET_SIZE;
+	if (!buckets)
+		buckets = 1;
+
+	ht_size = 4 * UHT_MPH_HDR_WORDS + 4 * buckets +
+		  4 * UHT_HASHTBL_ENTRY_WORDS_V2 * n_members;
+	ht = uht_writer_alloc(wr, &key, ht_size);
+	if (!ht)
+		return 0;
+
+	memset(ht, 0, ht_size);
+	ht[1] = cpu_to_le32(buckets);
+
+	return key.entry | UHT_HASHTBL_MPH;
+}
 
 void uht_writer_hashtbl_add_element(struct uht_writer *wr, uint32_t hashtbl,
 				    const char *key, uint32_t val)
@@ -165,13 +702,26 @@ void uht_writer_hashtbl_add_element(struct uht_writer *wr, uint32_t hashtbl,
 	uint32_t key_attr = uht_writer_add_string(wr, key);
 	uint32_t *ht_next;
 
-	if (uht_hashtbl_get_meta(&meta, wr->buf, wr->buf_ofs, hashtbl))
+	if (wr->stream) {
+		uht_writer_stream_hashtbl_add(wr, hashtbl, key, key_attr, val);
+		return;
+	}
+
+	if (uht_hashtbl_get_meta(&meta, wr->buf, wr->buf_ofs, hashtbl, wr->version))
 		return;
 
-	ht_next = &meta.ht_entry[2 * meta.elements];
-	*meta.ht = cpu_to_le32(le32_to_cpu(*meta.ht) + (1 << UHT_HASHTBL_SIZE_SHIFT));
+	ht_next = &meta.ht_entry[meta.entry_words * meta.elements];
+	if (uht_entry_type(hashtbl) == UHT_HASHTBL_MPH)
+		*meta.ht = cpu_to_le32(meta.elements + 1);
+	else
+		*meta.ht = cpu_to_le32(le32_to_cpu(*meta.ht) + (1 << UHT_HASHTBL_SIZE_SHIFT));
 	ht_next[0] = cpu_to_le32(key_attr);
 	ht_next[1] = cpu_to_le32(val);
+	if (meta.entry_words < UHT_HASHTBL_ENTRY_WORDS_V2)
+		return;
+
+	ht_next[2] = cpu_to_le32(XXH32(key, strlen(key), 0));
+	ht_next[3] = cpu_to_le32(strlen(key));
 }
 
 static uint32_t
@@ -182,42 +732,341 @@ uht_hashtbl_key_slot(const char *key, uint8_t order)
 	return XXH32(key, strlen(key), 0) & mask;
 }
 
-
 static uint32_t
-uht_hashtbl_entry_key_slot(struct uht_writer *wr, uint32_t k, uint8_t order)
+uht_hashtbl_entry_slot(struct uht_writer *wr, const uint32_t *entry, uint8_t order)
 {
-	return uht_hashtbl_key_slot(uht_entry_ptr(wr->buf, k), order);
+	uint32_t mask = (1 << order) - 1;
+
+	if (wr->version == UHT_VERSION_1)
+		return uht_hashtbl_key_slot(uht_entry_ptr(wr->buf, le32_to_cpu(entry[0])), order);
+
+	return le32_to_cpu(entry[2]) & mask;
 }
 
-struct uht_writer *__sort_wr;
-static uint8_t __sort_order;
-static int __entry_sort_fn(const void *a1, const void *a2)
+
+struct uht_entry_sort_ctx {
+	struct uht_writer *wr;
+	uint8_t order;
+};
+
+static int __entry_sort_fn(const void *a1, const void *a2, void *arg)
 {
-	struct uht_writer *wr = __sort_wr;
-	const uint32_t *k1 = a1, *k2 = a2;
-	uint32_t slot1 = uht_hashtbl_entry_key_slot(wr, le32_to_cpu(*k1), __sort_order);
-	uint32_t slot2 = uht_hashtbl_entry_key_slot(wr, le32_to_cpu(*k2), __sort_order);
+	struct uht_entry_sort_ctx *ctx = arg;
+	uint32_t slot1 = uht_hashtbl_entry_slot(ctx->wr, a1, ctx->order);
+	uint32_t slot2 = uht_hashtbl_entry_slot(ctx->wr, a2, ctx->order);
 
 	return slot1 - slot2;
 }
 
+struct uht_dedup_ctx {
+	const uint32_t *entries;
+	uint8_t entry_words;
+};
+
+static uint32_t
+uht_dedup_key(struct uht_dedup_ctx *ctx, uint32_t i)
+{
+	return le32_to_cpu(ctx->entries[ctx->entry_words * i]) & ~UHT_TYPE_MASK;
+}
+
+static int __dedup_sort_fn(const void *a1, const void *a2, void *arg)
+{
+	struct uht_dedup_ctx *ctx = arg;
+	uint32_t i1 = *(const uint32_t *)a1, i2 = *(const uint32_t *)a2;
+	uint32_t k1 = uht_dedup_key(ctx, i1), k2 = uht_dedup_key(ctx, i2);
+
+	if (k1 != k2)
+		return k1 < k2 ? -1 : 1;
+
+	return i1 < i2 ? -1 : i1 > i2;
+}
+
+/*
+ * Identical key strings share one key entry, so duplicate keys can be found
+ * by comparing key offsets. The element added last wins, earlier ones are
+ * removed. Returns the new number of elements.
+ */
+static uint32_t
+uht_writer_hashtbl_dedup(struct uht_hashtbl_meta *meta)
+{
+	struct uht_dedup_ctx ctx = {
+		.entries = meta->ht_entry,
+		.entry_words = meta->entry_words,
+	};
+	size_t entry_size = 4 * meta->entry_words;
+	uint32_t n = meta->elements, n_out = 0;
+	uint32_t *idx;
+	uint8_t *drop;
+
+	if (n < 2)
+		return n;
+
+	idx = calloc(n, sizeof(*idx));
+	drop = calloc(n, sizeof(*drop));
+	for (uint32_t i = 0; i < n; i++)
+		idx[i] = i;
+
+	qsort_r(idx, n, sizeof(*idx), __dedup_sort_fn, &ctx);
+	for (uint32_t i = 0; i + 1 < n; i++)
+		if (uht_dedup_key(&ctx, idx[i]) == uht_dedup_key(&ctx, idx[i + 1]))
+			drop[idx[i]] = 1;
+
+	for (uint32_t i = 0; i < n; i++) {
+		if (drop[i])
+			continue;
+
+		if (n_out != i)
+			memcpy(&meta->ht_entry[meta->entry_words * n_out],
+			       &meta->ht_entry[meta->entry_words * i], entry_size);
+		n_out++;
+	}
+
+	free(idx);
+	free(drop);
+
+	return n_out;
+}
+
+/*
+ * Minimal perfect hash (CHD style): keys are distributed over buckets, and
+ * each bucket stores a displacement index that maps all of its keys to
+ * distinct free slots: slot = (f1 + d0 * f2 + d1) % n, with
+ * d0 = disp / n, d1 = disp % n
+ */
+struct uht_mph_key {
+	uint32_t bucket;
+	uint32_t f1, f2;
+};
+
+struct uht_mph_bucket {
+	uint32_t id;
+	uint32_t size;
+	uint32_t first;
+};
+
+static void
+uht_mph_key_hash(struct uht_mph_key *k, uint32_t hash, uint32_t n, uint32_t buckets)
+{
+	uint64_t z = hash + 0x9e3779b97f4a7c15ULL;
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z ^= z >> 31;
+
+	k->bucket = hash % buckets;
+	k->f1 = (uint32_t)z % n;
+	k->f2 = (uint32_t)(z >> 32) % n;
+}
+
+static uint32_t
+uht_mph_slot(const struct uht_mph_key *k, uint32_t disp, uint32_t n)
+{
+	uint64_t d0 = disp / n, d1 = disp % n;
+
+	return (k->f1 + d0 * k->f2 + d1) % n;
+}
+
+static int
+uht_mph_bucket_cmp(const void *a1, const void *a2)
+{
+	const struct uht_mph_bucket *b1 = a1, *b2 = a2;
+
+	if (b1->size != b2->size)
+		return b1->size > b2->size ? -1 : 1;
+
+	return b1->id < b2->id ? -1 : b1->id > b2->id;
+}
+
+static bool
+uht_mph_place_bucket(struct uht_mph_key *keys, uint32_t *members,
+		     struct uht_mph_bucket *b, uint32_t n, uint8_t *taken,
+		     uint32_t *slots, uint32_t *disp)
+{
+	uint64_t max_disp = (uint64_t)n * UHT_MPH_MAX_TRIES;
+
+	if (max_disp > UINT32_MAX)
+		max_disp = UINT32_MAX;
+
+	for (uint64_t d = 0; d < max_disp; d++) {
+		uint32_t i;
+
+		for (i = 0; i < b->size; i++) {
+			uint32_t slot = uht_mph_slot(&keys[members[b->first + i]], d, n);
+
+			if (taken[slot])
+				break;
+
+			taken[slot] = 1;
+			slots[i] = slot;
+		}
+
+		if (i == b->size) {
+			*disp = d;
+			return true;
+		}
+
+		while (i-- > 0)
+			taken[slots[i]] = 0;
+	}
+
+	return false;
+}
+
+static bool
+uht_mph_build(struct uht_writer *wr, struct uht_hashtbl_meta *meta,
+	      uint32_t seed, uint32_t *key_slot)
+{
+	uint32_t n = meta->elements, n_buckets = meta->buckets;
+	struct uht_mph_bucket *buckets;
+	struct uht_mph_key *keys;
+	uint32_t *members, *slots;
+	uint32_t max_size = 0;
+	uint8_t *taken;
+	bool ret = false;
+
+	keys = calloc(n, sizeof(*keys));
+	members = calloc(n, sizeof(*members));
+	slots = calloc(n, sizeof(*slots));
+	buckets = calloc(n_buckets, sizeof(*buckets));
+	taken = calloc(n, sizeof(*taken));
+
+	for (uint32_t i = 0; i < n_buckets; i++)
+		buckets[i].id = i;
+
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t *entry = &meta->ht_entry[UHT_HASHTBL_ENTRY_WORDS_V2 * i];
+		const char *key = uht_entry_ptr(wr->buf, le32_to_cpu(entry[0]));
+		uint32_t hash = XXH32(key, le32_to_cpu(entry[3]), seed);
+
+		entry[2] = cpu_to_le32(hash);
+		uht_mph_key_hash(&keys[i], hash, n, n_buckets);
+		buckets[keys[i].bucket].size++;
+	}
+
+	for (uint32_t i = 0, first = 0; i < n_buckets; i++) {
+		buckets[i].first = first;
+		first += buckets[i].size;
+		if (buckets[i].size > max_size)
+			max_size = buckets[i].size;
+		buckets[i].size = 0;
+	}
+
+	for (uint32_t i = 0; i < n; i++) {
+		struct uht_mph_bucket *b = &buckets[keys[i].bucket];
+
+		members[b->first + b->size++] = i;
+	}
+
+	qsort(buckets, n_buckets, sizeof(*buckets), uht_mph_bucket_cmp);
+	for (uint32_t i = 0; i < n_buckets && buckets[i].size; i++) {
+		struct uht_mph_bucket *b = &buckets[i];
+		uint32_t disp;
+
+		if (!uht_mph_place_bucket(keys, members, b, n, taken, slots, &disp))
+			goto out;
+
+		meta->ht_slot[b->id] = cpu_to_le32(disp);
+		for (uint32_t j = 0; j < b->size; j++)
+			key_slot[members[b->first + j]] = slots[j];
+	}
+
+	ret = true;
+
+out:
+	free(keys);
+	free(members);
+	free(slots);
+	free(buckets);
+	free(taken);
+
+	return ret;
+}
+
+static void
+uht_writer_mph_done(struct uht_writer *wr, struct uht_hashtbl_meta *meta)
+{
+	size_t entry_size = 4 * UHT_HASHTBL_ENTRY_WORDS_V2;
+	uint32_t n = meta->elements;
+	uint32_t *key_slot, *entries;
+	uint32_t seed;
+
+	if (!n)
+		return;
+
+	n = uht_writer_hashtbl_dedup(meta);
+	if (n != meta->elements) {
+		uint32_t buckets = (n + UHT_MPH_BUCKET_SIZE - 1) / UHT_MPH_BUCKET_SIZE;
+
+		/* shrink the bucket array, the unused tail of the table stays zeroed */
+		memmove(meta->ht_slot + buckets, meta->ht_entry, n * entry_size);
+		memset(meta->ht_slot + buckets + UHT_HASHTBL_ENTRY_WORDS_V2 * n, 0,
+		       (meta->buckets - buckets + UHT_HASHTBL_ENTRY_WORDS_V2 * (meta->elements - n)) * 4);
+		meta->ht_entry = meta->ht_slot + buckets;
+		meta->buckets = buckets;
+		meta->elements = n;
+		meta->ht[0] = cpu_to_le32(n);
+		meta->ht[1] = cpu_to_le32(buckets);
+	}
+
+	key_slot = calloc(n, sizeof(*key_slot));
+	for (seed = 0; seed < UHT_MPH_MAX_SEEDS; seed++) {
+		memset(meta->ht_slot, 0, 4 * meta->buckets);
+		if (uht_mph_build(wr, meta, seed, key_slot))
+			break;
+	}
+
+	if (seed == UHT_MPH_MAX_SEEDS) {
+		/* fail uht_writer_save() rather than writing a broken table */
+		wr->error = true;
+		free(key_slot);
+		return;
+	}
+
+	entries = malloc(n * entry_size);
+	memcpy(entries, meta->ht_entry, n * entry_size);
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t *entry = &meta->ht_entry[UHT_HASHTBL_ENTRY_WORDS_V2 * key_slot[i]];
+
+		memcpy(entry, &entries[UHT_HASHTBL_ENTRY_WORDS_V2 * i], entry_size);
+		entry[0] &= ~cpu_to_le32(UHT_TYPE_MASK);
+	}
+	meta->ht[2] = cpu_to_le32(seed);
+
+	free(entries);
+	free(key_slot);
+}
+
 void uht_writer_hashtbl_done(struct uht_writer *wr, uint32_t hashtbl)
 {
 	struct uht_hashtbl_meta meta = {};
+	struct uht_entry_sort_ctx ctx;
 	uint32_t last_slot = ~0;
 
-	if (uht_hashtbl_get_meta(&meta, wr->buf, wr->buf_ofs, hashtbl))
+	if (wr->stream) {
+		uht_writer_stream_hashtbl_done(wr, hashtbl);
 		return;
+	}
+
+	if (uht_hashtbl_get_meta(&meta, wr->buf, wr->buf_ofs, hashtbl, wr->version))
+		return;
+
+	if (uht_entry_type(hashtbl) == UHT_HASHTBL_MPH) {
+		uht_writer_mph_done(wr, &meta);
+		return;
+	}
+
+	meta.elements = uht_writer_hashtbl_dedup(&meta);
+	*meta.ht = cpu_to_le32(meta.order | (meta.elements << UHT_HASHTBL_SIZE_SHIFT));
 
-	__sort_wr = wr;
-	__sort_order = meta.order;
-	qsort(meta.ht_entry, meta.elements, 8, __entry_sort_fn);
+	ctx.wr = wr;
+	ctx.order = meta.order;
+	qsort_r(meta.ht_entry, meta.elements, 4 * meta.entry_words, __entry_sort_fn, &ctx);
 	for (size_t i = 0; i < meta.elements; i++) {
-		uint32_t key_attr = cpu_to_le32(meta.ht_entry[2 * i]);
-		uint32_t slot = uht_hashtbl_entry_key_slot(wr, key_attr, __sort_order);
-		meta.ht_entry[2 * i] &= ~cpu_to_le32(UHT_TYPE_MASK);
+		uint32_t *entry = &meta.ht_entry[meta.entry_words * i];
+		uint32_t slot = uht_hashtbl_entry_slot(wr, entry, meta.order);
+		entry[0] &= ~cpu_to_le32(UHT_TYPE_MASK);
 		if (slot != last_slot)
-			meta.ht_entry[2 * i] |= cpu_to_le32(UHT_HASHTBL_KEY_FLAG_FIRST);
+			entry[0] |= cpu_to_le32(UHT_HASHTBL_KEY_FLAG_FIRST);
 		meta.ht_slot[slot] = cpu_to_le32(i);
 		last_slot = slot;
 	}
@@ -274,10 +1123,34 @@ uint32_t uht_writer_add_int(struct uht_writer *wr, int64_t val)
 	return uht_writer_add_generic(wr, &val, 8) | UHT_INT;
 }
 
+static int
+uht_writer_stream_save(struct uht_writer *wr, uint32_t val)
+{
+	struct uht_writer_stream *s = wr->stream;
+	struct uht_file_hdr hdr = {
+		.version = wr->version,
+		.val = val,
+	};
+
+	uht_writer_stream_flush(wr);
+	uht_writer_stream_write(wr, &hdr, sizeof(hdr), 0);
+	if (ftruncate(s->fd, wr->buf_ofs))
+		s->error = true;
+
+	return s->error ? -1 : 0;
+}
+
 int uht_writer_save(struct uht_writer *wr, FILE *out, uint32_t val)
 {
 	struct uht_file_hdr *hdr = wr->buf;
 
+	if (wr->error)
+		return -1;
+
+	if (wr->stream)
+		return uht_writer_stream_save(wr, val);
+
+	hdr->version = wr->version;
 	hdr->val = val;
 
 	if (fwrite(wr->buf, 1, wr->buf_ofs, out) != wr->buf_ofs)
@@ -286,10 +1159,31 @@ int uht_writer_save(struct uht_writer *wr, FILE *out, uint32_t val)
 	return 0;
 }
 
+static void
+uht_writer_stream_free(struct uht_writer_stream *s)
+{
+	struct uht_stream_hashtbl *ht, *tmp;
+
+	list_for_each_entry_safe(ht, tmp, &s->hashtbls, list) {
+		list_del(&ht->list);
+		free(ht->spill);
+		free(ht->run);
+		free(ht);
+	}
+
+	close(s->spill_fd);
+	free(s->dedup);
+	free(s->scratch);
+	free(s);
+}
+
 void uht_writer_free(struct uht_writer *wr)
 {
 	struct uht_entry *e, *tmp;
 
+	if (wr->stream)
+		uht_writer_stream_free(wr->stream);
+
 	avl_remove_all_elements(&wr->data, e, node, tmp)
 		free(e);
 	free(wr->buf);
@@ -315,6 +1209,13 @@ __uht_object_iter_init(struct uht_reader *r, uint32_t attr)
 		iter.size = __uht_iter_fetch(&iter);
 		iter.__data += 1 << (iter.size & UHT_HASHTBL_ORDER_MASK);
 		iter.size >>= UHT_HASHTBL_SIZE_SHIFT;
+		iter.__skip = uht_hashtbl_entry_words(r->version) - 2;
+		break;
+	case UHT_HASHTBL_MPH:
+		iter.__data = uht_entry_ptr(r->data, attr);
+		iter.size = __uht_iter_fetch(&iter);
+		iter.__data += __uht_iter_fetch(&iter) + 1;
+		iter.__skip = UHT_HASHTBL_ENTRY_WORDS_V2 - 2;
 		break;
 	case UHT_ARRAY:
 	case UHT_OBJECT:
@@ -340,45 +1241,112 @@ void __uht_object_iter_next(struct uht_reader *r, struct uht_reader_iter *iter)
 		iter->key = uht_reader_get_string(r, key);
 	}
 	iter->val = __uht_iter_fetch(iter);
+	iter->__data += iter->__skip;
+}
+
+/* check that the file contains the given number of words starting at attr */
+static bool
+uht_reader_words_valid(struct uht_reader *r, uint32_t attr, uint64_t words)
+{
+	size_t ofs = uht_entry_offset(attr);
+
+	return ofs < r->len && words <= (r->len - ofs) / 4;
+}
+
+static uint32_t
+uht_reader_mph_lookup(struct uht_reader *r, uint32_t hashtbl, const char *key)
+{
+	uint32_t *ht, *entry, n, n_buckets, hash, cur_entry;
+	size_t key_len = strlen(key);
+	struct uht_mph_key k;
+	const char *cur_key;
+	size_t off;
+
+	if (r->version == UHT_VERSION_1 ||
+	    !uht_reader_words_valid(r, hashtbl, UHT_MPH_HDR_WORDS))
+		return 0;
+
+	ht = uht_entry_ptr(r->data, hashtbl);
+	n = le32_to_cpu(ht[0]);
+	n_buckets = le32_to_cpu(ht[1]);
+	if (!n || !n_buckets || n >= 1 << 24 || n_buckets > n)
+		return 0;
+
+	if (!uht_reader_words_valid(r, hashtbl, UHT_MPH_HDR_WORDS + n_buckets +
+					     UHT_HASHTBL_ENTRY_WORDS_V2 * n))
+		return 0;
+
+	hash = XXH32(key, key_len, le32_to_cpu(ht[2]));
+	uht_mph_key_hash(&k, hash, n, n_buckets);
+	ht += UHT_MPH_HDR_WORDS;
+	entry = &ht[n_buckets];
+	entry += UHT_HASHTBL_ENTRY_WORDS_V2 * uht_mph_slot(&k, le32_to_cpu(ht[k.bucket]), n);
+	if (le32_to_cpu(entry[2]) != hash || le32_to_cpu(entry[3]) != key_len)
+		return 0;
+
+	cur_entry = le32_to_cpu(entry[0]);
+	cur_entry &= ~UHT_TYPE_MASK;
+	cur_entry |= UHT_STRING;
+	if (!uht_entry_valid(r->len, cur_entry))
+		return 0;
+
+	cur_key = uht_reader_get_string(r, cur_entry);
+	off = cur_key - (const char *)r->data;
+	if (off + key_len >= r->len || memcmp(key, cur_key, key_len + 1) != 0)
+		return 0;
+
+	cur_entry = le32_to_cpu(entry[1]);
+	if (!uht_entry_valid(r->len, cur_entry))
+		return 0;
+
+	return cur_entry;
 }
 
 uint32_t uht_reader_hashtbl_lookup(struct uht_reader *r, uint32_t hashtbl,
 				   const char *key)
 {
-	uint32_t *ht, *ht_end, val, slot, size, offset;
+	uint8_t entry_words = uht_hashtbl_entry_words(r->version);
+	uint32_t *ht, val, slot, size, hash;
 	size_t key_len = strlen(key);
 	int32_t entry;
 	uint8_t order;
 
-	if (!uht_entry_valid(r->len, hashtbl))
+	if (uht_entry_type(hashtbl) == UHT_HASHTBL_MPH)
+		return uht_reader_mph_lookup(r, hashtbl, key);
+
+	if (!uht_reader_words_valid(r, hashtbl, 1))
 		return 0;
 
 	ht = uht_entry_ptr(r->data, hashtbl);
 	val = le32_to_cpu(*ht);
 	order = val & UHT_HASHTBL_ORDER_MASK;
 	size = val >> UHT_HASHTBL_SIZE_SHIFT;
-	offset = (1 << order) + 2 * size;
-	ht_end = ht + offset;
-	offset <<= 2 + UHT_TYPE_BITS - UHT_ALIGN_BITS;
+	if (!size)
+		return 0;
 
-	if (!uht_entry_valid(r->len, hashtbl + offset))
+	if (!uht_reader_words_valid(r, hashtbl, 1 + (1ULL << order) +
+					     (uint64_t)entry_words * size))
 		return 0;
 
 	ht++;
-	slot = uht_hashtbl_key_slot(key, order);
-	if (ht + slot >= ht_end)
+	hash = XXH32(key, key_len, 0);
+	slot = hash & ((1ULL << order) - 1);
+	if (le32_to_cpu(ht[slot]) >= size)
 		return 0;
 
-	entry = le32_to_cpu(ht[slot]) * 2;
-	if ((uint32_t)entry > 2 * size)
-		return 0;
+	entry = le32_to_cpu(ht[slot]) * entry_words;
 
-	ht += 1 << order;
+	ht += 1ULL << order;
 	while (entry >= 0) {
 		uint32_t cur_entry = le32_to_cpu(ht[entry]);
 		const char *cur_key;
 		size_t off;
 
+		if (entry_words == UHT_HASHTBL_ENTRY_WORDS_V2 &&
+		    (le32_to_cpu(ht[entry + 2]) != hash ||
+		     le32_to_cpu(ht[entry + 3]) != key_len))
+			goto next;
+
 		cur_entry &= ~UHT_TYPE_MASK;
 		cur_entry |= UHT_STRING;
 		if (!uht_entry_valid(r->len, cur_entry))
@@ -397,10 +1365,39 @@ uint32_t uht_reader_hashtbl_lookup(struct uht_reader *r, uint32_t hashtbl,
 			return cur_entry;
 		}
 
+next:
 		if (ht[entry] & cpu_to_le32(UHT_HASHTBL_KEY_FLAG_FIRST))
 			return 0;
 
-		entry -= 2;
+		entry -= entry_words;
+	}
+
+	return 0;
+}
+
+/*
+ * Look up a key in the outer hashtables of a stack of files, starting from
+ * the last (topmost) layer.
+ */
+uint32_t uht_reader_layers_lookup(struct uht_reader *layers, size_t n_layers,
+				  const char *key, struct uht_reader **layer)
+{
+	for (size_t i = n_layers; i-- > 0; ) {
+		struct uht_reader *r = &layers[i];
+		uint32_t val;
+
+		if (!uht_entry_is_hashtbl(r->val))
+			continue;
+
+		val = uht_reader_hashtbl_lookup(r, r->val, key);
+		if (!val)
+			continue;
+
+		if (val == UHT_DELETED)
+			return 0;
+
+		*layer = r;
+		return val;
 	}
 
 	return 0;
@@ -424,8 +1421,17 @@ int uht_reader_open(struct uht_reader *r, const char *file)
 
 	r->fd = fd;
 	r->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (r->data == MAP_FAILED)
+		goto close_fd;
+
 	r->len = st.st_size;
 	hdr = r->data;
+	if (hdr->version != UHT_VERSION_1 && hdr->version != UHT_VERSION_2) {
+		munmap(r->data, r->len);
+		goto close_fd;
+	}
+
+	r->version = hdr->version;
 	r->val = hdr->val;
 
 	return 0;
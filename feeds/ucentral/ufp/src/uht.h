@@ -13,6 +13,11 @@
 
 #define UHT_ALIGN_MASK ((1 << UHT_ALIGN_BITS) - 1)
 
+/* original layout, files were written with a zeroed version field */
+#define UHT_VERSION_1	0
+/* hashtable entries carry the key hash and length */
+#define UHT_VERSION_2	2
+
 enum uht_type {
 	UHT_NULL, /* can also be used as value */
 	UHT_STRING,
@@ -22,16 +27,25 @@ enum uht_type {
 	UHT_HASHTBL,
 	UHT_OBJECT,
 	UHT_ARRAY,
+	UHT_HASHTBL_MPH, /* minimal perfect hash, version 2 only */
 };
 
+struct uht_writer_stream;
+
 struct uht_writer {
 	struct avl_tree data;
 	void *buf;
 	size_t buf_ofs;
 	size_t buf_len;
+	uint8_t version;
+	bool error;
+
+	/* set when the file is written incrementally, see uht_writer_init_stream */
+	struct uht_writer_stream *stream;
 };
 
 uint32_t uht_writer_hashtbl_alloc(struct uht_writer *wr, size_t n_members);
+uint32_t uht_writer_mph_alloc(struct uht_writer *wr, size_t n_members);
 void uht_writer_hashtbl_add_element(struct uht_writer *wr, uint32_t hashtbl,
 				    const char *key, uint32_t val);
 void uht_writer_hashtbl_done(struct uht_writer *wr, uint32_t hashtbl);
@@ -42,6 +56,12 @@ uint32_t uht_writer_add_object(struct uht_writer *wr, uint32_t *keys,
 uint32_t uht_writer_add_string(struct uht_writer *wr, const char *val);
 uint32_t uht_writer_add_double(struct uht_writer *wr, double val);
 
+/*
+ * Marks a hashtable key as deleted. When looking up keys in a stack of files,
+ * it hides the key in all lower layers.
+ */
+#define UHT_DELETED	((1 << UHT_TYPE_BITS) | UHT_NULL)
+
 static inline uint32_t
 uht_writer_add_bool(struct uht_writer *wr, bool val)
 {
@@ -51,6 +71,9 @@ uht_writer_add_bool(struct uht_writer *wr, bool val)
 uint32_t uht_writer_add_int(struct uht_writer *wr, int64_t val);
 
 void uht_writer_init(struct uht_writer *wr);
+void uht_writer_init_version(struct uht_writer *wr, uint8_t version);
+int uht_writer_init_stream(struct uht_writer *wr, FILE *out, size_t mem_limit,
+			   const char *tmpdir);
 int uht_writer_save(struct uht_writer *wr, FILE *out, uint32_t val);
 void uht_writer_free(struct uht_writer *wr);
 
@@ -72,6 +95,13 @@ uht_entry_type(uint32_t attr)
 	return attr & UHT_TYPE_MASK;
 }
 
+static inline bool
+uht_entry_is_hashtbl(uint32_t attr)
+{
+	return uht_entry_type(attr) == UHT_HASHTBL ||
+	       uht_entry_type(attr) == UHT_HASHTBL_MPH;
+}
+
 static inline bool
 uht_entry_valid(size_t len, uint32_t attr)
 {
@@ -82,12 +112,14 @@ struct uht_reader {
 	void *data;
 	size_t len;
 	uint32_t val;
+	uint8_t version;
 	int fd;
 };
 
 struct uht_reader_iter {
 	uint32_t *__data;
 	uint8_t type;
+	uint8_t __skip;
 
 	uint32_t index, size;
 	const char *key;
@@ -131,6 +163,8 @@ void __uht_object_iter_next(struct uht_reader *r, struct uht_reader_iter *iter);
 struct uht_reader_iter __uht_object_iter_init(struct uht_reader *r, uint32_t attr);
 uint32_t uht_reader_hashtbl_lookup(struct uht_reader *r, uint32_t hashtbl,
 				   const char *key);
+uint32_t uht_reader_layers_lookup(struct uht_reader *layers, size_t n_layers,
+				  const char *key, struct uht_reader **layer);
 
 #define uht_for_each(r, iter, attr)							\
 	for (struct uht_reader_iter iter = __uht_object_iter_init(r, attr);		\